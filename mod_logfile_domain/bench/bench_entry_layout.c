@@ -0,0 +1,377 @@
+/*
+ * bench_entry_layout.c -- Cache misses per logged line, old vs. new entry layout
+ *
+ * Replays the per-line work on a domain entry (probe, CLOCK bit, append buffer and
+ * rollover accounting) over many domains picked at random, once on the previous layout
+ * with the name and path inline and once on the module's hot/cold layout allocated from
+ * its entry slabs. Cache misses come from perf_event_open() where the kernel allows it;
+ * the cache lines each layout touches per line are always reported.
+ *
+ * Usage: bench_entry_layout [-d domains] [-n lines]
+ *
+ */
+
+#include "../logfile_domain.h"
+
+SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load);
+SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_logfile_domain_shutdown);
+
+#include <stddef.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
+
+/* domain_cache_entry_t before the hot/cold split */
+typedef struct {
+    uint32_t hash;
+    switch_size_t domain_len;
+    char domain[128];
+    domain_sink_t sink;
+    switch_size_t log_size;
+    switch_size_t roll_size;
+    int suffix;
+    int rotate_pending;
+    char logfile_path[512];
+    switch_mutex_t *file_lock;
+    char *buf;
+    switch_size_t buf_len;
+    switch_size_t buf_size;
+    switch_size_t buf_cap;
+    switch_time_t buf_since;
+    switch_size_t unsynced;
+    int sync_pending;
+    int referenced;
+    switch_time_t last_used;
+    switch_memory_pool_t *pool;
+    uint32_t refs;
+    int retired;
+    switch_time_t retired_at;
+    void *next;
+} legacy_entry_t;
+
+#define LINE_LEN 120
+#define NAME_LEN 23  /* "tenant00000.example.com" */
+
+/* The fields a buffered line reads and writes, the same for both layouts */
+#define TOUCH_ENTRY(e, now)                                          \
+    do {                                                             \
+        (e)->refs++;                                                 \
+        (void)(e)->file_lock;                                        \
+        (e)->referenced = 1;                                         \
+        (e)->last_used = (now);                                      \
+        if ((e)->buf_len + LINE_LEN > (e)->buf_size) {               \
+            (e)->buf_len = 0;                                        \
+        }                                                            \
+        if (!(e)->buf_len) {                                         \
+            (e)->buf_since = (now);                                  \
+        }                                                            \
+        (e)->buf_len += LINE_LEN;                                    \
+        (e)->log_size += LINE_LEN;                                   \
+        if ((e)->log_size >= (e)->roll_size && !(e)->rotate_pending) { \
+            (e)->log_size = 0;                                       \
+        }                                                            \
+        (e)->refs--;                                                 \
+    } while (0)
+
+typedef struct {
+    int domains;
+    char **names;
+    uint32_t *picks;              /* 64K random domain indexes, replayed */
+    uint32_t mask;
+    legacy_entry_t **legacy;      /* by domain index, for lines whose entry is cached */
+    legacy_entry_t **legacy_slots;
+    domain_cache_entry_t **entries;
+    domain_cache_entry_t **slots; /* probed like domain_table_find() */
+} bench_t;
+
+/* A session line reaches its entry through the UUID cache, a fallback line probes by name */
+static void run_legacy(const bench_t *b, long lines, int probe, switch_time_t now)
+{
+    long l;
+
+    for (l = 0; l < lines; l++) {
+        uint32_t d = b->picks[l & 65535];
+        legacy_entry_t *e = b->legacy[d];
+
+        if (probe) {
+            const char *name = b->names[d];
+            switch_size_t len = NAME_LEN;
+            uint32_t h = domain_hash_func(name, len), j;
+
+            for (j = h & b->mask; (e = b->legacy_slots[j]); j = (j + 1) & b->mask) {
+                if (e->hash == h && e->domain_len == len && !memcmp(e->domain, name, len)) {
+                    break;
+                }
+            }
+        }
+        TOUCH_ENTRY(e, now);
+    }
+}
+
+static void run_hot_cold(const bench_t *b, long lines, int probe, switch_time_t now)
+{
+    long l;
+
+    for (l = 0; l < lines; l++) {
+        uint32_t d = b->picks[l & 65535];
+        domain_cache_entry_t *e = b->entries[d];
+
+        if (probe) {
+            const char *name = b->names[d];
+            switch_size_t len = NAME_LEN;
+            uint32_t h = domain_hash_func(name, len), j;
+
+            for (j = h & b->mask; (e = b->slots[j]); j = (j + 1) & b->mask) {
+                if (e->hash == h && e->domain->len == len && !memcmp(e->domain->str, name, len)) {
+                    break;
+                }
+            }
+        }
+        TOUCH_ENTRY(e, now);
+    }
+}
+
+static int perf_fd = -1;
+
+static void perf_open(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void perf_start(void)
+{
+#ifdef __linux__
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static int64_t perf_stop(void)
+{
+    uint64_t count = 0;
+
+#ifdef __linux__
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf_fd, &count, sizeof(count)) == sizeof(count)) {
+            return (int64_t)count;
+        }
+    }
+#endif
+
+    return -1;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Distinct cache lines of an entry spanned by the fields TOUCH_ENTRY and the probe use,
+   with the name bytes read by the probe at [name_off, name_off + name_len) */
+#define LINES_TOUCHED(type, name_off, name_len)                                       \
+    lines_touched((size_t[]) { offsetof(type, hash), offsetof(type, refs),             \
+                               offsetof(type, file_lock), offsetof(type, referenced),  \
+                               offsetof(type, last_used), offsetof(type, buf_len),     \
+                               offsetof(type, buf_size), offsetof(type, buf_since),    \
+                               offsetof(type, log_size), offsetof(type, roll_size),    \
+                               offsetof(type, rotate_pending) }, 11, (name_off), (name_len))
+
+static int lines_touched(const size_t *offs, int n, size_t name_off, size_t name_len)
+{
+    uint64_t seen = 0;
+    size_t off;
+    int i, lines = 0;
+
+    for (i = 0; i < n; i++) {
+        seen |= 1ULL << (offs[i] / 64);
+    }
+    for (off = name_off; off < name_off + name_len; off += 64 - off % 64) {
+        seen |= 1ULL << (off / 64);
+    }
+    for (i = 0; i < 64; i++) {
+        lines += (seen >> i) & 1;
+    }
+
+    return lines;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *modes[] = { "cached", "probe" };
+    switch_loadable_module_interface_t *mi = NULL;
+    switch_memory_pool_t *pool = NULL;
+    char logdir[] = "/tmp/bench_entry_layout.XXXXXX";
+    bench_t b;
+    uint32_t size, seed = 12345;
+    long lines = 20000000;
+    int opt, i, mode, layout;
+
+    memset(&b, 0, sizeof(b));
+    b.domains = 16384;
+
+    while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+        switch (opt) {
+        case 'd':
+            b.domains = atoi(optarg);
+            break;
+        case 'n':
+            lines = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d domains] [-n lines]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (b.domains < 1 || b.domains > 99999 || lines < 1) {
+        fprintf(stderr, "domains must be 1..99999\n");
+        return 1;
+    }
+
+    if (!mkdtemp(logdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    SWITCH_GLOBAL_dirs.log_dir = logdir;
+
+    switch_core_new_memory_pool(&pool);
+    mod_logfile_domain_load(&mi, pool);
+
+    for (size = 16; size < (uint32_t)b.domains * 2; size <<= 1);
+    b.mask = size - 1;
+    b.legacy_slots = calloc(size, sizeof(*b.legacy_slots));
+    b.slots = calloc(size, sizeof(*b.slots));
+    b.legacy = calloc(b.domains, sizeof(*b.legacy));
+    b.entries = calloc(b.domains, sizeof(*b.entries));
+    b.names = calloc(b.domains, sizeof(*b.names));
+    b.picks = malloc(sizeof(*b.picks) * 65536);
+
+    /* The old layout from module_pool as before the slabs, the new one the way
+       get_domain_entry() builds it, minus opening the file */
+    switch_mutex_lock(globals.mutex);
+    for (i = 0; i < b.domains; i++) {
+        domain_cache_entry_t *entry;
+        legacy_entry_t *old;
+        uint32_t h;
+
+        b.names[i] = malloc(64);
+        snprintf(b.names[i], 64, "tenant%05d.example.com", i);
+        h = domain_hash_func(b.names[i], NAME_LEN);
+
+        old = switch_core_alloc(module_pool, sizeof(*old));
+        old->hash = h;
+        old->domain_len = NAME_LEN;
+        memcpy(old->domain, b.names[i], NAME_LEN + 1);
+        snprintf(old->logfile_path, sizeof(old->logfile_path), "%s/domain_%s.log", logdir, b.names[i]);
+        old->buf_size = globals.buffer_size;
+        old->roll_size = 10485760;
+        b.legacy[i] = old;
+
+        entry = domain_entry_alloc();
+        switch_core_new_memory_pool(&entry->pool);
+        switch_mutex_init(&entry->file_lock, SWITCH_MUTEX_NESTED, entry->pool);
+        entry->domain = domain_str_new(entry->pool, b.names[i], NAME_LEN);
+        entry->hash = h;
+        build_domain_logfile_path(entry);
+        entry->buf_size = globals.buffer_size;
+        entry->roll_size = 10485760;
+        b.entries[i] = entry;
+
+        for (h &= b.mask; b.slots[h]; h = (h + 1) & b.mask);
+        b.legacy_slots[h] = old;
+        b.slots[h] = entry;
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    for (i = 0; i < 65536; i++) {
+        seed = seed * 1103515245U + 12345U;
+        b.picks[i] = (seed >> 8) % (uint32_t)b.domains;
+    }
+
+    perf_open();
+
+    printf("domains=%d lines=%ld entry-bytes inline=%zu hot/cold=%zu\n", b.domains, lines,
+           sizeof(legacy_entry_t), sizeof(domain_cache_entry_t));
+    printf("%8s %8s %14s %14s %10s\n", "layout", "lookup", "lines touched", "misses/line", "ns/line");
+
+    for (mode = 0; mode < 2; mode++) {
+        for (layout = 0; layout < 2; layout++) {
+            switch_time_t now = switch_micro_time_now();
+            double start, elapsed;
+            int64_t misses;
+            int touched;
+
+            start = now_sec();
+            perf_start();
+            if (layout == 0) {
+                run_legacy(&b, lines, mode, now);
+                touched = LINES_TOUCHED(legacy_entry_t, offsetof(legacy_entry_t, domain), mode ? NAME_LEN : 0);
+            } else {
+                run_hot_cold(&b, lines, mode, now);
+                /* a probe also reads the name in its own block */
+                touched = LINES_TOUCHED(domain_cache_entry_t, offsetof(domain_cache_entry_t, domain),
+                                        mode ? sizeof(void *) : 0) + mode;
+            }
+            misses = perf_stop();
+            elapsed = now_sec() - start;
+
+            printf("%8s %8s %14d", layout ? "hot/cold" : "inline", modes[mode], touched);
+            if (misses >= 0) {
+                printf(" %14.2f", (double)misses / lines);
+            } else {
+                printf(" %14s", "n/a");
+            }
+            printf(" %10.1f\n", elapsed * 1e9 / lines);
+        }
+    }
+
+    if (perf_fd < 0) {
+        printf("(hardware cache counters unavailable, see perf_event_paranoid)\n");
+    }
+
+    switch_mutex_lock(globals.mutex);
+    for (i = 0; i < b.domains; i++) {
+        domain_entry_free(b.entries[i]);
+        free(b.names[i]);
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    mod_logfile_domain_shutdown();
+    switch_core_destroy_memory_pool(&pool);
+
+    {
+        char path[512];
+
+        snprintf(path, sizeof(path), "%s/switch_mod_logfile_domain_loaded", logdir);
+        unlink(path);
+    }
+    rmdir(logdir);
+    free(b.picks);
+    free(b.names);
+    free(b.entries);
+    free(b.legacy);
+    free(b.slots);
+    free(b.legacy_slots);
+
+    return 0;
+}
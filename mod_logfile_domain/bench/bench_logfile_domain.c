@@ -0,0 +1,460 @@
+/*
+ * bench_logfile_domain.c -- End-to-end logger throughput, CPU cost and tail latency
+ *
+ * Drives the bound logger callback from several threads with synthetic
+ * switch_log_node_t streams, the way the FreeSWITCH core would, and waits
+ * until every accepted line is on disk. Lines are prepared up front so only
+ * the module is measured: a mix of levels, message sizes, and lines that
+ * carry a session UUID or only name their domain in the text.
+ *
+ * Without -c the module runs from a generated config: -w writer threads
+ * (0 for synchronous writes) and -L as the "all" level map. With -c the
+ * given logfile_domain.conf.xml is used as is, and its log-dir wins over -o.
+ * Logs are removed at the end unless -k or -o is given.
+ *
+ * Usage: bench_logfile_domain [-d domains] [-S sessions] [-t threads] [-n lines_per_thread]
+ *                             [-s min_bytes[:max_bytes]] [-l level=weight,...] [-L mapped_levels]
+ *                             [-u session_pct] [-w writers] [-r lines_per_sec_per_thread]
+ *                             [-c config.xml] [-o log_dir] [-k] [-m min_lines_per_sec]
+ *
+ * Exits 2 when -m is given and fewer lines per second were written, so it
+ * can gate performance regressions in CI.
+ *
+ */
+
+#include "../logfile_domain.h"
+
+SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load);
+SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_logfile_domain_shutdown);
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define BENCH_RING 1024            /* prepared lines per thread, replayed in order */
+#define BENCH_MAX_THREADS 256
+
+static const char *const bench_sources[] = { "switch_core_state_machine.c", "switch_channel.c", "mod_sofia.c", "switch_rtp.c" };
+
+typedef struct {
+    switch_log_node_t node;
+    switch_log_level_t level;
+} bench_line_t;
+
+typedef struct {
+    bench_line_t *ring;
+    long lines;
+    long rate;
+    uint64_t accepted;           /* lines the level map let through */
+    uint64_t hist[LATENCY_BUCKETS];
+    uint64_t max_ns;
+} bench_thread_t;
+
+static switch_log_function_t bench_logger;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_sec(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* "debug=70,info=20,err=10" into cumulative weights per level */
+static int parse_level_mix(const char *spec, int *weights)
+{
+    char *dup = strdup(spec), *p, *next;
+    int total = 0;
+
+    memset(weights, 0, sizeof(int) * (SWITCH_LOG_DEBUG + 1));
+
+    for (p = dup; p && *p; p = next) {
+        char *eq;
+        switch_log_level_t level;
+
+        if ((next = strchr(p, ','))) {
+            *next++ = '\0';
+        }
+        if (!(eq = strchr(p, '='))) {
+            break;
+        }
+        *eq++ = '\0';
+        level = switch_log_str2level(p);
+        if (level > SWITCH_LOG_DEBUG || atoi(eq) < 0) {
+            free(dup);
+            return 0;
+        }
+        weights[level] += atoi(eq);
+        total += atoi(eq);
+    }
+
+    free(dup);
+
+    return total;
+}
+
+static uint32_t bench_rand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245U + 12345U;
+
+    return *seed >> 8;
+}
+
+/* One thread's ring of lines: random level by weight, size in [min, max], and either a
+   session UUID or " domain_name=..." at the end of the text */
+static bench_line_t *build_ring(int thread, int domains, int sessions, char **uuids, int min_size, int max_size,
+                                const int *weights, int total_weight, int session_pct)
+{
+    bench_line_t *ring = calloc(BENCH_RING, sizeof(*ring));
+    uint32_t seed = 0x9e3779b9U * (uint32_t)(thread + 1);
+    int i;
+
+    for (i = 0; i < BENCH_RING; i++) {
+        bench_line_t *bl = &ring[i];
+        int pick = (int)(bench_rand(&seed) % (uint32_t)total_weight), level = 0;
+        int size = min_size + (int)(bench_rand(&seed) % (uint32_t)(max_size - min_size + 1));
+        int session = (int)(bench_rand(&seed) % (uint32_t)sessions);
+        char *msg = malloc(size + 64);
+        int len;
+
+        while (pick >= weights[level]) {
+            pick -= weights[level++];
+        }
+
+        len = snprintf(msg, size + 64, "bench thread %d line %d ", thread, i);
+        while (len < size) {
+            msg[len] = (char)('a' + len % 26);
+            len++;
+        }
+        if ((int)(bench_rand(&seed) % 100) < session_pct) {
+            bl->node.userdata = uuids[session];
+            bl->node.channel = SWITCH_CHANNEL_ID_SESSION;
+            msg[len] = '\0';
+        } else {
+            bl->node.channel = SWITCH_CHANNEL_ID_LOG;
+            snprintf(msg + len, 64, " domain_name=tenant%d.example.com", session % domains);
+        }
+        strcat(msg, "\n");
+
+        bl->level = (switch_log_level_t)level;
+        bl->node.data = msg;
+        bl->node.content = msg;
+        bl->node.level = bl->level;
+        bl->node.line = 100 + i;
+        switch_copy_string(bl->node.file, bench_sources[i % switch_arraylen(bench_sources)], sizeof(bl->node.file));
+        switch_copy_string(bl->node.func, "bench_func", sizeof(bl->node.func));
+    }
+
+    return ring;
+}
+
+static void *bench_thread(void *arg)
+{
+    bench_thread_t *bt = arg;
+    const level_map_t *map = __atomic_load_n(&globals.level_map, __ATOMIC_ACQUIRE);
+    double start = now_sec();
+    long i;
+
+    for (i = 0; i < bt->lines; i++) {
+        bench_line_t *bl = &bt->ring[i % BENCH_RING];
+        uint64_t t0, ns;
+
+        /* Open loop: sleep off any lead over the requested rate every 64 lines */
+        if (bt->rate && !(i & 63)) {
+            double ahead = (double)i / bt->rate - (now_sec() - start);
+
+            if (ahead > 0) {
+                usleep((useconds_t)(ahead * 1e6));
+            }
+        }
+
+        bl->node.timestamp = switch_micro_time_now();
+        t0 = latency_now();
+        bench_logger(&bl->node, bl->level);
+        ns = latency_ns(latency_now() - t0);
+
+        bt->hist[latency_index(ns)]++;
+        if (ns > bt->max_ns) {
+            bt->max_ns = ns;
+        }
+        if (level_map_lookup(map, bl->node.file)->mask & (1U << bl->level)) {
+            bt->accepted++;
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+    uint64_t want = (uint64_t)(total * pct / 100.0), seen = 0;
+    int i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > want) {
+            return latency_bucket_max(i);
+        }
+    }
+
+    return latency_bucket_max(LATENCY_BUCKETS - 1);
+}
+
+static int write_config(const char *path, const char *logdir, int writers, const char *levels)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        return -1;
+    }
+
+    fprintf(f, "<configuration name=\"logfile_domain.conf\">\n  <settings>\n");
+    fprintf(f, "    <param name=\"async-write\" value=\"%s\"/>\n", writers ? "true" : "false");
+    if (writers) {
+        fprintf(f, "    <param name=\"writer-threads\" value=\"%d\"/>\n", writers);
+    }
+    fprintf(f, "  </settings>\n  <profiles>\n    <profile name=\"default\">\n      <settings>\n");
+    fprintf(f, "        <param name=\"log-dir\" value=\"%s\"/>\n", logdir);
+    fprintf(f, "      </settings>\n      <mappings>\n        <map name=\"all\" value=\"%s\"/>\n", levels);
+    fprintf(f, "      </mappings>\n    </profile>\n  </profiles>\n</configuration>\n");
+
+    return fclose(f);
+}
+
+/* Domain logs, rotated generations and the module's marker file; nothing below them */
+static void remove_log_dir(const char *logdir)
+{
+    DIR *dir = opendir(logdir);
+    struct dirent *de;
+
+    while (dir && (de = readdir(dir))) {
+        char path[1024];
+
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", logdir, de->d_name);
+        unlink(path);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    rmdir(logdir);
+}
+
+int main(int argc, char **argv)
+{
+    switch_loadable_module_interface_t *mi = NULL;
+    switch_memory_pool_t *pool = NULL;
+    char logdir[512] = "/tmp/bench_logfile_domain.XXXXXX", config[600];
+    const char *mix = "debug=70,info=20,notice=5,warning=4,err=1", *levels = "info,notice,warning,err,crit,alert";
+    const char *config_file = NULL, *out_dir = NULL;
+    int domains = 64, sessions = 0, threads = 4, writers = 2, session_pct = 90, min_size = 80, max_size = 200;
+    int keep = 0, opt, i, total_weight, weights[SWITCH_LOG_DEBUG + 1];
+    long lines = 200000, rate = 0;
+    double min_rate = 0, start, offered_at, drained_at, cpu;
+    pthread_t tids[BENCH_MAX_THREADS];
+    bench_thread_t *bt;
+    switch_core_session_t **ss;
+    char **uuids;
+    uint64_t hist[LATENCY_BUCKETS] = { 0 }, max_ns = 0, offered, accepted = 0, dropped, limited, written;
+
+    while ((opt = getopt(argc, argv, "d:S:t:n:s:l:L:u:w:r:c:o:km:")) != -1) {
+        switch (opt) {
+        case 'd':
+            domains = atoi(optarg);
+            break;
+        case 'S':
+            sessions = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            lines = atol(optarg);
+            break;
+        case 's':
+            min_size = max_size = atoi(optarg);
+            if (strchr(optarg, ':')) {
+                max_size = atoi(strchr(optarg, ':') + 1);
+            }
+            break;
+        case 'l':
+            mix = optarg;
+            break;
+        case 'L':
+            levels = optarg;
+            break;
+        case 'u':
+            session_pct = atoi(optarg);
+            break;
+        case 'w':
+            writers = atoi(optarg);
+            break;
+        case 'r':
+            rate = atol(optarg);
+            break;
+        case 'c':
+            config_file = optarg;
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        case 'm':
+            min_rate = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d domains] [-S sessions] [-t threads] [-n lines_per_thread]\n"
+                    "          [-s min_bytes[:max_bytes]] [-l level=weight,...] [-L mapped_levels]\n"
+                    "          [-u session_pct] [-w writers] [-r lines_per_sec_per_thread]\n"
+                    "          [-c config.xml] [-o log_dir] [-k] [-m min_lines_per_sec]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!sessions) {
+        sessions = domains * 4;
+    }
+    if (domains < 1 || domains > DEFAULT_MAX_DOMAINS || sessions < 1 || threads < 1 || threads > BENCH_MAX_THREADS ||
+        lines < 1 || min_size < 1 || max_size < min_size || max_size > 65536 || session_pct < 0 || session_pct > 100 ||
+        writers < 0 || writers > MAX_WRITER_THREADS || rate < 0) {
+        fprintf(stderr, "domains must be 1..%d, threads 1..%d, writers 0..%d, sizes 1..65536 and -u 0..100\n",
+                DEFAULT_MAX_DOMAINS, BENCH_MAX_THREADS, MAX_WRITER_THREADS);
+        return 1;
+    }
+    if (!(total_weight = parse_level_mix(mix, weights))) {
+        fprintf(stderr, "bad level mix: %s\n", mix);
+        return 1;
+    }
+
+    if (out_dir) {
+        switch_copy_string(logdir, out_dir, sizeof(logdir));
+        mkdir(logdir, 0755);
+    } else if (!mkdtemp(logdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    SWITCH_GLOBAL_dirs.log_dir = logdir;
+
+    if (!config_file) {
+        snprintf(config, sizeof(config), "%s/bench.conf.xml", logdir);
+        if (write_config(config, logdir, writers, levels)) {
+            perror(config);
+            return 1;
+        }
+        config_file = config;
+    }
+    switch_stub_set_config_file(config_file);
+
+    switch_core_new_memory_pool(&pool);
+    if (mod_logfile_domain_load(&mi, pool) != SWITCH_STATUS_SUCCESS || !(bench_logger = switch_stub_bound_logger())) {
+        fprintf(stderr, "module failed to load\n");
+        return 1;
+    }
+    latency_calibrate();
+
+    uuids = calloc(sessions, sizeof(char *));
+    ss = calloc(sessions, sizeof(*ss));
+    for (i = 0; i < sessions; i++) {
+        char domain[64];
+
+        uuids[i] = malloc(40);
+        snprintf(uuids[i], 40, "00000000-bench-%08d", i);
+        snprintf(domain, sizeof(domain), "tenant%d.example.com", i % domains);
+        ss[i] = switch_stub_session_create(uuids[i]);
+        switch_stub_session_set_variable(ss[i], "domain_name", domain);
+    }
+
+    bt = calloc(threads, sizeof(*bt));
+    for (i = 0; i < threads; i++) {
+        bt[i].ring = build_ring(i, domains, sessions, uuids, min_size, max_size, weights, total_weight, session_pct);
+        bt[i].lines = lines;
+        bt[i].rate = rate;
+    }
+
+    printf("domains=%d sessions=%d threads=%d lines/thread=%ld size=%d..%d session-pct=%d rate/thread=%ld cpus=%ld\n",
+           domains, sessions, threads, lines, min_size, max_size, session_pct, rate, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("config=%s async-write=%s writers=%u mix=%s\n", config_file, globals.async_write ? "true" : "false",
+           globals.writer_count, mix);
+
+    cpu = cpu_sec();
+    start = now_sec();
+    for (i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, bench_thread, &bt[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        int b;
+
+        pthread_join(tids[i], NULL);
+        for (b = 0; b < LATENCY_BUCKETS; b++) {
+            hist[b] += bt[i].hist[b];
+        }
+        if (bt[i].max_ns > max_ns) {
+            max_ns = bt[i].max_ns;
+        }
+        accepted += bt[i].accepted;
+    }
+    offered_at = now_sec();
+    dropped = __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED);
+    limited = __atomic_load_n(&globals.rate_limited, __ATOMIC_RELAXED);
+
+    /* Shutdown drains the queues and flushes every buffer before it returns */
+    mod_logfile_domain_shutdown();
+    drained_at = now_sec();
+    cpu = cpu_sec() - cpu;
+
+    offered = (uint64_t)threads * (uint64_t)lines;
+    written = accepted - dropped - limited;
+
+    printf("offered:  %12.0f lines/s  (%" PRIu64 " lines in %.3f s)\n", offered / (offered_at - start), offered, offered_at - start);
+    printf("written:  %12.0f lines/s  (%" PRIu64 " lines on disk after %.3f s, %" PRIu64 " below the level map, %" PRIu64 " dropped, %" PRIu64 " rate-limited)\n",
+           written / (drained_at - start), written, drained_at - start, offered - accepted, dropped, limited);
+    printf("cpu:      %12.0f ns/line offered, %.0f ns/line written (%.3f s on all threads)\n",
+           cpu * 1e9 / offered, written ? cpu * 1e9 / written : 0.0, cpu);
+    printf("callback: p50 %" PRIu64 " ns, p90 %" PRIu64 " ns, p99 %" PRIu64 " ns, p99.9 %" PRIu64 " ns, p99.99 %" PRIu64 " ns, max %" PRIu64 " ns\n",
+           hist_percentile(hist, offered, 50), hist_percentile(hist, offered, 90), hist_percentile(hist, offered, 99),
+           hist_percentile(hist, offered, 99.9), hist_percentile(hist, offered, 99.99), max_ns);
+
+    for (i = 0; i < sessions; i++) {
+        switch_stub_session_destroy(ss[i]);
+        free(uuids[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        int j;
+
+        for (j = 0; j < BENCH_RING; j++) {
+            free(bt[i].ring[j].node.data);
+        }
+        free(bt[i].ring);
+    }
+    free(bt);
+    free(ss);
+    free(uuids);
+    switch_core_destroy_memory_pool(&pool);
+
+    if (keep || out_dir) {
+        printf("logs kept in %s\n", logdir);
+    } else {
+        remove_log_dir(logdir);
+    }
+
+    if (min_rate > 0 && written / (drained_at - start) < min_rate) {
+        fprintf(stderr, "written %.0f lines/s is below the %.0f lines/s floor\n", written / (drained_at - start), min_rate);
+        return 2;
+    }
+
+    return 0;
+}
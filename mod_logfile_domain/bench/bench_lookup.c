@@ -0,0 +1,187 @@
+/*
+ * bench_lookup.c -- Domain lookup throughput vs. thread count
+ *
+ * Compares the lock-free hit path of get_domain_entry() with the same probe
+ * wrapped in globals.mutex, which is what every cache hit used to cost.
+ * The core's internals come from logfile_domain.h and the module is linked
+ * in whole; FreeSWITCH is replaced by the stub in bench/stub.
+ *
+ * Usage: bench_lookup [-d domains] [-t max_threads] [-n lookups_per_thread]
+ *
+ */
+
+#include "../logfile_domain.h"
+
+SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load);
+SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_logfile_domain_shutdown);
+
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+    int domains;
+    long lookups;
+    int locked;
+    char **names;
+    uint64_t found;
+} bench_thread_t;
+
+static domain_cache_entry_t *locked_lookup(const char *domain)
+{
+    domain_cache_entry_t *entry;
+    switch_size_t len = strlen(domain);
+
+    switch_mutex_lock(globals.mutex);
+    entry = domain_table_find(globals.domain_table, domain, len, domain_hash_func(domain, len));
+    switch_mutex_unlock(globals.mutex);
+
+    return entry;
+}
+
+static void *bench_thread(void *arg)
+{
+    bench_thread_t *bt = arg;
+    uint32_t seed = (uint32_t)(uintptr_t)bt;
+    long i;
+
+    for (i = 0; i < bt->lookups; i++) {
+        domain_cache_entry_t *entry;
+        const char *name;
+
+        seed = seed * 1103515245U + 12345U;
+        name = bt->names[(seed >> 8) % (uint32_t)bt->domains];
+
+        /* both come back held, as a line would take them */
+        if ((entry = bt->locked ? locked_lookup(name) : get_domain_entry(name, strlen(name)))) {
+            domain_entry_release(entry);
+            bt->found++;
+        }
+    }
+
+    return NULL;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int threads, int locked, int domains, long lookups, char **names)
+{
+    pthread_t tids[256];
+    bench_thread_t bt[256];
+    double start, elapsed;
+    int i;
+
+    for (i = 0; i < threads; i++) {
+        bt[i].domains = domains;
+        bt[i].lookups = lookups;
+        bt[i].locked = locked;
+        bt[i].names = names;
+        bt[i].found = 0;
+    }
+
+    start = now_sec();
+    for (i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, bench_thread, &bt[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        if (bt[i].found != (uint64_t)lookups) {
+            fprintf(stderr, "thread %d missed %" PRIu64 " lookups\n", i, (uint64_t)lookups - bt[i].found);
+        }
+    }
+    elapsed = now_sec() - start;
+
+    return (double)threads * lookups / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    switch_loadable_module_interface_t *mi = NULL;
+    switch_memory_pool_t *pool = NULL;
+    char logdir[] = "/tmp/bench_lookup.XXXXXX";
+    char **names;
+    int domains = 64, max_threads = 8;
+    long lookups = 2000000;
+    int opt, i, t;
+
+    while ((opt = getopt(argc, argv, "d:t:n:")) != -1) {
+        switch (opt) {
+        case 'd':
+            domains = atoi(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            lookups = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d domains] [-t max_threads] [-n lookups_per_thread]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (domains < 1 || domains > DEFAULT_MAX_DOMAINS || max_threads < 1 || max_threads > 256 || lookups < 1) {
+        fprintf(stderr, "domains must be 1..%d, threads 1..256\n", DEFAULT_MAX_DOMAINS);
+        return 1;
+    }
+
+    if (!mkdtemp(logdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    SWITCH_GLOBAL_dirs.log_dir = logdir;
+
+    switch_core_new_memory_pool(&pool);
+    mod_logfile_domain_load(&mi, pool);
+
+    names = calloc(domains, sizeof(char *));
+    for (i = 0; i < domains; i++) {
+        domain_cache_entry_t *entry;
+
+        names[i] = malloc(64);
+        snprintf(names[i], 64, "tenant%d.example.com", i);
+        if (!(entry = get_domain_entry(names[i], strlen(names[i])))) {
+            fprintf(stderr, "failed to create %s\n", names[i]);
+            return 1;
+        }
+        domain_entry_release(entry);
+    }
+
+    printf("domains=%d lookups/thread=%ld cpus=%ld\n", domains, lookups, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %16s %16s %8s\n", "threads", "lock-free M/s", "mutex M/s", "speedup");
+
+    for (t = 1; t <= max_threads; t *= 2) {
+        double lf = run(t, 0, domains, lookups, names);
+        double mx = run(t, 1, domains, lookups, names);
+
+        printf("%8d %16.2f %16.2f %7.2fx\n", t, lf, mx, lf / mx);
+    }
+
+    mod_logfile_domain_shutdown();
+    switch_core_destroy_memory_pool(&pool);
+
+    for (i = 0; i < domains; i++) {
+        char path[512];
+
+        snprintf(path, sizeof(path), "%s/domain_%s.log", logdir, names[i]);
+        unlink(path);
+        free(names[i]);
+    }
+    {
+        char path[512];
+
+        snprintf(path, sizeof(path), "%s/switch_mod_logfile_domain_loaded", logdir);
+        unlink(path);
+    }
+    rmdir(logdir);
+    free(names);
+
+    return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * switch.h -- Minimal FreeSWITCH stand-in for the mod_logfile_domain benchmarks
+ *
+ * Declares only the parts of the FreeSWITCH core API that mod_logfile_domain.c
+ * uses, with the same names and signatures, so the module source can be built
+ * and driven on a plain Linux box. The implementations live in switch_stub.c
+ * and are backed by pthreads and POSIX file I/O.
+ *
+ */
+
+#ifndef SWITCH_STUB_H
+#define SWITCH_STUB_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/* Basic types */
+
+typedef enum {
+    SWITCH_STATUS_SUCCESS = 0,
+    SWITCH_STATUS_FALSE = 1,
+    SWITCH_STATUS_GENERR = 2,
+    SWITCH_STATUS_TIMEOUT = 3,
+    SWITCH_STATUS_BREAK = 9,
+    SWITCH_STATUS_MEMERR = 10,
+    SWITCH_STATUS_TERM = 22,
+    SWITCH_STATUS_NOTFOUND = 23,
+    SWITCH_STATUS_INUSE = 26
+} switch_status_t;
+
+typedef enum {
+    SWITCH_FALSE = 0,
+    SWITCH_TRUE = 1
+} switch_bool_t;
+
+typedef enum {
+    SWITCH_LOG_DEBUG10 = 110,
+    SWITCH_LOG_DEBUG1 = 101,
+    SWITCH_LOG_DEBUG = 7,
+    SWITCH_LOG_INFO = 6,
+    SWITCH_LOG_NOTICE = 5,
+    SWITCH_LOG_WARNING = 4,
+    SWITCH_LOG_ERROR = 3,
+    SWITCH_LOG_CRIT = 2,
+    SWITCH_LOG_ALERT = 1,
+    SWITCH_LOG_CONSOLE = 0,
+    SWITCH_LOG_DISABLE = -1,
+    SWITCH_LOG_INVALID = 64,
+    SWITCH_LOG_UNINIT = 1000
+} switch_log_level_t;
+
+typedef enum {
+    SWITCH_CHANNEL_ID_LOG,
+    SWITCH_CHANNEL_ID_LOG_CLEAN,
+    SWITCH_CHANNEL_ID_EVENT,
+    SWITCH_CHANNEL_ID_SESSION
+} switch_text_channel_t;
+
+typedef int64_t switch_time_t;
+typedef int64_t switch_interval_time_t;
+typedef size_t switch_size_t;
+typedef ssize_t switch_ssize_t;
+
+typedef struct switch_memory_pool switch_memory_pool_t;
+typedef struct switch_hash switch_hash_t;
+typedef struct switch_hash_index switch_hash_index_t;
+typedef struct switch_file switch_file_t;
+typedef struct switch_mutex switch_mutex_t;
+typedef struct switch_thread_cond switch_thread_cond_t;
+typedef struct switch_thread switch_thread_t;
+typedef struct switch_threadattr switch_threadattr_t;
+typedef struct switch_core_session switch_core_session_t;
+typedef struct switch_channel switch_channel_t;
+typedef struct switch_event_node switch_event_node_t;
+typedef struct switch_loadable_module_interface switch_loadable_module_interface_t;
+typedef struct switch_api_interface switch_api_interface_t;
+
+/* XML */
+
+struct switch_xml {
+    char *name;
+    char **attr;
+    char *txt;
+    struct switch_xml *next;
+    struct switch_xml *sibling;
+    struct switch_xml *child;
+    struct switch_xml *parent;
+};
+typedef struct switch_xml *switch_xml_t;
+
+/* Events */
+
+typedef enum {
+    SWITCH_EVENT_CUSTOM,
+    SWITCH_EVENT_CHANNEL_DESTROY,
+    SWITCH_EVENT_CHANNEL_EXECUTE_COMPLETE,
+    SWITCH_EVENT_RELOADXML,
+    SWITCH_EVENT_TRAP,
+    SWITCH_EVENT_ALL
+} switch_event_types_t;
+
+typedef struct switch_event_header {
+    char *name;
+    char *value;
+    struct switch_event_header *next;
+} switch_event_header_t;
+
+typedef struct switch_event {
+    switch_event_types_t event_id;
+    switch_event_header_t *headers;
+} switch_event_t;
+
+typedef void (*switch_event_callback_t) (switch_event_t *);
+
+#define SWITCH_EVENT_SUBCLASS_ANY NULL
+
+/* Logging */
+
+typedef struct {
+    char *data;
+    char file[80];
+    uint32_t line;
+    char func[80];
+    switch_log_level_t level;
+    switch_time_t timestamp;
+    char *content;
+    char *userdata;
+    switch_text_channel_t channel;
+    switch_log_level_t slevel;
+    switch_event_t *tags;
+} switch_log_node_t;
+
+typedef switch_status_t (*switch_log_function_t) (const switch_log_node_t *node, switch_log_level_t level);
+
+#define SWITCH_CHANNEL_LOG SWITCH_CHANNEL_ID_LOG, __FILE__, __func__, __LINE__, NULL
+
+/* Streams and API interfaces */
+
+typedef struct switch_stream_handle switch_stream_handle_t;
+typedef switch_status_t (*switch_stream_handle_write_function_t) (switch_stream_handle_t *handle, const char *fmt, ...);
+
+struct switch_stream_handle {
+    switch_stream_handle_write_function_t write_function;
+    void *data;
+    void *end;
+    switch_size_t data_size;
+    switch_size_t data_len;
+};
+
+typedef switch_status_t (*switch_api_function_t) (const char *cmd, switch_core_session_t *session, switch_stream_handle_t *stream);
+
+#define SWITCH_STANDARD_API(name) static switch_status_t name (const char *cmd, switch_core_session_t *session, switch_stream_handle_t *stream)
+#define SWITCH_ADD_API(api_int, int_name, descript, funcptr, syntax_string) \
+    api_int = switch_stub_add_api(*module_interface, int_name, descript, funcptr, syntax_string)
+
+/* Modules */
+
+#define SWITCH_MODULE_LOAD_ARGS (switch_loadable_module_interface_t **module_interface, switch_memory_pool_t *pool)
+#define SWITCH_MODULE_LOAD_FUNCTION(name) switch_status_t name SWITCH_MODULE_LOAD_ARGS
+#define SWITCH_MODULE_SHUTDOWN_FUNCTION(name) switch_status_t name (void)
+#define SWITCH_MODULE_DEFINITION(name, load, shutdown, runtime) static const char modname[] = #name
+
+/* Time */
+
+typedef struct {
+    int32_t tm_usec;
+    int32_t tm_sec;
+    int32_t tm_min;
+    int32_t tm_hour;
+    int32_t tm_mday;
+    int32_t tm_mon;
+    int32_t tm_year;
+    int32_t tm_wday;
+    int32_t tm_yday;
+    int32_t tm_isdst;
+    int32_t tm_gmtoff;
+} switch_time_exp_t;
+
+/* Globals */
+
+typedef struct {
+    char *log_dir;
+    char *conf_dir;
+} switch_directories;
+
+extern switch_directories SWITCH_GLOBAL_dirs;
+
+/* Misc macros */
+
+#define SWITCH_DECLARE(type) type
+#define SWITCH_THREAD_FUNC
+#define SWITCH_PATH_SEPARATOR "/"
+#define SWITCH_FOPEN_READ 0x00001
+#define SWITCH_FOPEN_WRITE 0x00002
+#define SWITCH_FOPEN_CREATE 0x00004
+#define SWITCH_FOPEN_APPEND 0x00008
+#define SWITCH_FOPEN_TRUNCATE 0x00010
+#define SWITCH_FPROT_OS_DEFAULT 0x0FFF
+#define SWITCH_DEFAULT_DIR_PERMS 0x0755
+#define SWITCH_UUID_FORMATTED_LENGTH 36
+#define SWITCH_SIZE_T_FMT "zu"
+#define SWITCH_MUTEX_DEFAULT 0x0
+#define SWITCH_MUTEX_NESTED 0x1
+#define SWITCH_THREAD_STACKSIZE 240 * 1024
+#define SWITCH_PRI_LOW 1
+#define SWITCH_PRI_NORMAL 10
+#define SWITCH_SEEK_SET SEEK_SET
+
+#define zstr(s) (!(s) || *(s) == '\0')
+#define switch_true(expr) ((expr) && (!strcasecmp(expr, "yes") || !strcasecmp(expr, "on") || \
+                                      !strcasecmp(expr, "true") || !strcasecmp(expr, "t") || \
+                                      !strcasecmp(expr, "enabled") || !strcasecmp(expr, "active") || \
+                                      !strcasecmp(expr, "allow") || atoi(expr)))
+#define switch_zmalloc(ptr, len) (void)(ptr = calloc(1, (len)))
+#define switch_malloc(ptr, len) (void)(ptr = malloc((len)))
+#define switch_safe_free(it) if (it) {free(it); it = NULL;}
+#define switch_yield(us) usleep(us)
+#define switch_cond_next() usleep(1000)
+#define switch_arraylen(_a) (sizeof(_a) / sizeof(_a[0]))
+
+typedef void *(SWITCH_THREAD_FUNC *switch_thread_start_t) (switch_thread_t *, void *);
+
+/* Memory */
+
+switch_status_t switch_core_new_memory_pool(switch_memory_pool_t **pool);
+switch_status_t switch_core_destroy_memory_pool(switch_memory_pool_t **pool);
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory);
+char *switch_core_strdup(switch_memory_pool_t *pool, const char *todup);
+char *switch_core_sprintf(switch_memory_pool_t *pool, const char *fmt, ...);
+#define switch_core_alloc(_pool, _mem) switch_core_perform_alloc(_pool, _mem)
+
+/* Strings */
+
+char *switch_copy_string(char *dst, const char *src, switch_size_t dst_size);
+int switch_snprintf(char *buf, switch_size_t len, const char *format, ...);
+unsigned int switch_separate_string(char *buf, char delim, char **array, unsigned int arraylen);
+
+/* Logging */
+
+void switch_log_printf(switch_text_channel_t channel, const char *file, const char *func, int line,
+                       const char *userdata, switch_log_level_t level, const char *fmt, ...);
+const char *switch_log_level2str(switch_log_level_t level);
+switch_log_level_t switch_log_str2level(const char *str);
+uint32_t switch_log_str2mask(const char *str);
+switch_status_t switch_log_bind_logger(switch_log_function_t function, switch_log_level_t level, switch_bool_t is_console);
+switch_status_t switch_log_unbind_logger(switch_log_function_t function);
+
+/* Files */
+
+switch_status_t switch_file_open(switch_file_t **newf, const char *fname, int32_t flag, int32_t perm, switch_memory_pool_t *pool);
+switch_status_t switch_file_close(switch_file_t *thefile);
+switch_status_t switch_file_write(switch_file_t *thefile, const void *buf, switch_size_t *nbytes);
+switch_status_t switch_file_seek(switch_file_t *thefile, int where, int64_t *offset);
+switch_size_t switch_file_get_size(switch_file_t *thefile);
+switch_status_t switch_file_exists(const char *filename, switch_memory_pool_t *pool);
+switch_status_t switch_file_remove(const char *path, switch_memory_pool_t *pool);
+switch_status_t switch_file_rename(const char *from_path, const char *to_path, switch_memory_pool_t *pool);
+switch_status_t switch_dir_make_recursive(const char *path, int32_t perm, switch_memory_pool_t *pool);
+
+/* Threads */
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool);
+switch_status_t switch_mutex_destroy(switch_mutex_t *lock);
+switch_status_t switch_mutex_lock(switch_mutex_t *lock);
+switch_status_t switch_mutex_trylock(switch_mutex_t *lock);
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock);
+switch_status_t switch_thread_cond_create(switch_thread_cond_t **cond, switch_memory_pool_t *pool);
+switch_status_t switch_thread_cond_wait(switch_thread_cond_t *cond, switch_mutex_t *mutex);
+switch_status_t switch_thread_cond_timedwait(switch_thread_cond_t *cond, switch_mutex_t *mutex, switch_interval_time_t timeout);
+switch_status_t switch_thread_cond_signal(switch_thread_cond_t *cond);
+switch_status_t switch_thread_cond_broadcast(switch_thread_cond_t *cond);
+switch_status_t switch_threadattr_create(switch_threadattr_t **new_attr, switch_memory_pool_t *pool);
+switch_status_t switch_threadattr_stacksize_set(switch_threadattr_t *attr, switch_size_t stacksize);
+switch_status_t switch_threadattr_priority_set(switch_threadattr_t *attr, int priority);
+switch_status_t switch_thread_create(switch_thread_t **new_thread, switch_threadattr_t *attr,
+                                     switch_thread_start_t func, void *data, switch_memory_pool_t *cont);
+switch_status_t switch_thread_join(switch_status_t *retval, switch_thread_t *thd);
+switch_status_t switch_core_thread_set_cpu_affinity(int cpu);
+
+/* Time */
+
+switch_time_t switch_time_now(void);
+switch_time_t switch_micro_time_now(void);
+switch_status_t switch_time_exp_lt(switch_time_exp_t *result, switch_time_t input);
+switch_status_t switch_strftime_nocheck(char *s, switch_size_t *retsize, switch_size_t max, const char *format, switch_time_exp_t *tm);
+
+/* Hash */
+
+switch_status_t switch_core_hash_init(switch_hash_t **hash);
+switch_status_t switch_core_hash_destroy(switch_hash_t **hash);
+switch_status_t switch_core_hash_insert(switch_hash_t *hash, const char *key, const void *data);
+void *switch_core_hash_find(switch_hash_t *hash, const char *key);
+void *switch_core_hash_delete(switch_hash_t *hash, const char *key);
+switch_hash_index_t *switch_core_hash_first(switch_hash_t *hash);
+switch_hash_index_t *switch_core_hash_next(switch_hash_index_t **hi);
+void switch_core_hash_this(switch_hash_index_t *hi, const void **key, switch_size_t *klen, void **val);
+
+/* Sessions and channels */
+
+switch_core_session_t *switch_core_session_perform_locate(const char *uuid_str, const char *file, const char *func, int line);
+#define switch_core_session_locate(uuid_str) switch_core_session_perform_locate(uuid_str, __FILE__, __func__, __LINE__)
+void switch_core_session_rwunlock(switch_core_session_t *session);
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session);
+const char *switch_channel_get_variable_dup(switch_channel_t *channel, const char *varname, switch_bool_t dup, int idx);
+#define switch_channel_get_variable(_c, _v) switch_channel_get_variable_dup(_c, _v, SWITCH_TRUE, -1)
+char *switch_channel_get_uuid(switch_channel_t *channel);
+
+/* XML */
+
+switch_xml_t switch_xml_open_cfg(const char *file_path, switch_xml_t *node, void *params);
+switch_xml_t switch_xml_child(switch_xml_t xml, const char *name);
+const char *switch_xml_attr(switch_xml_t xml, const char *attr);
+const char *switch_xml_attr_soft(switch_xml_t xml, const char *attr);
+void switch_xml_free(switch_xml_t xml);
+
+/* Events */
+
+switch_status_t switch_event_bind_removable(const char *id, switch_event_types_t event, const char *subclass_name,
+                                            switch_event_callback_t callback, void *user_data, switch_event_node_t **node);
+switch_status_t switch_event_unbind(switch_event_node_t **node);
+char *switch_event_get_header_idx(switch_event_t *event, const char *header_name, int idx);
+#define switch_event_get_header(_e, _h) switch_event_get_header_idx(_e, _h, -1)
+
+/* Loadable modules */
+
+switch_loadable_module_interface_t *switch_loadable_module_create_module_interface(switch_memory_pool_t *pool, const char *name);
+switch_api_interface_t *switch_stub_add_api(switch_loadable_module_interface_t *mod, const char *name, const char *desc,
+                                            switch_api_function_t function, const char *syntax);
+
+/*
+ * Stub-only hooks for the benchmark drivers
+ */
+
+/* The logger most recently bound with switch_log_bind_logger() */
+switch_log_function_t switch_stub_bound_logger(void);
+
+/* Run an API command registered by the module, output goes to stdout */
+switch_status_t switch_stub_api_execute(const char *name, const char *cmd);
+
+/* Fake sessions: register a UUID with channel variables that switch_core_session_locate() will find */
+switch_core_session_t *switch_stub_session_create(const char *uuid);
+void switch_stub_session_set_variable(switch_core_session_t *session, const char *name, const char *value);
+void switch_stub_session_destroy(switch_core_session_t *session);
+
+/* Configuration served by switch_xml_open_cfg(): a file path, or NULL for "no config" */
+void switch_stub_set_config_file(const char *path);
+
+#endif
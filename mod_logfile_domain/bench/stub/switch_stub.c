@@ -0,0 +1,1294 @@
+/*
+ * switch_stub.c -- pthread/POSIX implementation of the FreeSWITCH stand-in
+ *
+ * Just enough behaviour for mod_logfile_domain.c to load, log and unload
+ * outside FreeSWITCH. Memory pools never free individual allocations, the
+ * same as APR pools; everything is released when the pool is destroyed.
+ *
+ */
+
+#include "switch.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ctype.h>
+
+switch_directories SWITCH_GLOBAL_dirs = { "/tmp", "/tmp" };
+
+/* Memory pools: a list of blocks freed together */
+
+typedef struct pool_block {
+    struct pool_block *next;
+} pool_block_t;
+
+struct switch_memory_pool {
+    pthread_mutex_t lock;
+    pool_block_t *blocks;
+};
+
+switch_status_t switch_core_new_memory_pool(switch_memory_pool_t **pool)
+{
+    switch_memory_pool_t *p = calloc(1, sizeof(*p));
+
+    pthread_mutex_init(&p->lock, NULL);
+    *pool = p;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_destroy_memory_pool(switch_memory_pool_t **pool)
+{
+    pool_block_t *b, *next;
+
+    if (!pool || !*pool) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    for (b = (*pool)->blocks; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+
+    pthread_mutex_destroy(&(*pool)->lock);
+    free(*pool);
+    *pool = NULL;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory)
+{
+    /* keep the payload 16-byte aligned like apr_palloc's 8-byte minimum, with room to spare */
+    pool_block_t *b = calloc(1, 16 + memory);
+
+    pthread_mutex_lock(&pool->lock);
+    b->next = pool->blocks;
+    pool->blocks = b;
+    pthread_mutex_unlock(&pool->lock);
+
+    return (char *)b + 16;
+}
+
+char *switch_core_strdup(switch_memory_pool_t *pool, const char *todup)
+{
+    size_t len;
+    char *s;
+
+    if (!todup) {
+        return NULL;
+    }
+
+    len = strlen(todup) + 1;
+    s = switch_core_alloc(pool, len);
+    memcpy(s, todup, len);
+
+    return s;
+}
+
+char *switch_core_sprintf(switch_memory_pool_t *pool, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    char *s;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    s = switch_core_alloc(pool, len + 1);
+
+    va_start(ap, fmt);
+    vsnprintf(s, len + 1, fmt, ap);
+    va_end(ap);
+
+    return s;
+}
+
+/* Strings */
+
+char *switch_copy_string(char *dst, const char *src, switch_size_t dst_size)
+{
+    if (!dst_size) {
+        return dst;
+    }
+
+    strncpy(dst, src ? src : "", dst_size - 1);
+    dst[dst_size - 1] = '\0';
+
+    return dst;
+}
+
+int switch_snprintf(char *buf, switch_size_t len, const char *format, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, format);
+    ret = vsnprintf(buf, len, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+unsigned int switch_separate_string(char *buf, char delim, char **array, unsigned int arraylen)
+{
+    unsigned int argc = 0;
+    char *p = buf;
+
+    if (!buf || !array || !arraylen) {
+        return 0;
+    }
+
+    while (*p && argc < arraylen) {
+        while (*p == ' ') {
+            p++;
+        }
+        array[argc++] = p;
+        if (argc == arraylen) {
+            break;
+        }
+        if (!(p = strchr(p, delim))) {
+            break;
+        }
+        *p++ = '\0';
+    }
+
+    return argc;
+}
+
+/* Logging */
+
+static const char *LEVELS[] = { "CONSOLE", "ALERT", "CRIT", "ERR", "WARNING", "NOTICE", "INFO", "DEBUG" };
+
+static switch_log_function_t bound_logger = NULL;
+
+void switch_log_printf(switch_text_channel_t channel, const char *file, const char *func, int line,
+                       const char *userdata, switch_log_level_t level, const char *fmt, ...)
+{
+    const char *verbose = getenv("SWITCH_STUB_VERBOSE");
+    va_list ap;
+
+    if (!verbose && level > SWITCH_LOG_WARNING) {
+        return;
+    }
+
+    fprintf(stderr, "[%s] ", switch_log_level2str(level));
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+const char *switch_log_level2str(switch_log_level_t level)
+{
+    if (level >= SWITCH_LOG_CONSOLE && level <= SWITCH_LOG_DEBUG) {
+        return LEVELS[level];
+    }
+    if (level >= SWITCH_LOG_DEBUG1 && level <= SWITCH_LOG_DEBUG10) {
+        return "DEBUG";
+    }
+
+    return "INVALID";
+}
+
+switch_log_level_t switch_log_str2level(const char *str)
+{
+    int x;
+
+    if (!str) {
+        return SWITCH_LOG_INVALID;
+    }
+
+    if (isdigit((unsigned char)*str)) {
+        x = atoi(str);
+        return (x >= SWITCH_LOG_CONSOLE && x <= SWITCH_LOG_DEBUG) ? (switch_log_level_t)x : SWITCH_LOG_INVALID;
+    }
+
+    if (!strcasecmp(str, "error")) {
+        return SWITCH_LOG_ERROR;
+    }
+    if (!strcasecmp(str, "warn")) {
+        return SWITCH_LOG_WARNING;
+    }
+
+    for (x = 0; x < (int)switch_arraylen(LEVELS); x++) {
+        if (!strcasecmp(LEVELS[x], str)) {
+            return (switch_log_level_t)x;
+        }
+    }
+
+    return SWITCH_LOG_INVALID;
+}
+
+uint32_t switch_log_str2mask(const char *str)
+{
+    char *dup, *p, *next;
+    uint32_t mask = 0;
+
+    if (!str) {
+        return 0;
+    }
+
+    dup = strdup(str);
+
+    for (p = dup; p; p = next) {
+        switch_log_level_t level;
+
+        if ((next = strchr(p, ','))) {
+            *next++ = '\0';
+        }
+
+        if (!strcasecmp(p, "all")) {
+            mask = 0xFF;
+            break;
+        }
+
+        level = switch_log_str2level(p);
+        if (level != SWITCH_LOG_INVALID) {
+            mask |= (1 << level);
+        }
+    }
+
+    free(dup);
+
+    return mask;
+}
+
+switch_status_t switch_log_bind_logger(switch_log_function_t function, switch_log_level_t level, switch_bool_t is_console)
+{
+    bound_logger = function;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_log_unbind_logger(switch_log_function_t function)
+{
+    if (bound_logger == function) {
+        bound_logger = NULL;
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    return SWITCH_STATUS_FALSE;
+}
+
+switch_log_function_t switch_stub_bound_logger(void)
+{
+    return bound_logger;
+}
+
+/* Files */
+
+struct switch_file {
+    int fd;
+};
+
+switch_status_t switch_file_open(switch_file_t **newf, const char *fname, int32_t flag, int32_t perm, switch_memory_pool_t *pool)
+{
+    int oflags = 0;
+    int fd;
+
+    if ((flag & SWITCH_FOPEN_READ) && (flag & SWITCH_FOPEN_WRITE)) {
+        oflags = O_RDWR;
+    } else if (flag & SWITCH_FOPEN_WRITE) {
+        oflags = O_WRONLY;
+    } else {
+        oflags = O_RDONLY;
+    }
+
+    if (flag & SWITCH_FOPEN_CREATE) {
+        oflags |= O_CREAT;
+    }
+    if (flag & SWITCH_FOPEN_APPEND) {
+        oflags |= O_APPEND;
+    }
+    if (flag & SWITCH_FOPEN_TRUNCATE) {
+        oflags |= O_TRUNC;
+    }
+
+    if ((fd = open(fname, oflags | O_CLOEXEC, 0644)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *newf = switch_core_alloc(pool, sizeof(switch_file_t));
+    (*newf)->fd = fd;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_close(switch_file_t *thefile)
+{
+    if (!thefile || thefile->fd < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    close(thefile->fd);
+    thefile->fd = -1;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_write(switch_file_t *thefile, const void *buf, switch_size_t *nbytes)
+{
+    ssize_t r;
+
+    if (!thefile || thefile->fd < 0) {
+        *nbytes = 0;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    do {
+        r = write(thefile->fd, buf, *nbytes);
+    } while (r < 0 && errno == EINTR);
+
+    if (r < 0) {
+        *nbytes = 0;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *nbytes = (switch_size_t)r;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_seek(switch_file_t *thefile, int where, int64_t *offset)
+{
+    off_t r = lseek(thefile->fd, (off_t)*offset, where);
+
+    if (r < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *offset = r;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_size_t switch_file_get_size(switch_file_t *thefile)
+{
+    struct stat st;
+
+    if (!thefile || fstat(thefile->fd, &st)) {
+        return 0;
+    }
+
+    return (switch_size_t)st.st_size;
+}
+
+switch_status_t switch_file_exists(const char *filename, switch_memory_pool_t *pool)
+{
+    struct stat st;
+
+    return stat(filename, &st) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_remove(const char *path, switch_memory_pool_t *pool)
+{
+    return unlink(path) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_rename(const char *from_path, const char *to_path, switch_memory_pool_t *pool)
+{
+    return rename(from_path, to_path) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_dir_make_recursive(const char *path, int32_t perm, switch_memory_pool_t *pool)
+{
+    char buf[1024];
+    char *p;
+
+    switch_copy_string(buf, path, sizeof(buf));
+
+    for (p = buf + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(buf, 0755);
+            *p = '/';
+        }
+    }
+
+    if (mkdir(buf, 0755) && errno != EEXIST) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Threads */
+
+struct switch_mutex {
+    pthread_mutex_t m;
+};
+
+struct switch_thread_cond {
+    pthread_cond_t c;
+};
+
+struct switch_threadattr {
+    switch_size_t stacksize;
+    int priority;
+};
+
+struct switch_thread {
+    pthread_t tid;
+    switch_thread_start_t func;
+    void *data;
+};
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool)
+{
+    pthread_mutexattr_t attr;
+    switch_mutex_t *m = switch_core_alloc(pool, sizeof(*m));
+
+    pthread_mutexattr_init(&attr);
+    if (flags & SWITCH_MUTEX_NESTED) {
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    }
+    pthread_mutex_init(&m->m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    *lock = m;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_destroy(switch_mutex_t *lock)
+{
+    return pthread_mutex_destroy(&lock->m) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+    return pthread_mutex_lock(&lock->m) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_trylock(switch_mutex_t *lock)
+{
+    return pthread_mutex_trylock(&lock->m) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+    return pthread_mutex_unlock(&lock->m) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_create(switch_thread_cond_t **cond, switch_memory_pool_t *pool)
+{
+    switch_thread_cond_t *c = switch_core_alloc(pool, sizeof(*c));
+
+    pthread_cond_init(&c->c, NULL);
+    *cond = c;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_wait(switch_thread_cond_t *cond, switch_mutex_t *mutex)
+{
+    return pthread_cond_wait(&cond->c, &mutex->m) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_timedwait(switch_thread_cond_t *cond, switch_mutex_t *mutex, switch_interval_time_t timeout)
+{
+    struct timespec ts;
+    int r;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000000;
+    ts.tv_nsec += (timeout % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    r = pthread_cond_timedwait(&cond->c, &mutex->m, &ts);
+
+    if (r == ETIMEDOUT) {
+        return SWITCH_STATUS_TIMEOUT;
+    }
+
+    return r ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_signal(switch_thread_cond_t *cond)
+{
+    return pthread_cond_signal(&cond->c) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_broadcast(switch_thread_cond_t *cond)
+{
+    return pthread_cond_broadcast(&cond->c) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_threadattr_create(switch_threadattr_t **new_attr, switch_memory_pool_t *pool)
+{
+    *new_attr = switch_core_alloc(pool, sizeof(switch_threadattr_t));
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_threadattr_stacksize_set(switch_threadattr_t *attr, switch_size_t stacksize)
+{
+    attr->stacksize = stacksize;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_threadattr_priority_set(switch_threadattr_t *attr, int priority)
+{
+    attr->priority = priority;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void *thread_trampoline(void *arg)
+{
+    switch_thread_t *thd = arg;
+
+    return thd->func(thd, thd->data);
+}
+
+switch_status_t switch_thread_create(switch_thread_t **new_thread, switch_threadattr_t *attr,
+                                     switch_thread_start_t func, void *data, switch_memory_pool_t *cont)
+{
+    pthread_attr_t pattr;
+    switch_thread_t *thd = switch_core_alloc(cont, sizeof(*thd));
+    int r;
+
+    thd->func = func;
+    thd->data = data;
+
+    pthread_attr_init(&pattr);
+    if (attr && attr->stacksize) {
+        pthread_attr_setstacksize(&pattr, attr->stacksize);
+    }
+    r = pthread_create(&thd->tid, &pattr, thread_trampoline, thd);
+    pthread_attr_destroy(&pattr);
+
+    if (r) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *new_thread = thd;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_join(switch_status_t *retval, switch_thread_t *thd)
+{
+    pthread_join(thd->tid, NULL);
+
+    if (retval) {
+        *retval = SWITCH_STATUS_SUCCESS;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_thread_set_cpu_affinity(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+/* Time */
+
+switch_time_t switch_micro_time_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (switch_time_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+switch_time_t switch_time_now(void)
+{
+    return switch_micro_time_now();
+}
+
+switch_status_t switch_time_exp_lt(switch_time_exp_t *result, switch_time_t input)
+{
+    time_t t = (time_t)(input / 1000000);
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+
+    result->tm_usec = (int32_t)(input % 1000000);
+    result->tm_sec = tm.tm_sec;
+    result->tm_min = tm.tm_min;
+    result->tm_hour = tm.tm_hour;
+    result->tm_mday = tm.tm_mday;
+    result->tm_mon = tm.tm_mon;
+    result->tm_year = tm.tm_year;
+    result->tm_wday = tm.tm_wday;
+    result->tm_yday = tm.tm_yday;
+    result->tm_isdst = tm.tm_isdst;
+    result->tm_gmtoff = (int32_t)tm.tm_gmtoff;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_strftime_nocheck(char *s, switch_size_t *retsize, switch_size_t max, const char *format, switch_time_exp_t *xt)
+{
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_sec = xt->tm_sec;
+    tm.tm_min = xt->tm_min;
+    tm.tm_hour = xt->tm_hour;
+    tm.tm_mday = xt->tm_mday;
+    tm.tm_mon = xt->tm_mon;
+    tm.tm_year = xt->tm_year;
+    tm.tm_wday = xt->tm_wday;
+    tm.tm_yday = xt->tm_yday;
+    tm.tm_isdst = xt->tm_isdst;
+
+    *retsize = strftime(s, max, format, &tm);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Hash: a mutex-free chained table, callers provide their own locking like the real one */
+
+typedef struct hash_node {
+    char *key;
+    void *val;
+    struct hash_node *next;
+} hash_node_t;
+
+#define STUB_HASH_BUCKETS 256
+
+struct switch_hash {
+    hash_node_t *buckets[STUB_HASH_BUCKETS];
+};
+
+struct switch_hash_index {
+    switch_hash_t *hash;
+    unsigned int bucket;
+    hash_node_t *node;
+};
+
+static unsigned int stub_hash_key(const char *key)
+{
+    unsigned int h = 5381;
+
+    while (*key) {
+        h = h * 33 + (unsigned char)*key++;
+    }
+
+    return h % STUB_HASH_BUCKETS;
+}
+
+switch_status_t switch_core_hash_init(switch_hash_t **hash)
+{
+    *hash = calloc(1, sizeof(switch_hash_t));
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_hash_destroy(switch_hash_t **hash)
+{
+    unsigned int i;
+
+    if (!hash || !*hash) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    for (i = 0; i < STUB_HASH_BUCKETS; i++) {
+        hash_node_t *n, *next;
+
+        for (n = (*hash)->buckets[i]; n; n = next) {
+            next = n->next;
+            free(n->key);
+            free(n);
+        }
+    }
+
+    free(*hash);
+    *hash = NULL;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_hash_insert(switch_hash_t *hash, const char *key, const void *data)
+{
+    unsigned int b = stub_hash_key(key);
+    hash_node_t *n;
+
+    for (n = hash->buckets[b]; n; n = n->next) {
+        if (!strcmp(n->key, key)) {
+            n->val = (void *)data;
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+
+    n = calloc(1, sizeof(*n));
+    n->key = strdup(key);
+    n->val = (void *)data;
+    n->next = hash->buckets[b];
+    hash->buckets[b] = n;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void *switch_core_hash_find(switch_hash_t *hash, const char *key)
+{
+    hash_node_t *n;
+
+    for (n = hash->buckets[stub_hash_key(key)]; n; n = n->next) {
+        if (!strcmp(n->key, key)) {
+            return n->val;
+        }
+    }
+
+    return NULL;
+}
+
+void *switch_core_hash_delete(switch_hash_t *hash, const char *key)
+{
+    hash_node_t **np = &hash->buckets[stub_hash_key(key)];
+
+    for (; *np; np = &(*np)->next) {
+        if (!strcmp((*np)->key, key)) {
+            hash_node_t *n = *np;
+            void *val = n->val;
+
+            *np = n->next;
+            free(n->key);
+            free(n);
+            return val;
+        }
+    }
+
+    return NULL;
+}
+
+static switch_hash_index_t *stub_hash_advance(switch_hash_index_t *hi)
+{
+    while (!hi->node) {
+        if (++hi->bucket >= STUB_HASH_BUCKETS) {
+            free(hi);
+            return NULL;
+        }
+        hi->node = hi->hash->buckets[hi->bucket];
+    }
+
+    return hi;
+}
+
+switch_hash_index_t *switch_core_hash_first(switch_hash_t *hash)
+{
+    switch_hash_index_t *hi = calloc(1, sizeof(*hi));
+
+    hi->hash = hash;
+    hi->bucket = 0;
+    hi->node = hash->buckets[0];
+
+    return stub_hash_advance(hi);
+}
+
+switch_hash_index_t *switch_core_hash_next(switch_hash_index_t **hi)
+{
+    (*hi)->node = (*hi)->node->next;
+    *hi = stub_hash_advance(*hi);
+
+    return *hi;
+}
+
+void switch_core_hash_this(switch_hash_index_t *hi, const void **key, switch_size_t *klen, void **val)
+{
+    if (key) {
+        *key = hi->node->key;
+    }
+    if (klen) {
+        *klen = strlen(hi->node->key) + 1;
+    }
+    if (val) {
+        *val = hi->node->val;
+    }
+}
+
+/* Sessions: a global list of fake sessions with a handful of variables each */
+
+#define STUB_SESSION_VARS 8
+
+struct switch_channel {
+    switch_core_session_t *session;
+};
+
+struct switch_core_session {
+    char uuid[64];
+    char *names[STUB_SESSION_VARS];
+    char *values[STUB_SESSION_VARS];
+    switch_channel_t channel;
+    struct switch_core_session *next;
+};
+
+static pthread_rwlock_t session_lock = PTHREAD_RWLOCK_INITIALIZER;
+static switch_core_session_t *sessions = NULL;
+
+switch_core_session_t *switch_stub_session_create(const char *uuid)
+{
+    switch_core_session_t *session = calloc(1, sizeof(*session));
+
+    switch_copy_string(session->uuid, uuid, sizeof(session->uuid));
+    session->channel.session = session;
+
+    pthread_rwlock_wrlock(&session_lock);
+    session->next = sessions;
+    sessions = session;
+    pthread_rwlock_unlock(&session_lock);
+
+    return session;
+}
+
+void switch_stub_session_set_variable(switch_core_session_t *session, const char *name, const char *value)
+{
+    int i;
+
+    pthread_rwlock_wrlock(&session_lock);
+    for (i = 0; i < STUB_SESSION_VARS; i++) {
+        if (!session->names[i] || !strcmp(session->names[i], name)) {
+            if (!session->names[i]) {
+                session->names[i] = strdup(name);
+            }
+            free(session->values[i]);
+            session->values[i] = value ? strdup(value) : NULL;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&session_lock);
+}
+
+void switch_stub_session_destroy(switch_core_session_t *session)
+{
+    switch_core_session_t **sp;
+    int i;
+
+    pthread_rwlock_wrlock(&session_lock);
+    for (sp = &sessions; *sp; sp = &(*sp)->next) {
+        if (*sp == session) {
+            *sp = session->next;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&session_lock);
+
+    for (i = 0; i < STUB_SESSION_VARS; i++) {
+        free(session->names[i]);
+        free(session->values[i]);
+    }
+    free(session);
+}
+
+switch_core_session_t *switch_core_session_perform_locate(const char *uuid_str, const char *file, const char *func, int line)
+{
+    switch_core_session_t *session;
+
+    if (!uuid_str) {
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&session_lock);
+    for (session = sessions; session; session = session->next) {
+        if (!strcmp(session->uuid, uuid_str)) {
+            /* stays read-locked until switch_core_session_rwunlock(), like the real thing */
+            return session;
+        }
+    }
+    pthread_rwlock_unlock(&session_lock);
+
+    return NULL;
+}
+
+void switch_core_session_rwunlock(switch_core_session_t *session)
+{
+    pthread_rwlock_unlock(&session_lock);
+}
+
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session)
+{
+    return session ? &session->channel : NULL;
+}
+
+const char *switch_channel_get_variable_dup(switch_channel_t *channel, const char *varname, switch_bool_t dup, int idx)
+{
+    switch_core_session_t *session;
+    int i;
+
+    if (!channel || !varname) {
+        return NULL;
+    }
+
+    session = channel->session;
+    for (i = 0; i < STUB_SESSION_VARS && session->names[i]; i++) {
+        if (!strcmp(session->names[i], varname)) {
+            return session->values[i];
+        }
+    }
+
+    return NULL;
+}
+
+char *switch_channel_get_uuid(switch_channel_t *channel)
+{
+    return channel ? channel->session->uuid : NULL;
+}
+
+/* XML: a small parser for the attribute-only configuration documents the module reads */
+
+static char *config_path = NULL;
+
+void switch_stub_set_config_file(const char *path)
+{
+    free(config_path);
+    config_path = path ? strdup(path) : NULL;
+}
+
+static void xml_free_node(switch_xml_t xml)
+{
+    int i;
+
+    while (xml) {
+        switch_xml_t next = xml->sibling;
+
+        xml_free_node(xml->next);
+        xml_free_node(xml->child);
+        for (i = 0; xml->attr && xml->attr[i]; i++) {
+            free(xml->attr[i]);
+        }
+        free(xml->attr);
+        free(xml->name);
+        free(xml);
+        xml = next;
+    }
+}
+
+static char *xml_token(const char **pp, const char *stop)
+{
+    const char *p = *pp;
+    const char *start = p;
+    char *tok;
+
+    while (*p && !strchr(stop, *p)) {
+        p++;
+    }
+
+    tok = strndup(start, p - start);
+    *pp = p;
+
+    return tok;
+}
+
+static void xml_skip_ws(const char **pp)
+{
+    while (**pp && isspace((unsigned char)**pp)) {
+        (*pp)++;
+    }
+}
+
+/* Link a new child after its siblings, chaining same-named siblings through ->next */
+static void xml_add_child(switch_xml_t parent, switch_xml_t child)
+{
+    switch_xml_t c;
+
+    child->parent = parent;
+
+    if (!parent->child) {
+        parent->child = child;
+        return;
+    }
+
+    for (c = parent->child; c; c = c->sibling) {
+        if (!strcmp(c->name, child->name)) {
+            while (c->next) {
+                c = c->next;
+            }
+            c->next = child;
+            return;
+        }
+        if (!c->sibling) {
+            c->sibling = child;
+            return;
+        }
+    }
+}
+
+static switch_xml_t xml_parse(const char *p)
+{
+    switch_xml_t root = NULL;
+    switch_xml_t cur = NULL;
+
+    while (*p) {
+        if (*p != '<') {
+            p++;
+            continue;
+        }
+
+        if (!strncmp(p, "<!--", 4)) {
+            const char *end = strstr(p, "-->");
+            p = end ? end + 3 : p + strlen(p);
+            continue;
+        }
+
+        if (p[1] == '?' || p[1] == '!') {
+            const char *end = strchr(p, '>');
+            p = end ? end + 1 : p + strlen(p);
+            continue;
+        }
+
+        if (p[1] == '/') {
+            const char *end = strchr(p, '>');
+            if (cur) {
+                cur = cur->parent;
+            }
+            p = end ? end + 1 : p + strlen(p);
+            continue;
+        }
+
+        {
+            switch_xml_t node = calloc(1, sizeof(*node));
+            int nattr = 0;
+
+            p++;
+            node->name = xml_token(&p, " \t\r\n/>");
+            node->attr = calloc(1, sizeof(char *));
+
+            for (;;) {
+                char *name, *value;
+                char quote;
+
+                xml_skip_ws(&p);
+                if (!*p || *p == '>' || *p == '/') {
+                    break;
+                }
+
+                name = xml_token(&p, "= \t\r\n/>");
+                xml_skip_ws(&p);
+                if (*p != '=') {
+                    free(name);
+                    continue;
+                }
+                p++;
+                xml_skip_ws(&p);
+                quote = *p;
+                if (quote != '"' && quote != '\'') {
+                    free(name);
+                    continue;
+                }
+                p++;
+                value = xml_token(&p, quote == '"' ? "\"" : "'");
+                if (*p) {
+                    p++;
+                }
+
+                node->attr = realloc(node->attr, sizeof(char *) * (nattr + 3));
+                node->attr[nattr++] = name;
+                node->attr[nattr++] = value;
+                node->attr[nattr] = NULL;
+            }
+
+            if (!root) {
+                root = node;
+            } else if (cur) {
+                xml_add_child(cur, node);
+            } else {
+                xml_free_node(node);
+                break;
+            }
+
+            if (*p == '/') {
+                p++;
+            } else {
+                cur = node;
+            }
+            if (*p == '>') {
+                p++;
+            }
+        }
+    }
+
+    return root;
+}
+
+switch_xml_t switch_xml_open_cfg(const char *file_path, switch_xml_t *node, void *params)
+{
+    switch_xml_t root;
+    char *text;
+    FILE *f;
+    long len;
+
+    if (!config_path || !(f = fopen(config_path, "r"))) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    text = calloc(1, len + 1);
+    if (fread(text, 1, len, f) != (size_t)len) {
+        len = 0;
+    }
+    fclose(f);
+
+    root = xml_parse(text);
+    free(text);
+
+    if (!root) {
+        return NULL;
+    }
+
+    *node = root;
+
+    return root;
+}
+
+switch_xml_t switch_xml_child(switch_xml_t xml, const char *name)
+{
+    switch_xml_t c;
+
+    for (c = xml ? xml->child : NULL; c; c = c->sibling) {
+        if (!strcmp(c->name, name)) {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+const char *switch_xml_attr(switch_xml_t xml, const char *attr)
+{
+    int i;
+
+    for (i = 0; xml && xml->attr && xml->attr[i]; i += 2) {
+        if (!strcmp(xml->attr[i], attr)) {
+            return xml->attr[i + 1];
+        }
+    }
+
+    return NULL;
+}
+
+const char *switch_xml_attr_soft(switch_xml_t xml, const char *attr)
+{
+    const char *ret = switch_xml_attr(xml, attr);
+
+    return ret ? ret : "";
+}
+
+void switch_xml_free(switch_xml_t xml)
+{
+    xml_free_node(xml);
+}
+
+/* Events: accepted and ignored, the drivers call the module's handlers directly if they need to */
+
+switch_status_t switch_event_bind_removable(const char *id, switch_event_types_t event, const char *subclass_name,
+                                            switch_event_callback_t callback, void *user_data, switch_event_node_t **node)
+{
+    *node = (switch_event_node_t *)calloc(1, 1);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_event_unbind(switch_event_node_t **node)
+{
+    if (node && *node) {
+        free(*node);
+        *node = NULL;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+char *switch_event_get_header_idx(switch_event_t *event, const char *header_name, int idx)
+{
+    switch_event_header_t *hp;
+
+    for (hp = event ? event->headers : NULL; hp; hp = hp->next) {
+        if (!strcasecmp(hp->name, header_name)) {
+            return hp->value;
+        }
+    }
+
+    return NULL;
+}
+
+/* Loadable modules */
+
+#define STUB_MAX_APIS 8
+
+struct switch_loadable_module_interface {
+    const char *name;
+};
+
+struct switch_api_interface {
+    const char *name;
+    switch_api_function_t function;
+};
+
+static struct switch_api_interface apis[STUB_MAX_APIS];
+static int api_count = 0;
+
+switch_loadable_module_interface_t *switch_loadable_module_create_module_interface(switch_memory_pool_t *pool, const char *name)
+{
+    switch_loadable_module_interface_t *mod = switch_core_alloc(pool, sizeof(*mod));
+
+    mod->name = name;
+
+    return mod;
+}
+
+switch_api_interface_t *switch_stub_add_api(switch_loadable_module_interface_t *mod, const char *name, const char *desc,
+                                            switch_api_function_t function, const char *syntax)
+{
+    int i;
+
+    for (i = 0; i < api_count; i++) {
+        if (!strcmp(apis[i].name, name)) {
+            apis[i].function = function;
+            return &apis[i];
+        }
+    }
+
+    if (api_count == STUB_MAX_APIS) {
+        return NULL;
+    }
+
+    apis[api_count].name = name;
+    apis[api_count].function = function;
+
+    return &apis[api_count++];
+}
+
+static switch_status_t stub_stream_write(switch_stream_handle_t *handle, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stdout, fmt, ap);
+    va_end(ap);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_stub_api_execute(const char *name, const char *cmd)
+{
+    switch_stream_handle_t stream = { 0 };
+    int i;
+
+    stream.write_function = stub_stream_write;
+
+    for (i = 0; i < api_count; i++) {
+        if (!strcmp(apis[i].name, name)) {
+            return apis[i].function(cmd, NULL, &stream);
+        }
+    }
+
+    return SWITCH_STATUS_NOTFOUND;
+}
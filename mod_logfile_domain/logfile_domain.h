@@ -0,0 +1,680 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain.h -- The logging core behind mod_logfile_domain
+ *
+ * The core takes log nodes, finds their domain, formats the line and writes it to the
+ * domain's file through the writer threads, rotating and compressing as configured.
+ * mod_logfile_domain.c adapts it to FreeSWITCH: config XML, events, the API command and
+ * the logger binding. Everything here is internal to the module; the tests and benchmarks
+ * include it to drive the parts on their own.
+ *
+ */
+
+#ifndef LOGFILE_DOMAIN_H
+#define LOGFILE_DOMAIN_H
+
+#include "logfile_domain_platform.h"
+
+#if defined(__GNUC__) && !defined(WIN32)
+#pragma GCC visibility push(hidden)
+#endif
+
+#define DEFAULT_LIMIT 0xA00000  /* About 10 MB */
+#define WARM_FUZZY_OFFSET 256
+#define MAX_ROT 4096
+#define DEFAULT_MAX_ROT 32
+#define DEFAULT_MAX_DOMAINS 16384     /* domains tracked; only max-open-files of them hold a file */
+#define DEFAULT_MAX_OPEN_FILES 256
+#define DOMAIN_NAME_MAX 128           /* longest domain name + 1 */
+#define DOMAIN_PATH_MAX 512
+#define DEFAULT_IDLE_TIMEOUT 300      /* seconds without a line before a domain's file is closed */
+#define IDLE_CHECK_INTERVAL 1000000   /* usec between idle sweeps on writer 0 */
+#define DEFAULT_QUEUE_SIZE 65536
+#define MIN_QUEUE_SIZE 64
+#define WRITER_IDLE_WAIT 100000       /* usec the writer sleeps when the queue is empty */
+#define QUEUE_REPORT_INTERVAL 10      /* seconds between overflow warnings */
+#define WRITER_BATCH 256              /* queued lines handled between flush checks */
+#define DEFAULT_BUFFER_SIZE 65536
+#define DEFAULT_FLUSH_INTERVAL 1000   /* msec */
+#define DOMAIN_TABLE_INITIAL_SIZE 16   /* slots, power of two, kept at most half full */
+#define DOMAIN_TOMBSTONE ((domain_cache_entry_t *)1)  /* slot of a retired entry, probes continue past it */
+#define ENTRY_SLAB_ENTRIES 64         /* entries per slab allocation */
+#define ENTRY_ALIGN 64                /* each entry starts on its own cache line */
+#define RECLAIM_GRACE 5000000         /* usec a replaced domain table is kept, covering lock-free probes */
+#define ENTRY_DEAD 0x80000000U        /* in refs while an entry is free, so lock-free holders back off */
+#define MAX_WRITER_THREADS 64
+#define MAX_WRITER_CPUS 1024          /* highest CPU number + 1 accepted in writer-cpus */
+#define DEFAULT_REBALANCE_DEPTH 4096  /* queued lines that make a writer hot, 0 disables */
+#define REBALANCE_INTERVAL 1000000    /* usec between writer load samples */
+#define REBALANCE_SAMPLES 3           /* consecutive hot samples before a domain is moved */
+#define DEFAULT_UUID_CACHE_SIZE 4096  /* slots, rounded up to a power of two, 0 disables */
+#define DEFAULT_UUID_CACHE_TTL 5000   /* msec */
+#define DEFAULT_MMAP_CHUNK 0x800000   /* 8 MB preallocated per step in the mmap backend */
+#define URING_ENTRIES 256             /* io_uring writes per submission, each with a registered buffer */
+#define URING_FILE_SLOTS 4096         /* registered file table; files beyond it are passed as plain fds */
+#define DEFAULT_SYNC_INTERVAL 1000    /* msec between syncs with durability=interval */
+#define DEFAULT_SYNC_BYTES 0x100000   /* unsynced bytes per domain that trigger a sync with durability=bytes */
+#define SYNC_IDLE_WAIT 1000000        /* usec the sync thread sleeps when not on an interval */
+#define SYNC_HISTOGRAM_BUCKETS 32     /* log2 usec buckets of sync latency */
+#define WRITE_HISTOGRAM_BUCKETS 24    /* log2 usec buckets of per-domain write latency */
+#define STATS_SAMPLE_INTERVAL 1000000 /* usec between per-domain rate samples on writer 0 */
+#define MAX_COMPRESS_THREADS 8
+#define COMPRESS_CHUNK 0x10000        /* bytes read from a rotated file per compression step */
+#define RATE_SUMMARY_INTERVAL 1000000 /* usec between "lines suppressed" summaries of one domain */
+
+/* Output backends. A sink is one open domain file; rotation opens the new sink without
+   file_lock and only swaps the struct under it. */
+typedef struct domain_sink domain_sink_t;
+
+typedef struct {
+    const char *name;
+    switch_status_t (*open)(domain_sink_t *sink, const char *path);
+    switch_status_t (*write)(domain_sink_t *sink, const char *data, switch_size_t len);
+    void (*close)(domain_sink_t *sink);
+} domain_sink_ops_t;
+
+struct domain_sink {
+    const domain_sink_ops_t *ops;   /* NULL while closed */
+    switch_size_t size;             /* bytes of log data in the file */
+    switch_file_t *file;            /* file backend */
+    switch_memory_pool_t *pool;     /* file backend, holds file for this open only */
+    int fd;                         /* every backend, -1 if none; what the sync thread syncs */
+    int slot;                       /* io_uring registered file index, -1 if none */
+    char *map;
+    switch_size_t map_off;
+    switch_size_t map_len;
+};
+
+/* How rotated files, and with compress-active the live file, are compressed */
+typedef enum {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD
+} compress_t;
+
+/* Length-prefixed string kept in the entry's pool, off its hot cache lines */
+typedef struct {
+    switch_size_t len;
+    char str[];
+} domain_str_t;
+
+/* Per-domain counters for the status command. Lines, bytes, opens and latencies are only
+   updated under the domain's file_lock, so they stay on cache lines its writer already owns;
+   drops and rate-limited lines are counted by the logging thread that turned the line away.
+   Readers load them lock-free. */
+typedef struct {
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t drops;
+    uint64_t suppressed;         /* lines over rate-limit */
+    uint64_t opens;
+    uint64_t write_errors;
+    uint64_t write_hist[WRITE_HISTOGRAM_BUCKETS];
+    uint64_t sample_lines;       /* totals at the last rate sample, writer 0 only */
+    uint64_t sample_bytes;
+    uint64_t lines_rate;         /* per second over the last sample */
+    uint64_t bytes_rate;
+} domain_stats_t;
+
+/* Domain file cache entry, allocated from the entry slab on a cache-line boundary so no two
+   domains share a line. What a logged line touches comes first and spans the first three
+   lines; the name and path are read only to match a probe or (re)open the file. */
+typedef struct domain_cache_entry {
+    /* hot: lookup, lock, append buffer; hash and refs come first, they outlive reuse */
+    uint32_t hash;
+    uint32_t refs;               /* holders: lookups in progress and lines on their way */
+    const domain_str_t *domain;
+    switch_mutex_t *file_lock;
+    int referenced;              /* CLOCK bit, set on every line and cleared by the hand */
+    int retired;                 /* unlinked from the table, lines are redirected */
+    int rotate_pending;
+    int sync_pending;            /* sync thread already asked to sync this domain */
+    char *buf;                   /* pending lines, written out in one call per flush */
+    switch_size_t buf_len;
+    switch_size_t buf_size;
+    /* hot: rollover, idle and sync accounting, then the open file */
+    switch_size_t buf_cap;       /* allocated size, buf_size may shrink on reload */
+    switch_time_t buf_since;     /* when the oldest pending line was appended */
+    switch_size_t log_size;
+    switch_size_t roll_size;
+    switch_time_t last_used;     /* last line written, for idle-timeout */
+    switch_size_t unsynced;      /* bytes handed to the sink since its last sync */
+    uint32_t writer;             /* writer thread owning the domain's queued lines */
+    uint32_t enqueuing;          /* producers between reading writer and their push */
+    uint32_t lines;              /* lines written since the last rebalance sample */
+    int migrating;               /* MIGRATION_* while moving to another writer */
+    domain_sink_t sink;
+    /* rate limit, a token bucket kept as GCRA's theoretical arrival time so one CAS updates it */
+    uint64_t rate_interval;      /* ns per token at rate-limit, 0 when unlimited */
+    uint64_t rate_tolerance;     /* ns the schedule may run ahead of now, rate-limit-burst tokens */
+    uint64_t rate_tat;           /* ns when the bucket is full again */
+    uint64_t rate_suppressed;    /* lines turned away since the last summary line */
+    switch_time_t rate_summary_due;  /* no summary line before this */
+    /* cold */
+    const domain_str_t *path;    /* replaced on relocation, the old copy stays in pool */
+    int suffix;                  /* rotated generations on disk, -1 until counted */
+    switch_memory_pool_t *pool;  /* file_lock and the strings live here and go with the entry */
+    struct domain_cache_entry *next;  /* free or retired list */
+    uint32_t migrate_from;       /* previous writer while migrating */
+    uint32_t migrate_ticket;     /* its queue position after the last line sent to it */
+    uint32_t deferred;           /* lines the new writer holds until the old one passes the ticket */
+    compress_t stream;           /* compress-active method of the live file, fixed with path */
+    int stream_checked;          /* live file checked for a torn last frame */
+    domain_stats_t stats;
+} domain_cache_entry_t;
+
+/* A domain moving between writers: lines queued on the old writer must be written before
+   the new writer writes any, so the new writer holds them back until the old one is done */
+enum {
+    MIGRATION_NONE,
+    MIGRATION_SWITCHED,          /* new writer published, waiting for in-flight producers */
+    MIGRATION_TICKETED           /* migrate_ticket valid */
+};
+
+/* Slabs are only freed at unload; their entries cycle through the free list */
+typedef struct entry_slab {
+    struct entry_slab *next;
+} entry_slab_t;
+
+/* Open-addressing domain table. Slots are never cleared, only filled or turned into
+   tombstones, so readers probe without locking; inserts and rebuilds happen under
+   globals.mutex and a rebuild publishes a new table, keeping the old one on the retired
+   list until it has been out of use for RECLAIM_GRACE. */
+typedef struct domain_table {
+    uint32_t size;
+    uint32_t count;              /* used slots, tombstones included */
+    uint32_t tombstones;
+    domain_cache_entry_t **slots;
+    struct domain_table *retired;
+    switch_time_t retired_at;
+} domain_table_t;
+
+/* What the logging callback does when the async queue is full */
+typedef enum {
+    QUEUE_OVERFLOW_DROP,
+    QUEUE_OVERFLOW_BLOCK
+} queue_overflow_policy_t;
+
+/* When written lines are forced to disk by the sync thread */
+typedef enum {
+    DURABILITY_NONE,
+    DURABILITY_INTERVAL,
+    DURABILITY_BYTES
+} durability_t;
+
+/* A closed domain file's unsynced data, synced by the sync thread through a dup of its fd */
+typedef struct sync_closed {
+    int fd;
+    struct sync_closed *next;
+    char path[];
+} sync_closed_t;
+
+/* A rotated file waiting for a compress thread. The fd is opened right after the rotation;
+   later rotations keep renaming the file, so it is found again by inode when done. */
+typedef struct compress_job {
+    int fd;
+    compress_t method;
+    int level;
+    char *base;                  /* domain file path, rotated names are base.N[.gz|.zst] */
+    struct compress_job *next;
+} compress_job_t;
+
+/* A formatted line as segments pointing at the log node and cached strings; it is copied
+   exactly once, into the append buffer, a queue record or a write, and never truncated */
+#define LOG_LINE_SEGMENTS 16
+
+typedef struct {
+    struct iovec iov[LOG_LINE_SEGMENTS];
+    int count;
+    switch_size_t len;
+} log_line_t;
+
+static inline void log_line_add(log_line_t *line, const char *data, switch_size_t len)
+{
+    if (len && line->count < LOG_LINE_SEGMENTS) {
+        line->iov[line->count].iov_base = (void *)data;
+        line->iov[line->count].iov_len = len;
+        line->count++;
+        line->len += len;
+    }
+}
+
+/* A formatted log line waiting for the writer thread; data lives in the same allocation */
+typedef struct log_record {
+    domain_cache_entry_t *entry;
+    char *data;
+    switch_size_t len;
+    struct log_record *next;     /* held back by a writer during a migration */
+} log_record_t;
+
+/* Bounded multi-producer queue cell, sequenced as in Vyukov's array queue */
+typedef struct {
+    uint32_t seq;
+    log_record_t *rec;
+} log_queue_cell_t;
+
+/* Producers are any logging thread, the only consumer is the writer thread */
+typedef struct {
+    log_queue_cell_t *cells;
+    uint32_t mask;
+    char pad0[64];
+    uint32_t enqueue_pos;
+    char pad1[64];
+    uint32_t dequeue_pos;
+    char pad2[64];
+} log_queue_t;
+
+/* One writer thread and its queue; a domain maps to one writer at a time so its lines stay in order */
+typedef struct {
+    log_queue_t queue;
+    uint32_t high_water;
+    int sleeping;
+    switch_mutex_t *mutex;
+    switch_thread_cond_t *cond;
+    switch_thread_t *thread;
+    int id;
+    int cpu;                     /* pinned CPU, -1 if not pinned */
+    uint32_t done;               /* queue position of the next line not yet written or held */
+    log_record_t *deferred;      /* held lines, oldest first */
+    log_record_t *deferred_tail;
+    uint32_t hot_samples;        /* consecutive rebalance samples over rebalance-depth */
+} log_writer_t;
+
+/* Session UUID -> domain entry, direct-mapped. Each slot is a seqlock: seq is odd while a writer
+   owns it, and every store or invalidation bumps it, so readers and racing stores notice the
+   change. A retired entry is cleared from every slot before its memory can be reused, and a
+   hit holds the entry and then re-checks seq, so a cached pointer is never used stale. The
+   payload is read and written with relaxed atomics, the uuid a zero-padded word at a time. */
+#define UUID_CACHE_WORDS ((SWITCH_UUID_FORMATTED_LENGTH + 8) / 8)
+
+typedef struct {
+    uint32_t seq;
+    uint64_t uuid[UUID_CACHE_WORDS];
+    domain_cache_entry_t *entry;
+    switch_time_t expires;
+} uuid_cache_slot_t;
+
+/* Levels written for one log source (node->file) */
+typedef struct {
+    uint32_t mask;
+    int fallback;                /* look for domain= in the message when there is no session domain,
+                                    -1 while parsing means same as "all" */
+} level_map_source_t;
+
+/* Built from <mappings> with log-level already folded in, then published whole so the
+   logging callback checks it without locking; replaced maps are kept until unload */
+typedef struct level_map {
+    level_map_source_t all;
+    switch_hash_t *sources;      /* node->file -> level_map_source_t, NULL if only "all" is mapped */
+    struct level_map *retired;
+} level_map_t;
+
+/* rate-limit for one domain, in lines per second (0 for unlimited) and lines of burst
+   (0 for one second's worth); -1 while parsing means same as the global setting */
+typedef struct {
+    int rate;
+    int burst;
+} rate_limit_t;
+
+/* The global rate-limit with the per-domain overrides from <domains>, published whole like
+   the level map; entries copy their limit when created and on reload */
+typedef struct rate_limit_map {
+    rate_limit_t all;
+    switch_hash_t *domains;      /* domain name -> rate_limit_t, NULL without overrides */
+    struct rate_limit_map *retired;
+} rate_limit_map_t;
+
+typedef struct log_uring log_uring_t;
+
+/* What the core needs from the host application: the domain of a live session, copied
+   into buf. -1 when there is no such session, else the domain's length like snprintf (0 when
+   it has none); len or more means buf holds only part of it. */
+typedef struct {
+    int (*session_domain)(const char *uuid, char *buf, switch_size_t len);
+} logfile_domain_host_t;
+
+/* Everything the config holds, parsed into a scratch copy so a reload can compare before applying */
+typedef struct {
+    switch_bool_t async_write;
+    uint32_t queue_size;
+    queue_overflow_policy_t overflow_policy;
+    uint32_t writer_threads;
+    int writer_cpus[MAX_WRITER_THREADS];
+    uint32_t writer_cpu_count;
+    uint32_t rebalance_depth;
+    switch_size_t buffer_size;
+    uint32_t flush_interval;
+    switch_bool_t rotate_on_hup;
+    switch_size_t roll_size;
+    int max_rot;
+    int max_domains;
+    int max_open_files;
+    uint32_t idle_timeout;
+    switch_log_level_t log_level;
+    switch_bool_t message_fallback;
+    uint32_t uuid_cache_size;
+    uint32_t uuid_cache_ttl;
+    switch_bool_t log_usec;
+    const domain_sink_ops_t *sink_ops;
+    switch_size_t mmap_chunk;
+    durability_t durability;
+    uint32_t sync_interval;
+    switch_size_t sync_bytes;
+    compress_t compress;
+    compress_t compress_active;
+    int compress_level;
+    uint32_t compress_threads;
+    switch_bool_t latency_histograms;
+    char log_dir[256];
+    level_map_t *level_map;
+    rate_limit_map_t *rate_limits;
+} logfile_domain_settings_t;
+
+/* State shared by every part of the core, defined in logfile_domain_core.c */
+typedef struct {
+    const logfile_domain_host_t *host;
+    switch_mutex_t *mutex;
+    switch_mutex_t *reload_mutex;    /* one apply_config() at a time, it starts the ring and compress threads once */
+    domain_table_t *domain_table;
+    int cache_entries;
+    entry_slab_t *entry_slabs;
+    domain_cache_entry_t *entry_free;
+    domain_cache_entry_t *entry_retired;
+    uint32_t entry_slab_count;
+    uint32_t entries_free;
+    uint32_t entries_retired;
+    uint32_t retire_hand;
+    uint32_t snapshots;           /* collect_domain_entries() arrays not yet released */
+    uint64_t entries_reclaimed;
+    int max_domains;
+    int max_open_files;
+    int open_files;
+    uint32_t idle_timeout;
+    uint32_t clock_hand;
+    switch_mutex_t *clock_mutex;
+    uint64_t handle_hits;
+    uint64_t handle_misses;
+    uint64_t evictions;
+    uint64_t idle_closes;
+    int running;
+    switch_bool_t async_write;
+    uint32_t queue_size;
+    queue_overflow_policy_t overflow_policy;
+    uint64_t queue_dropped;
+    log_writer_t *writers;
+    uint32_t writer_count;
+    int writer_cpus[MAX_WRITER_THREADS];
+    uint32_t writer_cpu_count;
+    uint32_t rebalance_depth;
+    domain_cache_entry_t *migration;  /* domain being moved, one at a time; writer 0 only */
+    uint64_t migrations;
+    switch_size_t buffer_size;
+    uint32_t flush_interval;
+    switch_bool_t rotate_on_hup;
+    switch_size_t roll_size;
+    int max_rot;
+    uint32_t rotate_requests;
+    uint32_t relocate_requests;  /* reopen every file on writer 0 after a log-dir or output change */
+    level_map_t *level_map;
+    rate_limit_map_t *rate_limits;
+    uint64_t renders;
+    uint64_t renders_avoided;
+    uint64_t rate_limited;
+    uuid_cache_slot_t *uuid_cache;
+    uint32_t uuid_cache_mask;
+    uint32_t uuid_cache_ttl;
+    switch_bool_t log_usec;
+    const domain_sink_ops_t *sink_ops;
+    switch_size_t mmap_chunk;
+    uint64_t uuid_cache_hits;
+    uint64_t uuid_cache_misses;
+    char log_dir[256];
+    log_uring_t *uring;
+    durability_t durability;
+    uint32_t sync_interval;
+    switch_size_t sync_bytes;
+    switch_thread_t *sync_thread;
+    switch_mutex_t *sync_mutex;
+    switch_thread_cond_t *sync_cond;
+    uint32_t sync_requests;
+    sync_closed_t *sync_closed;      /* closed files still to sync, under sync_mutex */
+    uint64_t syncs;
+    uint64_t sync_errors;
+    uint64_t sync_hist[SYNC_HISTOGRAM_BUCKETS];
+    switch_mutex_t *rotated_mutex;   /* renames of rotated files: writer 0 shifting, compress threads finishing */
+    compress_t compress;
+    int compress_level;
+    switch_thread_t *compress_threads[MAX_COMPRESS_THREADS];
+    uint32_t compress_thread_count;
+    switch_mutex_t *compress_mutex;
+    switch_thread_cond_t *compress_cond;
+    compress_job_t *compress_jobs;   /* oldest first */
+    compress_job_t *compress_jobs_tail;
+    uint32_t compress_pending;
+    int compress_stop;
+    uint64_t compressed;
+    uint64_t compress_errors;
+    uint64_t compress_bytes_in;
+    uint64_t compress_bytes_out;
+    compress_t compress_active;
+    uint64_t stream_frames;
+    uint64_t stream_bytes_in;
+    uint64_t stream_bytes_out;
+    int latency_enabled;
+    uint64_t latency_mult;           /* ns per latency_now() tick, 32.32 fixed point */
+    struct latency_hist *latency_hists;  /* one per thread that logged with latency on */
+} logfile_domain_globals_t;
+
+extern logfile_domain_globals_t globals;
+extern switch_memory_pool_t *module_pool;
+
+/* log2 bucket of a latency in usec: 0 for under 2, then [2^i, 2^(i+1)) */
+static inline int latency_bucket(switch_time_t usec, int buckets)
+{
+    int bucket = 0;
+
+    while (bucket < buckets - 1 && (switch_time_t)2 << bucket <= usec) {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/* Logger callback latency, per stage, in log-linear buckets: values under 16 ns get their own
+   bucket, then every power of two is split in LATENCY_SUB_BUCKETS, so a bucket is within 1/8
+   of its value. Each logging thread records into its own block, found through a thread-local
+   pointer, and only the owner writes it; the API merges the blocks when asked. */
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_MAX_BITS 38          /* ~275 s, anything slower lands in the last bucket */
+#define LATENCY_BUCKETS (16 + (LATENCY_MAX_BITS - 4) * LATENCY_SUB_BUCKETS)
+
+enum {
+    LATENCY_RESOLVE,             /* session lookup and message scan for the domain */
+    LATENCY_RENDER,              /* measuring the message text */
+    LATENCY_FORMAT,              /* date and line segments */
+    LATENCY_WRITE,               /* queue push, or the write itself without async-write */
+    LATENCY_TOTAL,               /* whole callback once the level passed */
+    LATENCY_STAGES
+};
+
+typedef struct latency_hist {
+    uint64_t counts[LATENCY_STAGES][LATENCY_BUCKETS];
+    uint64_t max[LATENCY_STAGES];
+    struct latency_hist *next;
+} latency_hist_t;
+
+/* Cheapest clock available: the TSC on x86, scaled to ns by latency_calibrate() */
+static inline uint64_t latency_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t latency_ns(uint64_t ticks)
+{
+    uint64_t mult = __atomic_load_n(&globals.latency_mult, __ATOMIC_RELAXED);
+
+    if (ticks >> 32) {
+        return (ticks >> 16) * mult >> 16;
+    }
+    return ticks * mult >> 32;
+}
+
+static inline int latency_index(uint64_t ns)
+{
+    int msb, index;
+
+    if (ns < 16) {
+        return (int)ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    index = 16 + (msb - 4) * LATENCY_SUB_BUCKETS + (int)((ns >> (msb - 3)) & (LATENCY_SUB_BUCKETS - 1));
+
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+/* Take a reference on an entry found without globals.mutex. Fails while the entry is free;
+   it may also have been reused for another domain, so the caller checks it is the one it
+   was after before using it. */
+static inline switch_bool_t domain_entry_hold(domain_cache_entry_t *entry)
+{
+    if (__atomic_add_fetch(&entry->refs, 1, __ATOMIC_SEQ_CST) & ENTRY_DEAD) {
+        __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_RELEASE);
+        return SWITCH_FALSE;
+    }
+
+    return SWITCH_TRUE;
+}
+
+static inline void domain_entry_release(domain_cache_entry_t *entry)
+{
+    __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_RELEASE);
+}
+
+/* logfile_domain_table.c: the lock-free domain table, entry slabs and the uuid cache */
+void cleanup_domain_entry(void *ptr);
+domain_str_t *domain_str_new(switch_memory_pool_t *pool, const char *str, switch_size_t len);
+uint32_t domain_hash_func(const char *domain, switch_size_t len);
+domain_table_t *domain_table_create(uint32_t size);
+domain_cache_entry_t *domain_table_find(const domain_table_t *table, const char *domain, switch_size_t len, uint32_t hash);
+void domain_table_destroy(void);
+domain_cache_entry_t *domain_entry_alloc(void);
+void domain_entry_free(domain_cache_entry_t *entry);
+domain_cache_entry_t *get_domain_entry(const char *domain, switch_size_t len);
+void uuid_cache_invalidate(const char *uuid);
+switch_bool_t resolve_session_entry(const char *uuid, switch_time_t now, domain_cache_entry_t **entry);
+domain_cache_entry_t **collect_domain_entries(int *count);
+void release_domain_entries(domain_cache_entry_t **entries);
+
+/* logfile_domain_format.c: level map, rate-limit map, domain extraction and the date prefix */
+uint32_t level_floor_mask(switch_log_level_t level);
+level_map_t *level_map_create(void);
+void level_map_destroy(level_map_t *map);
+void level_map_add(level_map_t *map, const char *name, uint32_t mask, const char *fallback);
+void level_map_finish(level_map_t *map, switch_log_level_t level);
+const level_map_source_t *level_map_lookup(const level_map_t *map, const char *file);
+rate_limit_map_t *rate_limit_map_create(void);
+void rate_limit_map_destroy(rate_limit_map_t *map);
+void rate_limit_map_add(rate_limit_map_t *map, const char *domain, int rate, int burst);
+void rate_limit_map_finish(rate_limit_map_t *map);
+const rate_limit_t *rate_limit_lookup(const rate_limit_map_t *map, const char *domain);
+void rate_limit_apply(domain_cache_entry_t *entry, const rate_limit_map_t *map);
+const char *extract_domain_from_msg(const char *msg, switch_size_t len, switch_size_t *domain_len);
+switch_size_t format_log_date(switch_time_t ts, char *buf);
+
+/* logfile_domain_sink.c: file, mmap and io_uring sinks and per-domain file handles */
+extern const char *const rotated_log_exts[3];
+void domain_sink_close(domain_sink_t *sink);
+#ifdef LOGFILE_DOMAIN_IO_URING
+extern __thread int uring_batching;
+void log_uring_destroy(log_uring_t *u);
+log_uring_t *log_uring_create(switch_size_t staging_size);
+void log_uring_flush(void);
+void log_uring_report(switch_stream_handle_t *stream);
+#endif
+const domain_sink_ops_t *domain_sink_ops_find(const char *name);
+switch_status_t domain_sink_open(domain_sink_t *sink, const char *path);
+const char *compress_ext(compress_t method);
+switch_status_t open_domain_logfile(domain_cache_entry_t *entry);
+void build_domain_logfile_path(domain_cache_entry_t *entry);
+switch_status_t domain_file_write(domain_cache_entry_t *entry, const char *data, switch_size_t len);
+void close_domain_handle(domain_cache_entry_t *entry);
+void close_idle_domain_handles(switch_time_t now);
+void close_all_domain_logs(void);
+
+/* logfile_domain_rotate.c: rotation, HUP reopen and background compression */
+void start_compress_threads(uint32_t count);
+void stop_compress_threads(void);
+void rotate_pending_domain_logs(void);
+void request_rotate_all(void);
+void reopen_all_domain_logs(switch_bool_t relocate);
+
+/* logfile_domain_writer.c: writer queues and threads, buffering and the sync thread */
+void log_queue_init(log_queue_t *q, uint32_t size);
+uint32_t log_queue_depth(log_queue_t *q);
+void log_sync_wake(void);
+void log_sync_closing(int fd, const char *path);
+switch_status_t flush_domain_buffer(domain_cache_entry_t *entry);
+void check_domain_rollover(domain_cache_entry_t *entry);
+switch_status_t write_domain_log(domain_cache_entry_t *entry, const struct iovec *iov, int count, switch_size_t len);
+void log_writer_wake(log_writer_t *writer);
+switch_status_t enqueue_domain_log(domain_cache_entry_t *entry, const log_line_t *line);
+void *SWITCH_THREAD_FUNC log_writer_thread(switch_thread_t *thread, void *obj);
+void *SWITCH_THREAD_FUNC log_sync_thread(switch_thread_t *thread, void *obj);
+void stop_log_writers(void);
+void stop_sync_thread(void);
+
+/* logfile_domain_core.c: settings, latency histograms, the logger entry point and reports */
+void logfile_domain_settings_init(logfile_domain_settings_t *s);
+void latency_calibrate(void);
+uint64_t latency_bucket_max(int index);
+void latency_enable(switch_bool_t on);
+void latency_reset(void);
+void latency_dump(switch_stream_handle_t *stream);
+void log_pending_summaries(switch_time_t now);
+switch_status_t logfile_domain_log(const switch_log_node_t *node, switch_log_level_t level);
+switch_status_t logfile_domain_start(switch_memory_pool_t *pool, const logfile_domain_host_t *host, logfile_domain_settings_t *s);
+void logfile_domain_reload(logfile_domain_settings_t *s);
+void logfile_domain_stop(void);
+void logfile_domain_hup(void);
+void logfile_domain_status(switch_stream_handle_t *stream, switch_bool_t json);
+void logfile_domain_queue_report(switch_stream_handle_t *stream);
+void logfile_domain_stats_report(switch_stream_handle_t *stream);
+void logfile_domain_sync_report(switch_stream_handle_t *stream);
+
+#if defined(__GNUC__) && !defined(WIN32)
+#pragma GCC visibility pop
+#endif
+
+#endif
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
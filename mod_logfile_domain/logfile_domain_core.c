@@ -0,0 +1,993 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_core.c -- Settings, start and stop, the per-line path and the reports
+ *
+ */
+
+#include "logfile_domain.h"
+
+logfile_domain_globals_t globals;
+switch_memory_pool_t *module_pool = NULL;
+
+/* Upper bound in usec of the bucket holding the pct-th percentile, 0 if empty */
+static uint64_t latency_percentile(const uint64_t *hist, int buckets, int pct)
+{
+    uint64_t counts[64], total = 0, seen = 0;
+    int i;
+
+    for (i = 0; i < buckets; i++) {
+        counts[i] = __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+
+    for (i = 0; i < buckets && total; i++) {
+        seen += counts[i];
+        if (seen * 100 >= total * (uint64_t)pct) {
+            return ((uint64_t)2 << i) - 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Every setting at its default, with an empty level map the caller fills or finishes */
+void logfile_domain_settings_init(logfile_domain_settings_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->async_write = SWITCH_FALSE;
+    s->queue_size = DEFAULT_QUEUE_SIZE;
+    s->overflow_policy = QUEUE_OVERFLOW_DROP;
+    s->writer_threads = 1;
+    s->rebalance_depth = DEFAULT_REBALANCE_DEPTH;
+    s->buffer_size = DEFAULT_BUFFER_SIZE;
+    s->flush_interval = DEFAULT_FLUSH_INTERVAL;
+    s->rotate_on_hup = SWITCH_TRUE;
+    s->roll_size = DEFAULT_LIMIT;
+    s->max_rot = DEFAULT_MAX_ROT;
+    s->max_domains = DEFAULT_MAX_DOMAINS;
+    s->max_open_files = DEFAULT_MAX_OPEN_FILES;
+    s->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    s->log_level = SWITCH_LOG_DEBUG;
+    switch_copy_string(s->log_dir, SWITCH_GLOBAL_dirs.log_dir, sizeof(s->log_dir));
+    s->message_fallback = SWITCH_TRUE;
+    s->uuid_cache_size = DEFAULT_UUID_CACHE_SIZE;
+    s->uuid_cache_ttl = DEFAULT_UUID_CACHE_TTL;
+    s->sink_ops = domain_sink_ops_find("file");
+    s->mmap_chunk = DEFAULT_MMAP_CHUNK;
+    s->durability = DURABILITY_NONE;
+    s->sync_interval = DEFAULT_SYNC_INTERVAL;
+    s->sync_bytes = DEFAULT_SYNC_BYTES;
+    s->compress = COMPRESS_NONE;
+    s->compress_threads = 1;
+    s->level_map = level_map_create();
+    s->rate_limits = rate_limit_map_create();
+}
+
+/* Apply settings that can change without unloading; async-write, queue-size, writer-threads
+   and writer-cpus set up the writer threads and queues, so they only take effect on load */
+static void apply_config(logfile_domain_settings_t *s, switch_bool_t reload)
+{
+    domain_cache_entry_t **entries;
+    switch_bool_t relocate = SWITCH_FALSE;
+    int n, i;
+
+    if (!reload) {
+        globals.async_write = s->async_write;
+        globals.queue_size = s->queue_size;
+        globals.writer_count = s->async_write ? s->writer_threads : 1;
+        memcpy(globals.writer_cpus, s->writer_cpus, sizeof(globals.writer_cpus));
+        globals.writer_cpu_count = s->writer_cpu_count;
+#ifndef LOGFILE_DOMAIN_AFFINITY
+        if (s->writer_cpu_count) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                            "mod_logfile_domain: writer-cpus is not supported on this platform\n");
+        }
+#endif
+        if (s->uuid_cache_size) {
+            uint32_t size = 1;
+
+            while (size < s->uuid_cache_size) {
+                size <<= 1;
+            }
+            globals.uuid_cache = (uuid_cache_slot_t *)switch_core_alloc(module_pool, sizeof(uuid_cache_slot_t) * size);
+            globals.uuid_cache_mask = size - 1;
+        }
+    } else if (s->async_write != globals.async_write || s->queue_size != globals.queue_size ||
+               (s->async_write && s->writer_threads != globals.writer_count) ||
+               s->writer_cpu_count != globals.writer_cpu_count ||
+               memcmp(s->writer_cpus, globals.writer_cpus, sizeof(int) * s->writer_cpu_count) ||
+               (s->uuid_cache_size != 0) != (globals.uuid_cache != NULL) ||
+               (globals.uuid_cache && s->uuid_cache_size > globals.uuid_cache_mask + 1)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: async-write, queue-size, writer-threads, writer-cpus and uuid-cache-size changes need a module reload\n");
+    }
+
+    if (switch_dir_make_recursive(s->log_dir, SWITCH_DEFAULT_DIR_PERMS, module_pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Can't create log-dir %s\n", s->log_dir);
+    }
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+    if (s->sink_ops == domain_sink_ops_find("io_uring") && !globals.uring) {
+        log_uring_t *u = log_uring_create(s->buffer_size ? s->buffer_size : DEFAULT_BUFFER_SIZE);
+
+        if (u) {
+            __atomic_store_n(&globals.uring, u, __ATOMIC_RELEASE);
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                            "mod_logfile_domain: io_uring unavailable (%s), using file output\n", strerror(errno));
+            s->sink_ops = domain_sink_ops_find("file");
+        }
+    }
+#endif
+
+    switch_mutex_lock(globals.mutex);
+    __atomic_store_n(&globals.overflow_policy, s->overflow_policy, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.rebalance_depth, s->rebalance_depth, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.flush_interval, s->flush_interval, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.rotate_on_hup, s->rotate_on_hup, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.roll_size, s->roll_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.max_rot, s->max_rot, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.max_domains, s->max_domains, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.max_open_files, s->max_open_files, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.idle_timeout, s->idle_timeout, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.uuid_cache_ttl, s->uuid_cache_ttl, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.log_usec, s->log_usec, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.mmap_chunk, s->mmap_chunk, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.durability, s->durability, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.sync_interval, s->sync_interval, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.sync_bytes, s->sync_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.compress, s->compress, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.compress_level, s->compress_level, __ATOMIC_RELAXED);
+    if (globals.sink_ops != s->sink_ops) {
+        relocate = reload;
+        __atomic_store_n(&globals.sink_ops, s->sink_ops, __ATOMIC_RELAXED);
+    }
+    s->level_map->retired = globals.level_map;
+    __atomic_store_n(&globals.level_map, s->level_map, __ATOMIC_RELEASE);
+    s->rate_limits->retired = globals.rate_limits;
+    __atomic_store_n(&globals.rate_limits, s->rate_limits, __ATOMIC_RELEASE);
+    if (globals.compress_active != s->compress_active) {
+        relocate = reload;
+        __atomic_store_n(&globals.compress_active, s->compress_active, __ATOMIC_RELAXED);
+    }
+    if (strcmp(globals.log_dir, s->log_dir)) {
+        relocate = reload;
+        switch_copy_string(globals.log_dir, s->log_dir, sizeof(globals.log_dir));
+    }
+    __atomic_store_n(&globals.buffer_size, s->buffer_size, __ATOMIC_RELAXED);
+    switch_mutex_unlock(globals.mutex);
+
+    if (!s->latency_histograms != !globals.latency_enabled) {
+        latency_enable(s->latency_histograms);
+    }
+
+    if (s->compress != COMPRESS_NONE && !globals.compress_thread_count) {
+        start_compress_threads(s->compress_threads);
+    } else if (globals.compress_thread_count && s->compress_threads != globals.compress_thread_count) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: compress-threads changes need a module reload\n");
+    }
+
+    if (!reload) {
+        return;
+    }
+
+    /* Existing domains pick up the new rollover, buffer size and rate-limit right away */
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+
+        switch_mutex_lock(entry->file_lock);
+        entry->roll_size = s->roll_size;
+        rate_limit_apply(entry, s->rate_limits);
+        if (entry->buf_size != s->buffer_size) {
+            flush_domain_buffer(entry);
+            if (s->buffer_size > entry->buf_cap) {
+                free(entry->buf);
+                entry->buf = NULL;
+                entry->buf_cap = 0;
+            }
+            entry->buf_size = s->buffer_size;
+        }
+        check_domain_rollover(entry);
+        switch_mutex_unlock(entry->file_lock);
+    }
+
+    release_domain_entries(entries);
+
+    if (relocate) {
+        __atomic_add_fetch(&globals.relocate_requests, 1, __ATOMIC_RELEASE);
+    }
+
+    if (globals.writers) {
+        log_writer_wake(&globals.writers[0]);
+    }
+}
+
+static const char *const latency_stage_names[LATENCY_STAGES] = { "resolve", "render", "format", "write", "total" };
+
+static __thread latency_hist_t *latency_tls = NULL;
+static __thread uint32_t latency_tls_generation = 0;
+static uint32_t latency_generation = 0;   /* bumped on load, so no thread keeps a block from a previous load */
+
+/* ns per clock tick in 32.32 fixed point */
+void latency_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec a, b;
+    uint64_t t0, t1, ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    t0 = latency_now();
+    switch_yield(10000);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    t1 = latency_now();
+    ns = (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000 + (uint64_t)b.tv_nsec - (uint64_t)a.tv_nsec;
+    if (t1 > t0) {
+        __atomic_store_n(&globals.latency_mult, (ns << 32) / (t1 - t0), __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+    __atomic_store_n(&globals.latency_mult, (uint64_t)1 << 32, __ATOMIC_RELAXED);
+}
+
+/* Highest ns value that lands in bucket index */
+uint64_t latency_bucket_max(int index)
+{
+    int msb = 4 + (index - 16) / LATENCY_SUB_BUCKETS;
+    uint64_t sub = (uint64_t)((index - 16) % LATENCY_SUB_BUCKETS);
+
+    if (index < 16) {
+        return (uint64_t)index;
+    }
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+}
+
+/* The calling thread's block, created on its first timed line */
+static latency_hist_t *latency_thread_hist(void)
+{
+    latency_hist_t *hist;
+
+    if (latency_tls && latency_tls_generation == latency_generation) {
+        return latency_tls;
+    }
+
+    if (!(hist = (latency_hist_t *)calloc(1, sizeof(*hist)))) {
+        return NULL;
+    }
+    hist->next = __atomic_load_n(&globals.latency_hists, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&globals.latency_hists, &hist->next, hist, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    latency_tls = hist;
+    latency_tls_generation = latency_generation;
+
+    return hist;
+}
+
+/* Owner thread only: plain read-modify-write, atomic just for the reader's sake */
+static inline void latency_record(latency_hist_t *hist, int stage, uint64_t ticks)
+{
+    uint64_t ns = latency_ns(ticks);
+    uint64_t *count = &hist->counts[stage][latency_index(ns)];
+
+    __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    if (ns > __atomic_load_n(&hist->max[stage], __ATOMIC_RELAXED)) {
+        __atomic_store_n(&hist->max[stage], ns, __ATOMIC_RELAXED);
+    }
+}
+
+/* Turn recording on or off; the clock is calibrated the first time */
+void latency_enable(switch_bool_t on)
+{
+    if (on && !__atomic_load_n(&globals.latency_mult, __ATOMIC_RELAXED)) {
+        latency_calibrate();
+    }
+    __atomic_store_n(&globals.latency_enabled, on ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+/* Zero every block; a line being recorded concurrently may survive the reset */
+void latency_reset(void)
+{
+    latency_hist_t *hist;
+    int s, b;
+
+    for (hist = __atomic_load_n(&globals.latency_hists, __ATOMIC_ACQUIRE); hist; hist = hist->next) {
+        for (s = 0; s < LATENCY_STAGES; s++) {
+            for (b = 0; b < LATENCY_BUCKETS; b++) {
+                __atomic_store_n(&hist->counts[s][b], 0, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&hist->max[s], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* API: logfile_domain latency, every thread's blocks merged */
+void latency_dump(switch_stream_handle_t *stream)
+{
+    static const int pcts[] = { 500, 900, 990, 999 };   /* per mille */
+    uint64_t *counts = (uint64_t *)calloc(LATENCY_BUCKETS, sizeof(uint64_t));
+    latency_hist_t *hist;
+    uint32_t threads = 0;
+    int s, b, p;
+
+    if (!counts) {
+        stream->write_function(stream, "-ERR out of memory\n");
+        return;
+    }
+
+    for (hist = __atomic_load_n(&globals.latency_hists, __ATOMIC_ACQUIRE); hist; hist = hist->next) {
+        threads++;
+    }
+
+    stream->write_function(stream, "latency: %s\nclock: %s\nthreads: %u\n",
+                           __atomic_load_n(&globals.latency_enabled, __ATOMIC_RELAXED) ? "on" : "off",
+#if defined(__x86_64__) || defined(__i386__)
+                           "tsc",
+#else
+                           "monotonic",
+#endif
+                           threads);
+
+    for (s = 0; s < LATENCY_STAGES; s++) {
+        uint64_t total = 0, max = 0, seen = 0;
+
+        memset(counts, 0, sizeof(uint64_t) * LATENCY_BUCKETS);
+        for (hist = __atomic_load_n(&globals.latency_hists, __ATOMIC_ACQUIRE); hist; hist = hist->next) {
+            uint64_t m = __atomic_load_n(&hist->max[s], __ATOMIC_RELAXED);
+
+            for (b = 0; b < LATENCY_BUCKETS; b++) {
+                uint64_t c = __atomic_load_n(&hist->counts[s][b], __ATOMIC_RELAXED);
+
+                counts[b] += c;
+                total += c;
+            }
+            if (m > max) {
+                max = m;
+            }
+        }
+
+        stream->write_function(stream, "%s: count %" PRIu64, latency_stage_names[s], total);
+        for (p = 0, b = 0; p < (int)(sizeof(pcts) / sizeof(pcts[0])); p++) {
+            /* buckets only grow, so carry on from where the last percentile stopped */
+            while (total && b < LATENCY_BUCKETS && (seen + counts[b]) * 1000 < total * (uint64_t)pcts[p]) {
+                seen += counts[b++];
+            }
+            stream->write_function(stream, " p%g-ns %" PRIu64, pcts[p] / 10.0,
+                                   total && b < LATENCY_BUCKETS ? latency_bucket_max(b) : 0);
+        }
+        stream->write_function(stream, " max-ns %" PRIu64 "\n", max);
+    }
+
+    free(counts);
+}
+
+/* Stage boundary: record the time since *mark under stage and move the mark */
+#define LATENCY_MARK(_hist, _stage, _mark) \
+    do { \
+        if (_hist) { \
+            uint64_t _now = latency_now(); \
+            latency_record(_hist, _stage, _now - (_mark)); \
+            (_mark) = _now; \
+        } \
+    } while (0)
+
+/* Take a token from the domain's bucket, or count the line as suppressed when it is empty.
+   GCRA form: rate_tat is when the bucket would be full again, each line pushes it one
+   interval further, and a line that would push it more than the burst ahead of now is
+   turned away, so the bucket is a single word updated with one CAS. */
+static switch_bool_t rate_limit_admit(domain_cache_entry_t *entry, switch_time_t now)
+{
+    uint64_t interval = __atomic_load_n(&entry->rate_interval, __ATOMIC_RELAXED);
+    uint64_t t = (uint64_t)now * 1000, limit, tat, next;
+
+    if (!interval) {
+        return SWITCH_TRUE;
+    }
+
+    limit = t + __atomic_load_n(&entry->rate_tolerance, __ATOMIC_RELAXED);
+    tat = __atomic_load_n(&entry->rate_tat, __ATOMIC_RELAXED);
+    do {
+        next = (tat > t ? tat : t) + interval;
+        if (next > limit) {
+            __atomic_add_fetch(&entry->rate_suppressed, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&entry->stats.suppressed, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&globals.rate_limited, 1, __ATOMIC_RELAXED);
+            return SWITCH_FALSE;
+        }
+    } while (!__atomic_compare_exchange_n(&entry->rate_tat, &tat, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return SWITCH_TRUE;
+}
+
+/* Hand a finished line to the writer or write it here; takes over the caller's entry ref */
+static void log_line_to_domain(domain_cache_entry_t *entry, log_line_t *line)
+{
+    if (globals.async_write) {
+        enqueue_domain_log(entry, line);
+    } else {
+        write_domain_log(entry, line->iov, line->count, line->len);
+        __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* A line let through after some were rate-limited is preceded by one line counting them,
+   at most every RATE_SUMMARY_INTERVAL so a long storm does not double the lines it is
+   allowed; the thread that moves the due time on writes it, in place when here is set */
+static void log_suppressed_summary(domain_cache_entry_t *entry, switch_time_t now, switch_bool_t here)
+{
+    switch_time_t due = __atomic_load_n(&entry->rate_summary_due, __ATOMIC_RELAXED);
+    char text[128];
+    switch_size_t len;
+    log_line_t line;
+    uint64_t n;
+
+    if (now < due || !__atomic_compare_exchange_n(&entry->rate_summary_due, &due, now + RATE_SUMMARY_INTERVAL,
+                                                  0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (!(n = __atomic_exchange_n(&entry->rate_suppressed, 0, __ATOMIC_RELAXED))) {
+        return;
+    }
+
+    len = format_log_date(now, text);
+    len += switch_snprintf(text + len, sizeof(text) - len,
+                           " [NOTICE] [mod_logfile_domain] %" PRIu64 " lines suppressed by rate-limit\n", n);
+    line.count = 0;
+    line.len = 0;
+    log_line_add(&line, text, len);
+
+    if (here) {
+        write_domain_log(entry, line.iov, line.count, line.len);
+        return;
+    }
+
+    __atomic_add_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL);
+    log_line_to_domain(entry, &line);
+}
+
+/* Writer 0, every STATS_SAMPLE_INTERVAL: summaries a storm left behind when no line came
+   through after it. Written in place, since queueing could block writer 0 on itself. */
+void log_pending_summaries(switch_time_t now)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        if (__atomic_load_n(&entries[i]->rate_suppressed, __ATOMIC_RELAXED)) {
+            log_suppressed_summary(entries[i], now, SWITCH_TRUE);
+        }
+    }
+
+    release_domain_entries(entries);
+}
+
+/* Everything after the level check; hist is the thread's latency block, NULL when off */
+static void log_node_to_domain(const switch_log_node_t *node, switch_log_level_t level,
+                               const level_map_source_t *src, latency_hist_t *hist)
+{
+    domain_cache_entry_t *entry = NULL;
+    const char *uuid = NULL;
+    const char *msg;
+    switch_size_t msg_len;
+    log_line_t line;
+    switch_time_t now = node->timestamp ? node->timestamp : switch_micro_time_now();
+    char date[40];
+    char lineno[16];
+    const char *lvl;
+    uint64_t mark = hist ? latency_now() : 0, resolve = 0;
+
+    /* userdata is the session UUID for channel logs */
+    if (!zstr(node->userdata) && resolve_session_entry(node->userdata, now, &entry)) {
+        uuid = node->userdata;
+    }
+
+    /* Over its domain's rate-limit the line is only counted, before any rendering */
+    if (entry && !rate_limit_admit(entry, now)) {
+        domain_entry_release(entry);
+        LATENCY_MARK(hist, LATENCY_RESOLVE, mark);
+        return;
+    }
+
+    /* Nothing to write unless a domain was found or the message may name one */
+    if (!entry && !src->fallback) {
+        __atomic_add_fetch(&globals.renders_avoided, 1, __ATOMIC_RELAXED);
+        LATENCY_MARK(hist, LATENCY_RESOLVE, mark);
+        return;
+    }
+    if (hist) {
+        uint64_t t = latency_now();
+
+        resolve = t - mark;
+        mark = t;
+    }
+
+    /* The message text without the core's own prefix, used in place and never copied here */
+    __atomic_add_fetch(&globals.renders, 1, __ATOMIC_RELAXED);
+    msg = node->content ? node->content : node->data;
+    msg_len = msg ? strlen(msg) : 0;
+    while (msg_len && (msg[msg_len - 1] == '\n' || msg[msg_len - 1] == '\r')) {
+        msg_len--;
+    }
+    LATENCY_MARK(hist, LATENCY_RENDER, mark);
+
+    /* Fallback: if no session/domain, try to parse the message for domain_name= or domain= */
+    if (!entry && msg_len) {
+        switch_size_t flen = 0;
+        const char *f = extract_domain_from_msg(msg, msg_len, &flen);
+
+        if (f && !(entry = get_domain_entry(f, flen))) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                            "mod_logfile_domain: No cache entry for domain: %.*s\n", (int)flen, f);
+        } else if (entry && !rate_limit_admit(entry, now)) {
+            domain_entry_release(entry);
+            entry = NULL;
+        }
+    }
+    if (hist) {
+        mark -= resolve;
+        LATENCY_MARK(hist, LATENCY_RESOLVE, mark);
+    }
+
+    if (!entry) {
+        return;
+    }
+
+    /* The lookup's reference goes with the line and keeps the entry until it is written */
+    if (__atomic_load_n(&entry->rate_suppressed, __ATOMIC_RELAXED)) {
+        log_suppressed_summary(entry, now, SWITCH_FALSE);
+    }
+
+    /* "date [LEVEL] [file:func:line] message [uuid]\n" as segments over the node's own strings */
+    lvl = switch_log_level2str(level);
+    line.count = 0;
+    line.len = 0;
+    log_line_add(&line, date, format_log_date(now, date));
+    log_line_add(&line, " [", 2);
+    log_line_add(&line, lvl, strlen(lvl));
+    log_line_add(&line, "] [", 3);
+    log_line_add(&line, node->file, strlen(node->file));
+    log_line_add(&line, ":", 1);
+    log_line_add(&line, node->func, strlen(node->func));
+    log_line_add(&line, lineno, switch_snprintf(lineno, sizeof(lineno), ":%u] ", (unsigned)node->line));
+    if (msg_len) {
+        log_line_add(&line, msg, msg_len);
+    } else {
+        log_line_add(&line, "(message)", 9);
+    }
+    if (uuid) {
+        log_line_add(&line, " [", 2);
+        log_line_add(&line, uuid, strlen(uuid));
+        log_line_add(&line, "]", 1);
+    }
+    log_line_add(&line, "\n", 1);
+    LATENCY_MARK(hist, LATENCY_FORMAT, mark);
+
+    log_line_to_domain(entry, &line);
+    LATENCY_MARK(hist, LATENCY_WRITE, mark);
+}
+
+/* The logger callback: level check, then domain from the session, and only then the message */
+switch_status_t logfile_domain_log(const switch_log_node_t *node, switch_log_level_t level)
+{
+    const level_map_source_t *src;
+    latency_hist_t *hist;
+    uint64_t start;
+
+    /* Reject unmapped levels before any other work */
+    if (!node || (uint32_t)level >= 32) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    src = level_map_lookup(__atomic_load_n(&globals.level_map, __ATOMIC_ACQUIRE), node->file);
+
+    if (!(src->mask & (1U << level))) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    /* Skip internal module logs to prevent recursion: mod_logfile_domain.c and the core's files */
+    if (node->file && strstr(node->file, "logfile_domain")) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (!__atomic_load_n(&globals.latency_enabled, __ATOMIC_RELAXED) || !(hist = latency_thread_hist())) {
+        log_node_to_domain(node, level, src, NULL);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    start = latency_now();
+    log_node_to_domain(node, level, src, hist);
+    latency_record(hist, LATENCY_TOTAL, latency_now() - start);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Set up the core from settings (taken over, level map included) and start its threads.
+   Log lines can be passed to logfile_domain_log() once this returns. */
+switch_status_t logfile_domain_start(switch_memory_pool_t *pool, const logfile_domain_host_t *host, logfile_domain_settings_t *s)
+{
+    module_pool = pool;
+
+    memset(&globals, 0, sizeof(globals));
+    latency_generation++;
+    globals.host = host;
+    switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, module_pool);
+    switch_mutex_init(&globals.reload_mutex, SWITCH_MUTEX_NESTED, module_pool);
+    switch_mutex_init(&globals.clock_mutex, SWITCH_MUTEX_NESTED, module_pool);
+    switch_mutex_init(&globals.rotated_mutex, SWITCH_MUTEX_NESTED, module_pool);
+    switch_mutex_init(&globals.compress_mutex, SWITCH_MUTEX_NESTED, module_pool);
+    switch_thread_cond_create(&globals.compress_cond, module_pool);
+
+    globals.domain_table = domain_table_create(DOMAIN_TABLE_INITIAL_SIZE);
+
+    apply_config(s, SWITCH_FALSE);
+
+    __atomic_store_n(&globals.running, 1, __ATOMIC_RELEASE);
+
+    /* Start the writer threads before binding so queued lines always have a consumer;
+       writer 0 also flushes idle append buffers and performs rotations when writes are synchronous */
+    {
+        switch_threadattr_t *thd_attr = NULL;
+        uint32_t i;
+
+        globals.writers = (log_writer_t *)switch_core_alloc(module_pool, sizeof(log_writer_t) * globals.writer_count);
+
+        switch_threadattr_create(&thd_attr, module_pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+        for (i = 0; i < globals.writer_count; i++) {
+            log_writer_t *writer = &globals.writers[i];
+
+            writer->id = (int)i;
+            writer->cpu = globals.writer_cpu_count ? globals.writer_cpus[i % globals.writer_cpu_count] : -1;
+            if (globals.async_write) {
+                log_queue_init(&writer->queue, globals.queue_size);
+            }
+            switch_mutex_init(&writer->mutex, SWITCH_MUTEX_NESTED, module_pool);
+            switch_thread_cond_create(&writer->cond, module_pool);
+
+            if (switch_thread_create(&writer->thread, thd_attr, log_writer_thread, writer, module_pool) != SWITCH_STATUS_SUCCESS) {
+                writer->thread = NULL;
+                break;
+            }
+        }
+
+        if (i < globals.writer_count) {
+            /* Stop the ones that did start; their queues are still empty */
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                            "mod_logfile_domain: Failed to start writer thread, falling back to unbuffered synchronous writes without rotation\n");
+            __atomic_store_n(&globals.running, 0, __ATOMIC_RELEASE);
+            stop_log_writers();
+            __atomic_store_n(&globals.running, 1, __ATOMIC_RELEASE);
+            globals.async_write = SWITCH_FALSE;
+            globals.buffer_size = 0;
+            globals.roll_size = 0;
+        } else if (globals.async_write) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                            "mod_logfile_domain: Async writer started (%u writers, queue %u, overflow %s)\n",
+                            globals.writer_count, globals.writers[0].queue.mask + 1,
+                            globals.overflow_policy == QUEUE_OVERFLOW_BLOCK ? "block" : "drop");
+        }
+    }
+
+    /* Syncs run on their own thread so neither the logging callback nor writer 0 waits on the disk */
+    {
+        switch_threadattr_t *thd_attr = NULL;
+
+        switch_mutex_init(&globals.sync_mutex, SWITCH_MUTEX_NESTED, module_pool);
+        switch_thread_cond_create(&globals.sync_cond, module_pool);
+        switch_threadattr_create(&thd_attr, module_pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&globals.sync_thread, thd_attr, log_sync_thread, NULL, module_pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                            "mod_logfile_domain: Failed to start sync thread, files are only synced at shutdown\n");
+            globals.sync_thread = NULL;
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Apply re-read settings to the running core; see apply_config() for what needs a restart.
+   reloadxml and the API command may both get here at once. */
+void logfile_domain_reload(logfile_domain_settings_t *s)
+{
+    switch_mutex_lock(globals.reload_mutex);
+    apply_config(s, SWITCH_TRUE);
+    switch_mutex_unlock(globals.reload_mutex);
+}
+
+/* Stop taking lines (the caller has unbound the logger), drain the writers and free everything */
+void logfile_domain_stop(void)
+{
+    /* Let the writers drain what is already queued */
+    __atomic_store_n(&globals.running, 0, __ATOMIC_RELEASE);
+    stop_log_writers();
+    stop_sync_thread();
+    stop_compress_threads();
+
+    /* Close all open files, syncing what is still unsynced */
+    close_all_domain_logs();
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+    log_uring_destroy(globals.uring);
+    globals.uring = NULL;
+#endif
+
+    /* Release entry pools, then the tables and the slabs holding the entries */
+    {
+        domain_cache_entry_t **entries;
+        int n, i;
+
+        entries = collect_domain_entries(&n);
+        for (i = 0; i < n; i++) {
+            cleanup_domain_entry(entries[i]);
+        }
+        release_domain_entries(entries);
+        domain_table_destroy();
+
+        while (globals.entry_retired) {
+            cleanup_domain_entry(globals.entry_retired);
+            globals.entry_retired = globals.entry_retired->next;
+        }
+        while (globals.entry_slabs) {
+            entry_slab_t *next = globals.entry_slabs->next;
+
+            free(globals.entry_slabs);
+            globals.entry_slabs = next;
+        }
+        globals.entry_free = NULL;
+        globals.entries_free = globals.entries_retired = globals.entry_slab_count = 0;
+    }
+
+    level_map_destroy(globals.level_map);
+    globals.level_map = NULL;
+    rate_limit_map_destroy(globals.rate_limits);
+    globals.rate_limits = NULL;
+
+    while (globals.latency_hists) {
+        struct latency_hist *next = globals.latency_hists->next;
+
+        free(globals.latency_hists);
+        globals.latency_hists = next;
+    }
+}
+
+/* On HUP either rotate every domain file or, with rotate-on-hup off, reopen them so an
+   external logrotate is picked up; buffered lines are flushed first in both cases */
+void logfile_domain_hup(void)
+{
+    if (__atomic_load_n(&globals.rotate_on_hup, __ATOMIC_RELAXED)) {
+        request_rotate_all();
+        log_writer_wake(&globals.writers[0]);
+    } else {
+        reopen_all_domain_logs(SWITCH_FALSE);
+    }
+}
+
+/* Copy str into out as the body of a JSON string; out holds 6 bytes per input byte plus one */
+static void json_escape(char *out, const char *str, switch_size_t len)
+{
+    switch_size_t i;
+
+    for (i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char)c;
+        } else if (c < 0x20) {
+            out += sprintf(out, "\\u%04x", c);
+        } else {
+            *out++ = (char)c;
+        }
+    }
+    *out = '\0';
+}
+
+/* API: logfile_domain status [json]. Everything is read lock-free from a snapshot of the
+   table, so a poll never waits on, or holds up, a domain's writer. */
+void logfile_domain_status(switch_stream_handle_t *stream, switch_bool_t json)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    if (json) {
+        stream->write_function(stream, "{\"async_write\":%s,\"writers\":%u,\"queue_dropped\":%" PRIu64 ",\"domains\":[",
+                               globals.async_write ? "true" : "false", globals.writer_count,
+                               __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED));
+    } else {
+        stream->write_function(stream, "async-write: %s\nwriters: %u\nqueue-dropped: %" PRIu64 "\ndomains: %d\n",
+                               globals.async_write ? "true" : "false", globals.writer_count,
+                               __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED), n);
+    }
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+        domain_stats_t *stats = &entry->stats;
+        const domain_sink_ops_t *ops = __atomic_load_n(&entry->sink.ops, __ATOMIC_RELAXED);
+        switch_size_t buf_len = __atomic_load_n(&entry->buf_len, __ATOMIC_RELAXED);
+        switch_size_t buf_size = __atomic_load_n(&entry->buf_size, __ATOMIC_RELAXED);
+        uint32_t queued = __atomic_load_n(&entry->refs, __ATOMIC_RELAXED);
+        uint64_t p50 = latency_percentile(stats->write_hist, WRITE_HISTOGRAM_BUCKETS, 50);
+        uint64_t p99 = latency_percentile(stats->write_hist, WRITE_HISTOGRAM_BUCKETS, 99);
+
+        if (json) {
+            char name[DOMAIN_NAME_MAX * 6 + 1];
+
+            json_escape(name, entry->domain->str, entry->domain->len);
+            stream->write_function(stream, "%s{\"domain\":\"%s\",\"writer\":%u,\"open\":%s,\"output\":\"%s\",\"rotate_pending\":%s,"
+                                   "\"lines\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"lines_per_sec\":%" PRIu64 ",\"bytes_per_sec\":%" PRIu64 ","
+                                   "\"buffer_used\":%" SWITCH_SIZE_T_FMT ",\"buffer_size\":%" SWITCH_SIZE_T_FMT ",\"queued\":%u,"
+                                   "\"drops\":%" PRIu64 ",\"suppressed\":%" PRIu64 ",\"opens\":%" PRIu64 ",\"write_errors\":%" PRIu64 ","
+                                   "\"write_p50_usec\":%" PRIu64 ",\"write_p99_usec\":%" PRIu64 "}",
+                                   i ? "," : "", name, __atomic_load_n(&entry->writer, __ATOMIC_RELAXED),
+                                   ops ? "true" : "false", ops ? ops->name : "",
+                                   __atomic_load_n(&entry->rotate_pending, __ATOMIC_RELAXED) ? "true" : "false",
+                                   __atomic_load_n(&stats->lines, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->lines_rate, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->bytes_rate, __ATOMIC_RELAXED),
+                                   buf_len, buf_size, queued,
+                                   __atomic_load_n(&stats->drops, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->suppressed, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->opens, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->write_errors, __ATOMIC_RELAXED), p50, p99);
+        } else {
+            stream->write_function(stream, "%s: writer %u %s%s%s lines/s %" PRIu64 " bytes/s %" PRIu64
+                                   " buffer %" SWITCH_SIZE_T_FMT "/%" SWITCH_SIZE_T_FMT " queued %u drops %" PRIu64 " suppressed %" PRIu64
+                                   " opens %" PRIu64 " write-errors %" PRIu64 " write-p50-us %" PRIu64 " write-p99-us %" PRIu64 "\n",
+                                   entry->domain->str, __atomic_load_n(&entry->writer, __ATOMIC_RELAXED),
+                                   ops ? "open " : "closed", ops ? ops->name : "",
+                                   __atomic_load_n(&entry->rotate_pending, __ATOMIC_RELAXED) ? " rotating" : "",
+                                   __atomic_load_n(&stats->lines_rate, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->bytes_rate, __ATOMIC_RELAXED),
+                                   buf_len, buf_size, queued,
+                                   __atomic_load_n(&stats->drops, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->suppressed, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->opens, __ATOMIC_RELAXED),
+                                   __atomic_load_n(&stats->write_errors, __ATOMIC_RELAXED), p50, p99);
+        }
+    }
+
+    if (json) {
+        stream->write_function(stream, "]}\n");
+    }
+
+    release_domain_entries(entries);
+}
+
+/* API: logfile_domain queue */
+void logfile_domain_queue_report(switch_stream_handle_t *stream)
+{
+    if (!globals.async_write) {
+        stream->write_function(stream, "async-write disabled\n");
+    } else {
+        uint32_t depth = 0, hw = 0, i;
+
+        for (i = 0; i < globals.writer_count; i++) {
+            uint32_t whw = __atomic_load_n(&globals.writers[i].high_water, __ATOMIC_RELAXED);
+
+            depth += log_queue_depth(&globals.writers[i].queue);
+            if (whw > hw) {
+                hw = whw;
+            }
+        }
+
+        stream->write_function(stream, "writers: %u\ndepth: %u\nsize: %u\nhigh-water: %u\ndropped: %" PRIu64 "\npolicy: %s\n",
+                               globals.writer_count, depth,
+                               globals.writers[0].queue.mask + 1, hw,
+                               __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED),
+                               __atomic_load_n(&globals.overflow_policy, __ATOMIC_RELAXED) == QUEUE_OVERFLOW_BLOCK ? "block" : "drop");
+
+        if (globals.writer_count > 1) {
+            for (i = 0; i < globals.writer_count; i++) {
+                log_writer_t *writer = &globals.writers[i];
+
+                stream->write_function(stream, "writer-%u: depth %u high-water %u cpu %d\n", i,
+                                       log_queue_depth(&writer->queue),
+                                       __atomic_load_n(&writer->high_water, __ATOMIC_RELAXED), writer->cpu);
+            }
+            stream->write_function(stream, "migrations: %" PRIu64 "\n",
+                                   __atomic_load_n(&globals.migrations, __ATOMIC_RELAXED));
+        }
+    }
+}
+
+/* API: logfile_domain stats */
+void logfile_domain_stats_report(switch_stream_handle_t *stream)
+{
+    compress_t compress = __atomic_load_n(&globals.compress, __ATOMIC_RELAXED);
+    compress_t compress_active = __atomic_load_n(&globals.compress_active, __ATOMIC_RELAXED);
+
+    stream->write_function(stream, "renders: %" PRIu64 "\nrenders-avoided: %" PRIu64 "\nrate-limited: %" PRIu64 "\n"
+                           "uuid-cache-hits: %" PRIu64 "\nuuid-cache-misses: %" PRIu64 "\n"
+                           "domains: %d\nopen-files: %d\nmax-open-files: %d\n"
+                           "handle-hits: %" PRIu64 "\nhandle-misses: %" PRIu64 "\n"
+                           "evictions: %" PRIu64 "\nidle-closes: %" PRIu64 "\n",
+                           __atomic_load_n(&globals.renders, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.renders_avoided, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.rate_limited, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.uuid_cache_hits, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.uuid_cache_misses, __ATOMIC_RELAXED),
+                           globals.cache_entries,
+                           __atomic_load_n(&globals.open_files, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.max_open_files, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.handle_hits, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.handle_misses, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.evictions, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.idle_closes, __ATOMIC_RELAXED));
+    switch_mutex_lock(globals.mutex);
+    stream->write_function(stream, "entry-slabs: %u\nentries-free: %u\nentries-retired: %u\nentries-reclaimed: %" PRIu64 "\n",
+                           globals.entry_slab_count, globals.entries_free, globals.entries_retired,
+                           globals.entries_reclaimed);
+    switch_mutex_unlock(globals.mutex);
+    switch_mutex_lock(globals.compress_mutex);
+    stream->write_function(stream, "compress: %s\ncompressed: %" PRIu64 "\ncompress-pending: %u\ncompress-errors: %" PRIu64 "\n"
+                           "compress-bytes-in: %" PRIu64 "\ncompress-bytes-out: %" PRIu64 "\n",
+                           compress == COMPRESS_ZSTD ? "zstd" : compress == COMPRESS_GZIP ? "gzip" : "none",
+                           __atomic_load_n(&globals.compressed, __ATOMIC_RELAXED), globals.compress_pending,
+                           __atomic_load_n(&globals.compress_errors, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.compress_bytes_in, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.compress_bytes_out, __ATOMIC_RELAXED));
+    switch_mutex_unlock(globals.compress_mutex);
+    stream->write_function(stream, "compress-active: %s\nstream-frames: %" PRIu64 "\nstream-bytes-in: %" PRIu64 "\nstream-bytes-out: %" PRIu64 "\n",
+                           compress_active == COMPRESS_ZSTD ? "zstd" : compress_active == COMPRESS_GZIP ? "gzip" : "none",
+                           __atomic_load_n(&globals.stream_frames, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.stream_bytes_in, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.stream_bytes_out, __ATOMIC_RELAXED));
+#ifdef LOGFILE_DOMAIN_IO_URING
+    log_uring_report(stream);
+#endif
+}
+
+/* API: logfile_domain sync */
+void logfile_domain_sync_report(switch_stream_handle_t *stream)
+{
+    durability_t durability = __atomic_load_n(&globals.durability, __ATOMIC_RELAXED);
+    int i;
+
+    stream->write_function(stream, "durability: %s\nsyncs: %" PRIu64 "\nerrors: %" PRIu64 "\nlatency-usec:\n",
+                           durability == DURABILITY_INTERVAL ? "interval" :
+                           durability == DURABILITY_BYTES ? "bytes" : "none",
+                           __atomic_load_n(&globals.syncs, __ATOMIC_RELAXED),
+                           __atomic_load_n(&globals.sync_errors, __ATOMIC_RELAXED));
+    for (i = 0; i < SYNC_HISTOGRAM_BUCKETS; i++) {
+        uint64_t count = __atomic_load_n(&globals.sync_hist[i], __ATOMIC_RELAXED);
+
+        if (count) {
+            stream->write_function(stream, "  %" PRIu64 "-%" PRIu64 ": %" PRIu64 "\n",
+                                   i ? (uint64_t)1 << i : 0, ((uint64_t)2 << i) - 1, count);
+        }
+    }
+}
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,372 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_format.c -- Level and rate-limit maps, domain scan of the message and line formatting
+ *
+ */
+
+#include "logfile_domain.h"
+
+/* Levels up to and including level as a mask */
+uint32_t level_floor_mask(switch_log_level_t level)
+{
+    if (level < SWITCH_LOG_CONSOLE) {
+        return 0;
+    }
+    if (level >= 31) {
+        return 0xFFFFFFFFU;
+    }
+
+    return (1U << (level + 1)) - 1;
+}
+
+level_map_t *level_map_create(void)
+{
+    level_map_t *map;
+
+    switch_zmalloc(map, sizeof(*map));
+
+    return map;
+}
+
+/* Free a map and everything on its retired list */
+void level_map_destroy(level_map_t *map)
+{
+    while (map) {
+        level_map_t *next = map->retired;
+
+        if (map->sources) {
+            switch_hash_index_t *hi;
+            void *val;
+
+            for (hi = switch_core_hash_first(map->sources); hi; hi = switch_core_hash_next(&hi)) {
+                switch_core_hash_this(hi, NULL, NULL, &val);
+                free(val);
+            }
+            switch_core_hash_destroy(&map->sources);
+        }
+        free(map);
+        map = next;
+    }
+}
+
+/* Add <map name="all"|"source.c" value="debug,info,..." [fallback="bool"]/>; repeated names
+   accumulate levels. A file map starts with the "all" fallback unless it sets its own. */
+void level_map_add(level_map_t *map, const char *name, uint32_t mask, const char *fallback)
+{
+    level_map_source_t *src;
+
+    if (!strcasecmp(name, "all")) {
+        map->all.mask |= mask;
+        if (fallback) {
+            map->all.fallback = switch_true(fallback) ? SWITCH_TRUE : SWITCH_FALSE;
+        }
+        return;
+    }
+
+    if (!map->sources) {
+        switch_core_hash_init(&map->sources);
+    }
+
+    if (!(src = (level_map_source_t *)switch_core_hash_find(map->sources, name))) {
+        switch_zmalloc(src, sizeof(*src));
+        src->fallback = -1;
+        switch_core_hash_insert(map->sources, name, src);
+    }
+
+    src->mask |= mask;
+    if (fallback) {
+        src->fallback = switch_true(fallback) ? SWITCH_TRUE : SWITCH_FALSE;
+    }
+}
+
+/* Restrict every mask to log-level so the callback needs a single test, and let file maps
+   without a fallback attribute inherit the one from "all" */
+void level_map_finish(level_map_t *map, switch_log_level_t level)
+{
+    uint32_t floor = level_floor_mask(level);
+
+    map->all.mask &= floor;
+
+    if (map->sources) {
+        switch_hash_index_t *hi;
+        void *val;
+
+        for (hi = switch_core_hash_first(map->sources); hi; hi = switch_core_hash_next(&hi)) {
+            switch_core_hash_this(hi, NULL, NULL, &val);
+            level_map_source_t *src = (level_map_source_t *)val;
+
+            src->mask &= floor;
+            if (src->fallback < 0) {
+                src->fallback = map->all.fallback;
+            }
+        }
+    }
+}
+
+/* Mask for a node's source, falling back to "all" */
+const level_map_source_t *level_map_lookup(const level_map_t *map, const char *file)
+{
+    const level_map_source_t *src;
+
+    if (map->sources && file && (src = (const level_map_source_t *)switch_core_hash_find(map->sources, file))) {
+        return src;
+    }
+
+    return &map->all;
+}
+
+rate_limit_map_t *rate_limit_map_create(void)
+{
+    rate_limit_map_t *map;
+
+    switch_zmalloc(map, sizeof(*map));
+
+    return map;
+}
+
+/* Free a map and everything on its retired list */
+void rate_limit_map_destroy(rate_limit_map_t *map)
+{
+    while (map) {
+        rate_limit_map_t *next = map->retired;
+
+        if (map->domains) {
+            switch_hash_index_t *hi;
+            void *val;
+
+            for (hi = switch_core_hash_first(map->domains); hi; hi = switch_core_hash_next(&hi)) {
+                switch_core_hash_this(hi, NULL, NULL, &val);
+                free(val);
+            }
+            switch_core_hash_destroy(&map->domains);
+        }
+        free(map);
+        map = next;
+    }
+}
+
+/* Add <domain name="..." rate-limit="N" rate-limit-burst="N"/>, -1 for an attribute it leaves
+   out; a repeated name replaces what it sets */
+void rate_limit_map_add(rate_limit_map_t *map, const char *domain, int rate, int burst)
+{
+    rate_limit_t *limit;
+
+    if (!map->domains) {
+        switch_core_hash_init(&map->domains);
+    }
+
+    if (!(limit = (rate_limit_t *)switch_core_hash_find(map->domains, domain))) {
+        switch_zmalloc(limit, sizeof(*limit));
+        limit->rate = -1;
+        limit->burst = -1;
+        switch_core_hash_insert(map->domains, domain, limit);
+    }
+
+    if (rate >= 0) {
+        limit->rate = rate;
+    }
+    if (burst >= 0) {
+        limit->burst = burst;
+    }
+}
+
+/* Fill what a domain left out from the global settings, then turn a burst of 0 into one
+   second's worth of its own rate */
+void rate_limit_map_finish(rate_limit_map_t *map)
+{
+    if (map->domains) {
+        switch_hash_index_t *hi;
+        void *val;
+
+        for (hi = switch_core_hash_first(map->domains); hi; hi = switch_core_hash_next(&hi)) {
+            switch_core_hash_this(hi, NULL, NULL, &val);
+            rate_limit_t *limit = (rate_limit_t *)val;
+
+            if (limit->rate < 0) {
+                limit->rate = map->all.rate;
+            }
+            if (limit->burst < 0) {
+                limit->burst = map->all.burst;
+            }
+            if (!limit->burst) {
+                limit->burst = limit->rate;
+            }
+        }
+    }
+
+    if (!map->all.burst) {
+        map->all.burst = map->all.rate;
+    }
+}
+
+/* Limit for a domain, falling back to the global one */
+const rate_limit_t *rate_limit_lookup(const rate_limit_map_t *map, const char *domain)
+{
+    const rate_limit_t *limit;
+
+    if (map->domains && (limit = (const rate_limit_t *)switch_core_hash_find(map->domains, domain))) {
+        return limit;
+    }
+
+    return &map->all;
+}
+
+/* Copy the domain's limit into its entry; the bucket itself carries over */
+void rate_limit_apply(domain_cache_entry_t *entry, const rate_limit_map_t *map)
+{
+    const rate_limit_t *limit = rate_limit_lookup(map, entry->domain->str);
+    uint64_t interval = limit->rate > 0 ? 1000000000ULL / (uint64_t)limit->rate : 0;
+
+    __atomic_store_n(&entry->rate_tolerance, interval * (uint64_t)limit->burst, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->rate_interval, interval, __ATOMIC_RELAXED);
+}
+
+/* Offset of the value if a domain key starts at p: 12 for domain_name=, 7 for domain=, else 0 */
+static inline switch_size_t domain_key_at(const char *p, const char *end)
+{
+    if (end - p < 7 || memcmp(p, "domain", 6)) {
+        return 0;
+    }
+    if (p[6] == '=') {
+        return 7;
+    }
+    if (end - p >= 12 && !memcmp(p + 6, "_name=", 6)) {
+        return 12;
+    }
+
+    return 0;
+}
+
+/* Try to extract domain from a rendered log message (fallback). Reentrant and allocation-free:
+   returns a view into msg, preferring domain_name= over domain= like the variable lookup.
+   A single pass visits each 'd', found SCAN_WIDTH bytes at a time where SIMD is available. */
+const char *extract_domain_from_msg(const char *msg, switch_size_t len, switch_size_t *domain_len)
+{
+    const char *end = msg + len;
+    const char *value = NULL;
+    switch_size_t i = 0, off;
+
+#define DOMAIN_SCAN_CANDIDATE(_p) \
+    if ((off = domain_key_at((_p), end))) { \
+        if (off == 12) { \
+            value = (_p) + off; \
+            goto found; \
+        } \
+        if (!value) { \
+            value = (_p) + off; \
+        } \
+    }
+
+#ifdef SCAN_WIDTH
+    for (; i + SCAN_WIDTH <= len; i += SCAN_WIDTH) {
+#if SCAN_WIDTH == 32
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(msg + i)),
+                                                                         _mm256_set1_epi8('d')));
+#else
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(msg + i)),
+                                                                   _mm_set1_epi8('d')));
+#endif
+        while (mask) {
+            const char *p = msg + i + __builtin_ctz(mask);
+
+            mask &= mask - 1;
+            DOMAIN_SCAN_CANDIDATE(p);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (msg[i] == 'd') {
+            DOMAIN_SCAN_CANDIDATE(msg + i);
+        }
+    }
+
+#undef DOMAIN_SCAN_CANDIDATE
+
+    if (!value) {
+        return NULL;
+    }
+
+  found:
+    /* value runs until whitespace or the end */
+    for (off = 0; value + off < end && !isspace((unsigned char)value[off]); off++);
+
+    if (!off) {
+        return NULL;
+    }
+
+    *domain_len = off;
+
+    return value;
+}
+
+/* "%Y-%m-%d %H:%M:%S" for the second last formatted on this thread */
+typedef struct {
+    switch_time_t sec;
+    switch_size_t len;
+    char date[32];
+} date_cache_t;
+
+static __thread date_cache_t date_cache = { -1, 0, "" };
+
+/* Write the line's timestamp into buf (at least 40 bytes) and return its length. Timezone
+   conversion and strftime only run when the second changes; microseconds come from ts. */
+switch_size_t format_log_date(switch_time_t ts, char *buf)
+{
+    switch_time_t sec = ts / 1000000;
+    switch_size_t len;
+
+    if (sec != date_cache.sec) {
+        switch_time_exp_t tm;
+        switch_size_t retsize;
+
+        switch_time_exp_lt(&tm, sec * 1000000);
+        switch_strftime_nocheck(date_cache.date, &retsize, sizeof(date_cache.date), "%Y-%m-%d %H:%M:%S", &tm);
+        date_cache.len = strlen(date_cache.date);
+        date_cache.sec = sec;
+    }
+
+    memcpy(buf, date_cache.date, date_cache.len);
+    len = date_cache.len;
+
+    if (__atomic_load_n(&globals.log_usec, __ATOMIC_RELAXED)) {
+        uint32_t usec = (uint32_t)(ts % 1000000);
+        int i;
+
+        buf[len] = '.';
+        for (i = 6; i > 0; i--) {
+            buf[len + i] = (char)('0' + usec % 10);
+            usec /= 10;
+        }
+        len += 7;
+    }
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
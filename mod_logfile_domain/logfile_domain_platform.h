@@ -0,0 +1,74 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_platform.h -- What the logging core is built on
+ *
+ * The core only uses the portable part of the FreeSWITCH core API: memory pools,
+ * mutexes, condition variables, threads, files, time, hashes, log printing and API
+ * streams, plus plain POSIX I/O. The module builds it against <switch.h>, the tests and
+ * benchmarks against the stub in bench/stub, so the core runs without FreeSWITCH.
+ * Sessions, channels, events, XML and module registration stay in mod_logfile_domain.c;
+ * the one thing the core asks of them goes through logfile_domain_host_t.
+ *
+ */
+
+#ifndef LOGFILE_DOMAIN_PLATFORM_H
+#define LOGFILE_DOMAIN_PLATFORM_H
+
+#include <switch.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/uio.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+/* IORING_OP_WRITE and the probe are enum values; this flag came with them in 5.6 */
+#ifdef IORING_FEAT_RW_CUR_POS
+#define LOGFILE_DOMAIN_IO_URING 1
+#endif
+#endif
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#define LOGFILE_DOMAIN_AFFINITY 1
+#endif
+#include <zlib.h>
+#ifdef LOGFILE_DOMAIN_ZSTD
+#include <zstd.h>
+#endif
+#if defined(WIN32)
+#define domain_fdatasync(fd) _commit(fd)
+#elif defined(__linux__)
+#define domain_fdatasync(fd) fdatasync(fd)
+#else
+#define domain_fdatasync(fd) fsync(fd)
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_WIDTH 16
+#endif
+
+#endif
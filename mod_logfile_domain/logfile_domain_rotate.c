@@ -0,0 +1,596 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_rotate.c -- Size rotation, rotated generations and their compression
+ *
+ */
+
+#include "logfile_domain.h"
+
+/* Length of the live path without its compress-active suffix; rotated names derive from it */
+static int rotated_base_len(const domain_cache_entry_t *entry)
+{
+    return (int)(entry->path->len - strlen(compress_ext(entry->stream)));
+}
+
+/* Queue the file just rotated to base.1. Called on writer 0 without file_lock, after the
+   old sink is closed so nothing is still appending to it. */
+static void compress_job_add(compress_job_t **jobs, const char *base, const char *rotated)
+{
+    compress_job_t *job;
+    size_t len = strlen(base);
+    int fd;
+
+    if ((fd = open(rotated, O_RDONLY | O_CLOEXEC)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Can't open %s for compression: %s\n", rotated, strerror(errno));
+        return;
+    }
+
+    if (!(job = (compress_job_t *)malloc(sizeof(*job) + len + 1))) {
+        close(fd);
+        return;
+    }
+
+    job->fd = fd;
+    job->method = __atomic_load_n(&globals.compress, __ATOMIC_RELAXED);
+    job->level = __atomic_load_n(&globals.compress_level, __ATOMIC_RELAXED);
+    job->base = (char *)(job + 1);
+    memcpy(job->base, base, len + 1);
+    job->next = *jobs;
+    *jobs = job;
+}
+
+/* Hand rotated files to the compress threads */
+static void compress_jobs_submit(compress_job_t *jobs)
+{
+    uint32_t n = 0;
+    compress_job_t *tail;
+
+    if (!jobs) {
+        return;
+    }
+
+    for (tail = jobs, n = 1; tail->next; tail = tail->next) {
+        n++;
+    }
+
+    switch_mutex_lock(globals.compress_mutex);
+    if (globals.compress_jobs_tail) {
+        globals.compress_jobs_tail->next = jobs;
+    } else {
+        globals.compress_jobs = jobs;
+    }
+    globals.compress_jobs_tail = tail;
+    globals.compress_pending += n;
+    switch_thread_cond_broadcast(globals.compress_cond);
+    switch_mutex_unlock(globals.compress_mutex);
+}
+
+static void compress_job_free(compress_job_t *job)
+{
+    close(job->fd);
+    free(job);
+}
+
+/* Compress everything readable from in into out; stops early, failing, on shutdown */
+static switch_bool_t compress_gzip(int in, int out, int level, char *chunk, uint64_t *bytes_in)
+{
+    gzFile gz;
+    char mode[8];
+    ssize_t n;
+    int fd;
+
+    if ((fd = dup(out)) < 0) {
+        return SWITCH_FALSE;
+    }
+    switch_snprintf(mode, sizeof(mode), level ? "wb%d" : "wb", level > 9 ? 9 : level);
+    if (!(gz = gzdopen(fd, mode))) {
+        close(fd);
+        return SWITCH_FALSE;
+    }
+
+    while ((n = read(in, chunk, COMPRESS_CHUNK)) > 0) {
+        if (__atomic_load_n(&globals.compress_stop, __ATOMIC_RELAXED) || gzwrite(gz, chunk, (unsigned)n) != (int)n) {
+            gzclose(gz);
+            return SWITCH_FALSE;
+        }
+        *bytes_in += (uint64_t)n;
+    }
+
+    return gzclose(gz) == Z_OK && n == 0;
+}
+
+#ifdef LOGFILE_DOMAIN_ZSTD
+static switch_bool_t write_all(int fd, const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return SWITCH_FALSE;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return SWITCH_TRUE;
+}
+
+static switch_bool_t compress_zstd(int in, int out, int level, char *chunk, uint64_t *bytes_in)
+{
+    ZSTD_CCtx *cctx;
+    size_t out_size = ZSTD_CStreamOutSize();
+    char *obuf;
+    switch_bool_t ok = SWITCH_FALSE;
+    ssize_t n;
+
+    if (!(cctx = ZSTD_createCCtx())) {
+        return SWITCH_FALSE;
+    }
+    if (!(obuf = (char *)malloc(out_size))) {
+        ZSTD_freeCCtx(cctx);
+        return SWITCH_FALSE;
+    }
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level ? level : ZSTD_CLEVEL_DEFAULT);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+    for (;;) {
+        ZSTD_EndDirective mode;
+        ZSTD_inBuffer ib;
+        size_t left;
+
+        if ((n = read(in, chunk, COMPRESS_CHUNK)) < 0 || __atomic_load_n(&globals.compress_stop, __ATOMIC_RELAXED)) {
+            goto end;
+        }
+        *bytes_in += (uint64_t)n;
+        mode = n ? ZSTD_e_continue : ZSTD_e_end;
+        ib.src = chunk;
+        ib.size = (size_t)n;
+        ib.pos = 0;
+
+        do {
+            ZSTD_outBuffer ob = { obuf, out_size, 0 };
+
+            left = ZSTD_compressStream2(cctx, &ob, &ib, mode);
+            if (ZSTD_isError(left) || !write_all(out, obuf, ob.pos)) {
+                goto end;
+            }
+        } while (mode == ZSTD_e_end ? left != 0 : ib.pos < ib.size);
+
+        if (!n) {
+            break;
+        }
+    }
+    ok = SWITCH_TRUE;
+
+  end:
+    free(obuf);
+    ZSTD_freeCCtx(cctx);
+
+    return ok;
+}
+#endif
+
+/* Compress one rotated file to a temporary name, then under rotated_mutex find which
+   generation it is now and swap the compressed copy in. file_lock is never taken. */
+static void compress_rotated_log(compress_job_t *job, uint32_t id, char *chunk)
+{
+    size_t len = strlen(job->base) + WARM_FUZZY_OFFSET;
+    char *tmp = (char *)malloc(len * 2);
+    char *name = tmp + len;
+    switch_bool_t ok;
+    uint64_t bytes_in = 0;
+    struct stat src, st;
+    int out, i, max_rot;
+
+    if (!tmp) {
+        return;
+    }
+
+    switch_snprintf(tmp, len, "%s.compress-%u.tmp", job->base, id);
+    if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Can't create %s: %s\n", tmp, strerror(errno));
+        __atomic_add_fetch(&globals.compress_errors, 1, __ATOMIC_RELAXED);
+        free(tmp);
+        return;
+    }
+
+#ifdef LOGFILE_DOMAIN_ZSTD
+    if (job->method == COMPRESS_ZSTD) {
+        ok = compress_zstd(job->fd, out, job->level, chunk, &bytes_in);
+    } else
+#endif
+    ok = compress_gzip(job->fd, out, job->level, chunk, &bytes_in);
+
+    /* the original goes away below, so the copy must be on disk first */
+    if (ok && domain_fdatasync(out)) {
+        ok = SWITCH_FALSE;
+    }
+    memset(&st, 0, sizeof(st));
+    fstat(out, &st);
+    close(out);
+
+    if (!ok) {
+        if (!__atomic_load_n(&globals.compress_stop, __ATOMIC_RELAXED)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                            "mod_logfile_domain: Compression of a rotated %s failed\n", job->base);
+            __atomic_add_fetch(&globals.compress_errors, 1, __ATOMIC_RELAXED);
+        }
+        unlink(tmp);
+        free(tmp);
+        return;
+    }
+
+    fstat(job->fd, &src);
+
+    switch_mutex_lock(globals.rotated_mutex);
+    max_rot = __atomic_load_n(&globals.max_rot, __ATOMIC_RELAXED);
+    for (i = 1; i <= max_rot; i++) {
+        struct stat cur;
+
+        switch_snprintf(name, len, "%s.%d", job->base, i);
+        if (!stat(name, &cur) && cur.st_ino == src.st_ino && cur.st_dev == src.st_dev) {
+            break;
+        }
+    }
+    if (i <= max_rot) {
+        char *to = (char *)malloc(len);
+
+        if (to) {
+            switch_snprintf(to, len, "%s%s", name, compress_ext(job->method));
+            if (!rename(tmp, to)) {
+                unlink(name);
+                __atomic_add_fetch(&globals.compressed, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&globals.compress_bytes_in, bytes_in, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&globals.compress_bytes_out, (uint64_t)st.st_size, __ATOMIC_RELAXED);
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                                "mod_logfile_domain: Error renaming %s to %s: %s\n", tmp, to, strerror(errno));
+                __atomic_add_fetch(&globals.compress_errors, 1, __ATOMIC_RELAXED);
+            }
+            free(to);
+        }
+    }
+    switch_mutex_unlock(globals.rotated_mutex);
+
+    /* dropped past maximum-rotate or removed while we worked */
+    unlink(tmp);
+    free(tmp);
+}
+
+/* Compress thread: takes rotated files off the job list at the lowest CPU and I/O priority */
+static void *SWITCH_THREAD_FUNC log_compress_thread(switch_thread_t *thread, void *obj)
+{
+    uint32_t id = (uint32_t)(uintptr_t)obj;
+    char *chunk = (char *)malloc(COMPRESS_CHUNK);
+
+    (void)thread;
+
+#ifdef LOGFILE_DOMAIN_AFFINITY
+    {
+        pid_t tid = (pid_t)syscall(SYS_gettid);
+
+        setpriority(PRIO_PROCESS, (id_t)tid, 19);
+#ifdef SYS_ioprio_set
+        /* IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE */
+        syscall(SYS_ioprio_set, 1, tid, 3 << 13);
+#endif
+    }
+#endif
+
+    while (chunk) {
+        compress_job_t *job;
+
+        switch_mutex_lock(globals.compress_mutex);
+        while (!globals.compress_jobs && !globals.compress_stop) {
+            switch_thread_cond_wait(globals.compress_cond, globals.compress_mutex);
+        }
+        if (globals.compress_stop) {
+            switch_mutex_unlock(globals.compress_mutex);
+            break;
+        }
+        job = globals.compress_jobs;
+        if (!(globals.compress_jobs = job->next)) {
+            globals.compress_jobs_tail = NULL;
+        }
+        switch_mutex_unlock(globals.compress_mutex);
+
+        compress_rotated_log(job, id, chunk);
+
+        switch_mutex_lock(globals.compress_mutex);
+        globals.compress_pending--;
+        switch_mutex_unlock(globals.compress_mutex);
+        compress_job_free(job);
+    }
+
+    free(chunk);
+
+    return NULL;
+}
+
+/* Start the compress threads the first time compression is turned on */
+void start_compress_threads(uint32_t count)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    uint32_t i;
+
+    switch_threadattr_create(&thd_attr, module_pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+    for (i = 0; i < count; i++) {
+        if (switch_thread_create(&globals.compress_threads[i], thd_attr, log_compress_thread,
+                                 (void *)(uintptr_t)i, module_pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                            "mod_logfile_domain: Failed to start compress thread %u\n", i);
+            break;
+        }
+    }
+    globals.compress_thread_count = i;
+}
+
+/* Join the compress threads; files still queued stay uncompressed */
+void stop_compress_threads(void)
+{
+    uint32_t i, left;
+
+    switch_mutex_lock(globals.compress_mutex);
+    globals.compress_stop = 1;
+    switch_thread_cond_broadcast(globals.compress_cond);
+    switch_mutex_unlock(globals.compress_mutex);
+
+    for (i = 0; i < globals.compress_thread_count; i++) {
+        switch_status_t st;
+
+        switch_thread_join(&st, globals.compress_threads[i]);
+        globals.compress_threads[i] = NULL;
+    }
+    globals.compress_thread_count = 0;
+
+    left = globals.compress_pending;
+    while (globals.compress_jobs) {
+        compress_job_t *job = globals.compress_jobs;
+
+        globals.compress_jobs = job->next;
+        compress_job_free(job);
+    }
+    globals.compress_jobs_tail = NULL;
+    globals.compress_pending = 0;
+
+    if (left) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: %u rotated files left uncompressed\n", left);
+    }
+}
+
+/* Rename domain_X.log.N[.gz|.zst] to .N+1 down to .1, dropping the oldest beyond
+   maximum-rotate. Only writer 0 rotates and nobody writes to rotated files; rotated_mutex,
+   held by the caller, keeps compress threads from renaming underneath. */
+static void shift_rotated_logs(domain_cache_entry_t *entry, switch_memory_pool_t *pool)
+{
+    char *from = switch_core_alloc(pool, strlen(entry->path->str) + WARM_FUZZY_OFFSET);
+    char *to = switch_core_alloc(pool, strlen(entry->path->str) + WARM_FUZZY_OFFSET);
+    const int exts = (int)(sizeof(rotated_log_exts) / sizeof(rotated_log_exts[0]));
+    int base = rotated_base_len(entry);
+    int i, x;
+
+    if (entry->suffix < 0) {
+        for (entry->suffix = 0; entry->suffix < MAX_ROT; entry->suffix++) {
+            for (x = 0; x < exts; x++) {
+                sprintf(from, "%.*s.%d%s", base, entry->path->str, entry->suffix + 1, rotated_log_exts[x]);
+                if (switch_file_exists(from, pool) == SWITCH_STATUS_SUCCESS) {
+                    break;
+                }
+            }
+            if (x == exts) {
+                break;
+            }
+        }
+    }
+
+    while (entry->suffix >= __atomic_load_n(&globals.max_rot, __ATOMIC_RELAXED)) {
+        for (x = 0; x < exts; x++) {
+            sprintf(from, "%.*s.%d%s", base, entry->path->str, entry->suffix, rotated_log_exts[x]);
+            switch_file_remove(from, pool);
+        }
+        entry->suffix--;
+    }
+
+    for (i = entry->suffix; i >= 1; i--) {
+        for (x = 0; x < exts; x++) {
+            sprintf(from, "%.*s.%d%s", base, entry->path->str, i, rotated_log_exts[x]);
+            if (switch_file_exists(from, pool) != SWITCH_STATUS_SUCCESS) {
+                continue;
+            }
+            sprintf(to, "%.*s.%d%s", base, entry->path->str, i + 1, rotated_log_exts[x]);
+            if (switch_file_rename(from, to, pool) != SWITCH_STATUS_SUCCESS) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                                "mod_logfile_domain: Error renaming %s to %s\n", from, to);
+            }
+        }
+    }
+}
+
+/* Rotate one domain file. Renames and the new open happen without file_lock; writers keep
+   appending to the old handle until the swap, which is the only step done under the lock.
+   With compress on, the rotated file is added to jobs once nothing writes to it. */
+static switch_status_t rotate_domain_log(domain_cache_entry_t *entry, compress_job_t **jobs)
+{
+    switch_memory_pool_t *pool = NULL;
+    domain_sink_t new_sink, old_sink;
+    switch_bool_t was_open;
+    char *to;
+    switch_status_t status;
+
+    switch_core_new_memory_pool(&pool);
+
+    switch_mutex_lock(globals.rotated_mutex);
+    shift_rotated_logs(entry, pool);
+
+    to = switch_core_alloc(pool, strlen(entry->path->str) + WARM_FUZZY_OFFSET);
+    sprintf(to, "%.*s.1%s", rotated_base_len(entry), entry->path->str, compress_ext(entry->stream));
+
+    status = switch_file_rename(entry->path->str, to, pool);
+    switch_mutex_unlock(globals.rotated_mutex);
+
+    if (status != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Error renaming %s to %s\n", entry->path->str, to);
+        goto end;
+    }
+
+    if (entry->suffix < __atomic_load_n(&globals.max_rot, __ATOMIC_RELAXED)) {
+        entry->suffix++;
+    }
+
+    /* A closed (evicted) domain stays closed; its next line creates the new file */
+    switch_mutex_lock(entry->file_lock);
+    was_open = entry->sink.ops != NULL;
+    switch_mutex_unlock(entry->file_lock);
+
+    new_sink.ops = NULL;
+    if (was_open && (status = domain_sink_open(&new_sink, entry->path->str)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Failed to open %s after rotation\n", entry->path->str);
+    }
+
+    switch_mutex_lock(entry->file_lock);
+    flush_domain_buffer(entry);
+    old_sink.ops = NULL;
+    if (new_sink.ops) {
+        /* ops goes in last and on its own; the CLOCK hand peeks at it unlocked */
+        old_sink = entry->sink;
+        memcpy(&entry->sink.size, &new_sink.size, sizeof(new_sink) - offsetof(domain_sink_t, size));
+        __atomic_store_n(&entry->sink.ops, new_sink.ops, __ATOMIC_RELAXED);
+        entry->log_size = 0;
+    } else if (!was_open) {
+        entry->log_size = 0;
+    }
+    switch_mutex_unlock(entry->file_lock);
+
+    /* closing the old mmap sink truncates the rotated file to its real length */
+    domain_sink_close(&old_sink);
+
+    if (__atomic_load_n(&globals.compress, __ATOMIC_RELAXED) != COMPRESS_NONE && entry->stream == COMPRESS_NONE) {
+        compress_job_add(jobs, entry->path->str, to);
+    }
+
+  end:
+    switch_mutex_lock(entry->file_lock);
+    if (status != SWITCH_STATUS_SUCCESS) {
+        /* don't retry on every line, wait for another rollover's worth of data */
+        entry->log_size = 0;
+    }
+    __atomic_store_n(&entry->rotate_pending, 0, __ATOMIC_RELEASE);
+    switch_mutex_unlock(entry->file_lock);
+
+    switch_core_destroy_memory_pool(&pool);
+
+    return status;
+}
+
+/* Rotate every domain flagged by check_domain_rollover() or a HUP */
+void rotate_pending_domain_logs(void)
+{
+    domain_cache_entry_t **entries;
+    compress_job_t *jobs = NULL;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        if (__atomic_load_n(&entries[i]->rotate_pending, __ATOMIC_ACQUIRE)) {
+            rotate_domain_log(entries[i], &jobs);
+        }
+    }
+
+    release_domain_entries(entries);
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+    /* io_uring writes to the rotated files must land before they are read */
+    if (jobs) {
+        log_uring_flush();
+    }
+#endif
+    compress_jobs_submit(jobs);
+}
+
+/* Flag every domain for rotation, used for rotate-on-hup */
+void request_rotate_all(void)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        __atomic_store_n(&entries[i]->rotate_pending, 1, __ATOMIC_RELEASE);
+    }
+
+    release_domain_entries(entries);
+
+    __atomic_add_fetch(&globals.rotate_requests, 1, __ATOMIC_RELEASE);
+}
+
+/* Flush and reopen every domain file, e.g. after an external logrotate,
+   or under a new log-dir when relocating */
+void reopen_all_domain_logs(switch_bool_t relocate)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+
+        switch_bool_t was_open;
+
+        switch_mutex_lock(entry->file_lock);
+        flush_domain_buffer(entry);
+        was_open = entry->sink.ops != NULL;
+        domain_sink_close(&entry->sink);
+        if (relocate) {
+            switch_mutex_lock(globals.mutex);
+            build_domain_logfile_path(entry);
+            switch_mutex_unlock(globals.mutex);
+            entry->suffix = -1;
+        }
+        if (was_open) {
+            open_domain_logfile(entry);
+        }
+        switch_mutex_unlock(entry->file_lock);
+    }
+
+    release_domain_entries(entries);
+}
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,1106 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_sink.c -- Output backends, compressed stream frames and the open file budget
+ *
+ */
+
+#include "logfile_domain.h"
+
+/* Close a sink if open */
+void domain_sink_close(domain_sink_t *sink)
+{
+    if (sink->ops) {
+        sink->ops->close(sink);
+        __atomic_store_n(&sink->ops, NULL, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&globals.open_files, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* "file" backend: append through switch_file_t */
+static switch_status_t file_sink_open(domain_sink_t *sink, const char *path)
+{
+    unsigned int flags = SWITCH_FOPEN_CREATE | SWITCH_FOPEN_READ | SWITCH_FOPEN_WRITE | SWITCH_FOPEN_APPEND;
+    switch_status_t stat;
+
+    /* A pool per open, so reopening after eviction or rotation does not grow module_pool */
+    if ((stat = switch_core_new_memory_pool(&sink->pool)) != SWITCH_STATUS_SUCCESS) {
+        return stat;
+    }
+
+    if ((stat = switch_file_open(&sink->file, path, flags, SWITCH_FPROT_OS_DEFAULT, sink->pool)) != SWITCH_STATUS_SUCCESS) {
+        switch_core_destroy_memory_pool(&sink->pool);
+        return stat;
+    }
+
+    sink->size = switch_file_get_size(sink->file);
+
+    /* A second descriptor on the same file for the sync thread; APR does not expose its own */
+#ifdef WIN32
+    sink->fd = -1;
+#else
+    sink->fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+#endif
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t file_sink_write(domain_sink_t *sink, const char *data, switch_size_t len)
+{
+    switch_size_t wlen = len;
+    switch_status_t stat;
+
+    if ((stat = switch_file_write(sink->file, data, &wlen)) == SWITCH_STATUS_SUCCESS) {
+        sink->size += len;
+    }
+
+    return stat;
+}
+
+static void file_sink_close(domain_sink_t *sink)
+{
+    switch_file_close(sink->file);
+    sink->file = NULL;
+    switch_core_destroy_memory_pool(&sink->pool);
+#ifndef WIN32
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+#endif
+    sink->fd = -1;
+}
+
+static const domain_sink_ops_t file_sink_ops = { "file", file_sink_open, file_sink_write, file_sink_close };
+
+#ifndef WIN32
+/* "mmap" backend: the file is preallocated mmap-chunk bytes at a time and lines are copied
+   into a shared mapping of the tail, so appends cost no syscall until a chunk fills. The
+   unused preallocated tail reads as NUL bytes until the file is closed and truncated. */
+static switch_status_t mmap_sink_map(domain_sink_t *sink)
+{
+    switch_size_t page = (switch_size_t)sysconf(_SC_PAGESIZE);
+    switch_size_t off = sink->size - sink->size % page;
+    switch_size_t len = __atomic_load_n(&globals.mmap_chunk, __ATOMIC_RELAXED);
+    void *map;
+
+    if (sink->map) {
+        munmap(sink->map, sink->map_len);
+        sink->map = NULL;
+    }
+
+    /* Reserve the blocks first so a full disk is an error here rather than SIGBUS in memcpy */
+    if (posix_fallocate(sink->fd, (off_t)off, (off_t)len)) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if ((map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd, (off_t)off)) == MAP_FAILED) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    sink->map = (char *)map;
+    sink->map_off = off;
+    sink->map_len = len;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Length of the log data, skipping NUL preallocation left behind if we were not closed cleanly */
+static switch_size_t mmap_sink_data_size(int fd, switch_size_t size)
+{
+    char block[4096];
+
+    while (size) {
+        switch_size_t n = size < sizeof(block) ? size : sizeof(block);
+        ssize_t got = pread(fd, block, n, (off_t)(size - n));
+
+        if (got != (ssize_t)n) {
+            break;
+        }
+        while (n && !block[n - 1]) {
+            n--;
+            size--;
+        }
+        if (n) {
+            break;
+        }
+    }
+
+    return size;
+}
+
+static switch_status_t mmap_sink_open(domain_sink_t *sink, const char *path)
+{
+    struct stat st;
+
+    if ((sink->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (fstat(sink->fd, &st) < 0) {
+        close(sink->fd);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    sink->size = mmap_sink_data_size(sink->fd, (switch_size_t)st.st_size);
+    sink->map = NULL;
+
+    if (mmap_sink_map(sink) != SWITCH_STATUS_SUCCESS) {
+        close(sink->fd);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t mmap_sink_write(domain_sink_t *sink, const char *data, switch_size_t len)
+{
+    while (len) {
+        switch_size_t room = sink->map_off + sink->map_len - sink->size;
+        switch_size_t n;
+
+        if (!room) {
+            if (mmap_sink_map(sink) != SWITCH_STATUS_SUCCESS) {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+
+        n = len < room ? len : room;
+        memcpy(sink->map + (sink->size - sink->map_off), data, n);
+        sink->size += n;
+        data += n;
+        len -= n;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Drop the preallocated tail so the file ends at the last line */
+static void mmap_sink_close(domain_sink_t *sink)
+{
+    if (sink->map) {
+        munmap(sink->map, sink->map_len);
+        sink->map = NULL;
+    }
+    if (ftruncate(sink->fd, (off_t)sink->size)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: Could not truncate mmap file to %" SWITCH_SIZE_T_FMT " bytes\n", sink->size);
+    }
+    close(sink->fd);
+    sink->fd = -1;
+}
+
+static const domain_sink_ops_t mmap_sink_ops = { "mmap", mmap_sink_open, mmap_sink_write, mmap_sink_close };
+#endif
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+/* "io_uring" backend: writer 0 copies flushed buffers into registered staging buffers and
+   submits the whole flush cycle, across every domain, with one io_uring_enter. Files are
+   written at explicit offsets reserved under file_lock, so direct pwrite()s from other
+   threads can run alongside a batch. A closed sink's fd is only released after the batch
+   that may still reference it has completed. */
+
+/* One queued write; the data is in staging buffer i for queued[i] */
+typedef struct {
+    int fd;
+    int slot;
+    off_t off;
+    uint32_t len;
+} uring_write_t;
+
+/* A closed sink whose fd waits for the current batch. Its size covers queued writes the
+   file does not show yet, so a reopen of the same file appends after them. */
+typedef struct {
+    int fd;
+    int slot;
+    dev_t dev;
+    ino_t ino;
+    switch_size_t size;
+} uring_closing_t;
+
+struct log_uring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+    char *staging;
+    switch_size_t staging_size;
+    switch_bool_t fixed_buffers;
+    uring_write_t queued[URING_ENTRIES];
+    uint32_t count;
+    switch_mutex_t *mutex;      /* free_slots and closing */
+    int *free_slots;
+    int free_count;
+    uring_closing_t *closing;
+    int closing_count;
+    int closing_size;
+    uint64_t submits;
+    uint64_t writes;
+};
+
+/* Set on writer 0, the only thread that queues io_uring writes */
+__thread int uring_batching = 0;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned n)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static switch_status_t pwrite_all(int fd, const char *data, switch_size_t len, off_t off)
+{
+    while (len) {
+        ssize_t n = pwrite(fd, data, len, off);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return SWITCH_STATUS_FALSE;
+        }
+        data += n;
+        len -= (switch_size_t)n;
+        off += n;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void log_uring_release_files(log_uring_t *u);
+
+void log_uring_destroy(log_uring_t *u)
+{
+    if (!u) {
+        return;
+    }
+    if (u->mutex) {
+        log_uring_release_files(u);
+    }
+    if (u->sqes) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->cq_ring && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_len);
+    }
+    if (u->sq_ring) {
+        munmap(u->sq_ring, u->sq_ring_len);
+    }
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    if (u->staging) {
+        munmap(u->staging, u->staging_size * URING_ENTRIES);
+    }
+    free(u->free_slots);
+    free(u->closing);
+    free(u);
+}
+
+/* Whether len more bytes can be pinned, keeping half of RLIMIT_MEMLOCK for everyone else */
+static switch_bool_t uring_memlock_fits(switch_size_t len)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) < 0) {
+        return SWITCH_FALSE;
+    }
+
+    return rl.rlim_cur == RLIM_INFINITY || len <= rl.rlim_cur / 2 ? SWITCH_TRUE : SWITCH_FALSE;
+}
+
+/* Ask the kernel whether it knows op; kernels older than the probe itself (5.6) do not */
+static switch_bool_t uring_op_supported(int fd, int op)
+{
+    switch_size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe;
+    switch_bool_t supported = SWITCH_FALSE;
+
+    if (!(probe = (struct io_uring_probe *)calloc(1, len))) {
+        return SWITCH_FALSE;
+    }
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0 && op < probe->ops_len &&
+        (probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        supported = SWITCH_TRUE;
+    }
+    free(probe);
+
+    return supported;
+}
+
+/* Set up the ring with raw syscalls; NULL if the kernel or seccomp policy refuses io_uring */
+log_uring_t *log_uring_create(switch_size_t staging_size)
+{
+    struct io_uring_params p;
+    struct iovec iov[URING_ENTRIES];
+    log_uring_t *u;
+    void *map;
+    int *fds;
+    int i;
+
+    if (!(u = (log_uring_t *)calloc(1, sizeof(*u)))) {
+        return NULL;
+    }
+
+    memset(&p, 0, sizeof(p));
+    if ((u->fd = uring_setup(URING_ENTRIES, &p)) < 0 || p.sq_entries < URING_ENTRIES) {
+        goto fail;
+    }
+
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && u->cq_ring_len > u->sq_ring_len) {
+        u->sq_ring_len = u->cq_ring_len;
+    }
+
+    if ((map = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+        goto fail;
+    }
+    u->sq_ring = map;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else if ((map = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        goto fail;
+    } else {
+        u->cq_ring = map;
+    }
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if ((map = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+        goto fail;
+    }
+    u->sqes = (struct io_uring_sqe *)map;
+
+    u->sq_tail = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+
+    u->staging_size = staging_size;
+    if ((map = mmap(NULL, staging_size * URING_ENTRIES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        goto fail;
+    }
+    u->staging = (char *)map;
+
+    /* Registered buffers are pinned once instead of on every write, but they count
+       against RLIMIT_MEMLOCK; past half of it plain IORING_OP_WRITE batches instead */
+    if (uring_memlock_fits(staging_size * URING_ENTRIES)) {
+        for (i = 0; i < URING_ENTRIES; i++) {
+            iov[i].iov_base = u->staging + (switch_size_t)i * staging_size;
+            iov[i].iov_len = staging_size;
+        }
+        if (uring_register(u->fd, IORING_REGISTER_BUFFERS, iov, URING_ENTRIES) == 0) {
+            u->fixed_buffers = SWITCH_TRUE;
+        }
+    }
+    if (!u->fixed_buffers && !uring_op_supported(u->fd, IORING_OP_WRITE)) {
+        goto fail;
+    }
+
+    /* A sparse file table, filled in as domains open their files */
+    u->free_slots = (int *)malloc(sizeof(int) * URING_FILE_SLOTS);
+    fds = (int *)malloc(sizeof(int) * URING_FILE_SLOTS);
+    if (!u->free_slots || !fds) {
+        free(fds);
+        goto fail;
+    }
+    for (i = 0; i < URING_FILE_SLOTS; i++) {
+        fds[i] = -1;
+        u->free_slots[i] = URING_FILE_SLOTS - 1 - i;
+    }
+    if (uring_register(u->fd, IORING_REGISTER_FILES, fds, URING_FILE_SLOTS) == 0) {
+        u->free_count = URING_FILE_SLOTS;
+    }
+    free(fds);
+
+    switch_mutex_init(&u->mutex, SWITCH_MUTEX_NESTED, module_pool);
+
+    return u;
+
+  fail:
+    log_uring_destroy(u);
+    return NULL;
+}
+
+/* Finish a write the kernel refused or cut short */
+static void log_uring_write_rest(log_uring_t *u, uint32_t i, uint32_t done)
+{
+    uring_write_t *w = &u->queued[i];
+
+    if (pwrite_all(w->fd, u->staging + (switch_size_t)i * u->staging_size + done, w->len - done, w->off + done) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Lost %u bytes of log data: %s\n", w->len - done, strerror(errno));
+    }
+}
+
+/* Submit everything queued with one io_uring_enter and wait for all of it */
+static void log_uring_submit(log_uring_t *u)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned mask = *u->sq_mask;
+    int submitted = -1, done = 0;
+    uint32_t i;
+
+    if (!u->count) {
+        return;
+    }
+
+    for (i = 0; i < u->count; i++) {
+        uring_write_t *w = &u->queued[i];
+        unsigned idx = (tail + i) & mask;
+        struct io_uring_sqe *sqe = &u->sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        if (u->fixed_buffers) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->buf_index = (uint16_t)i;
+        } else {
+            sqe->opcode = IORING_OP_WRITE;
+        }
+        if (w->slot >= 0) {
+            sqe->fd = w->slot;
+            sqe->flags = IOSQE_FIXED_FILE;
+        } else {
+            sqe->fd = w->fd;
+        }
+        sqe->addr = (uint64_t)(uintptr_t)(u->staging + (switch_size_t)i * u->staging_size);
+        sqe->len = w->len;
+        sqe->off = (uint64_t)w->off;
+        sqe->user_data = i;
+        u->sq_array[idx] = idx;
+    }
+    __atomic_store_n(u->sq_tail, tail + u->count, __ATOMIC_RELEASE);
+
+    while (submitted < 0) {
+        if ((submitted = uring_enter(u->fd, u->count, u->count, IORING_ENTER_GETEVENTS)) < 0 && errno != EINTR && errno != EAGAIN) {
+            submitted = 0;
+        }
+    }
+
+    /* Take back what the kernel did not consume; it is written directly below */
+    if ((uint32_t)submitted < u->count) {
+        __atomic_store_n(u->sq_tail, tail + (unsigned)submitted, __ATOMIC_RELEASE);
+    }
+
+    while (done < submitted) {
+        unsigned head = *u->cq_head;
+        struct io_uring_cqe *cqe;
+
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+            uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        cqe = &u->cqes[head & *u->cq_mask];
+        if (cqe->res != (int)u->queued[cqe->user_data].len) {
+            log_uring_write_rest(u, (uint32_t)cqe->user_data, cqe->res > 0 ? (uint32_t)cqe->res : 0);
+        }
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        done++;
+    }
+
+    for (i = (uint32_t)submitted; i < u->count; i++) {
+        log_uring_write_rest(u, i, 0);
+    }
+
+    u->submits++;
+    u->writes += u->count;
+    u->count = 0;
+}
+
+/* Close the fds of sinks closed since the last batch; nothing queued can refer to them now */
+static void log_uring_release_files(log_uring_t *u)
+{
+    int i;
+
+    switch_mutex_lock(u->mutex);
+    for (i = 0; i < u->closing_count; i++) {
+        int none = -1;
+        struct io_uring_files_update up;
+
+        if (u->closing[i].slot >= 0) {
+            memset(&up, 0, sizeof(up));
+            up.offset = (uint32_t)u->closing[i].slot;
+            up.fds = (uint64_t)(uintptr_t)&none;
+            uring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &up, 1);
+            u->free_slots[u->free_count++] = u->closing[i].slot;
+        }
+        close(u->closing[i].fd);
+    }
+    u->closing_count = 0;
+    switch_mutex_unlock(u->mutex);
+}
+
+/* End of a writer 0 batch */
+void log_uring_flush(void)
+{
+    log_uring_t *u = __atomic_load_n(&globals.uring, __ATOMIC_ACQUIRE);
+
+    if (u) {
+        log_uring_submit(u);
+        if (__atomic_load_n(&u->closing_count, __ATOMIC_RELAXED)) {
+            log_uring_release_files(u);
+        }
+    }
+}
+
+/* io_uring lines for logfile_domain stats */
+void log_uring_report(switch_stream_handle_t *stream)
+{
+    if (globals.uring) {
+        stream->write_function(stream, "uring-submits: %" PRIu64 "\nuring-writes: %" PRIu64 "\n",
+                               __atomic_load_n(&globals.uring->submits, __ATOMIC_RELAXED),
+                               __atomic_load_n(&globals.uring->writes, __ATOMIC_RELAXED));
+    }
+}
+
+static switch_status_t uring_sink_open(domain_sink_t *sink, const char *path)
+{
+    log_uring_t *u = globals.uring;
+    struct stat st;
+    int i;
+
+    if ((sink->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    sink->slot = -1;
+
+    /* fstat under the mutex: a batch is either still holding the old fd, and its end is in
+       closing, or it has completed and the file size already includes it */
+    switch_mutex_lock(u->mutex);
+    if (fstat(sink->fd, &st) < 0) {
+        switch_mutex_unlock(u->mutex);
+        close(sink->fd);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    sink->size = (switch_size_t)st.st_size;
+    for (i = 0; i < u->closing_count; i++) {
+        if (u->closing[i].dev == st.st_dev && u->closing[i].ino == st.st_ino && u->closing[i].size > sink->size) {
+            sink->size = u->closing[i].size;
+        }
+    }
+
+    if (u->free_count) {
+        struct io_uring_files_update up;
+
+        memset(&up, 0, sizeof(up));
+        up.offset = (uint32_t)u->free_slots[u->free_count - 1];
+        up.fds = (uint64_t)(uintptr_t)&sink->fd;
+        if (uring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &up, 1) == 1) {
+            sink->slot = u->free_slots[--u->free_count];
+        }
+    }
+    switch_mutex_unlock(u->mutex);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Queued on writer 0, written in place everywhere else */
+static switch_status_t uring_sink_write(domain_sink_t *sink, const char *data, switch_size_t len)
+{
+    log_uring_t *u = globals.uring;
+
+    if (uring_batching && len <= u->staging_size) {
+        uring_write_t *w;
+
+        if (u->count == URING_ENTRIES) {
+            log_uring_submit(u);
+        }
+
+        w = &u->queued[u->count];
+        memcpy(u->staging + (switch_size_t)u->count * u->staging_size, data, len);
+        w->fd = sink->fd;
+        w->slot = sink->slot;
+        w->off = (off_t)sink->size;
+        w->len = (uint32_t)len;
+        u->count++;
+        sink->size += len;
+
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (pwrite_all(sink->fd, data, len, (off_t)sink->size) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+    sink->size += len;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Hand the fd to writer 0; a queued write may still point at it */
+static void uring_sink_close(domain_sink_t *sink)
+{
+    log_uring_t *u = globals.uring;
+    struct stat st;
+
+    switch_mutex_lock(u->mutex);
+    if (u->closing_count == u->closing_size) {
+        int size = u->closing_size ? u->closing_size * 2 : 32;
+        uring_closing_t *closing = (uring_closing_t *)realloc(u->closing, sizeof(*closing) * size);
+
+        if (closing) {
+            u->closing = closing;
+            u->closing_size = size;
+        }
+    }
+    if (u->closing_count < u->closing_size) {
+        uring_closing_t *c = &u->closing[u->closing_count++];
+
+        memset(&st, 0, sizeof(st));
+        fstat(sink->fd, &st);
+        c->fd = sink->fd;
+        c->slot = sink->slot;
+        c->dev = st.st_dev;
+        c->ino = st.st_ino;
+        c->size = sink->size;
+    } else {
+        /* Leaking the fd is safer than closing it under a pending write */
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mod_logfile_domain: Out of memory releasing io_uring file\n");
+    }
+    switch_mutex_unlock(u->mutex);
+
+    sink->fd = -1;
+    sink->slot = -1;
+}
+
+static const domain_sink_ops_t uring_sink_ops = { "io_uring", uring_sink_open, uring_sink_write, uring_sink_close };
+#endif
+
+/* Backend for an output= value, NULL if unknown or unavailable on this platform */
+const domain_sink_ops_t *domain_sink_ops_find(const char *name)
+{
+    if (!strcasecmp(name, "file")) {
+        return &file_sink_ops;
+    }
+#ifndef WIN32
+    if (!strcasecmp(name, "mmap")) {
+        return &mmap_sink_ops;
+    }
+#endif
+#ifdef LOGFILE_DOMAIN_IO_URING
+    if (!strcasecmp(name, "io_uring")) {
+        return &uring_sink_ops;
+    }
+#endif
+
+    return NULL;
+}
+
+/* Open path with the configured backend */
+switch_status_t domain_sink_open(domain_sink_t *sink, const char *path)
+{
+    const domain_sink_ops_t *ops = __atomic_load_n(&globals.sink_ops, __ATOMIC_RELAXED);
+    switch_status_t stat;
+
+    /* ops stays NULL until the open succeeds; the CLOCK hand peeks at it unlocked */
+    memset(&sink->size, 0, sizeof(*sink) - offsetof(domain_sink_t, size));
+
+    if ((stat = ops->open(sink, path)) == SWITCH_STATUS_SUCCESS) {
+        __atomic_store_n(&sink->ops, ops, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&globals.open_files, 1, __ATOMIC_RELAXED);
+    }
+
+    return stat;
+}
+
+
+/* Rotated generations are plain or, once a compress thread is done with them, compressed */
+const char *const rotated_log_exts[3] = { "", ".gz", ".zst" };
+
+const char *compress_ext(compress_t method)
+{
+    return method == COMPRESS_ZSTD ? ".zst" : method == COMPRESS_GZIP ? ".gz" : "";
+}
+
+/* Live file compression (compress-active): every write, normally one flushed buffer, becomes
+   an independent frame, so the file decompresses as a whole while a crash costs at most the
+   frame being written. Each frame starts with its own size for stream_recover():
+   - gzip: a member whose FEXTRA field holds subfield "LD" with the member size
+   - zstd: a skippable frame holding the size of the zstd frame after it */
+#define STREAM_GZIP_HEADER 20
+#define STREAM_GZIP_TRAILER 8
+#define STREAM_ZSTD_SKIPPABLE 0x184D2A5EU
+#define STREAM_ZSTD_HEADER 12
+#define STREAM_HEADER_MAX 20
+
+static inline void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Compress len bytes into one frame; returns a malloc'ed frame and its length in out_len */
+static char *stream_frame(compress_t method, int level, const char *data, switch_size_t len, switch_size_t *out_len)
+{
+    unsigned char *frame = NULL;
+
+#ifdef LOGFILE_DOMAIN_ZSTD
+    if (method == COMPRESS_ZSTD) {
+        size_t cap = ZSTD_compressBound(len), n;
+
+        if (!(frame = (unsigned char *)malloc(STREAM_ZSTD_HEADER + cap))) {
+            return NULL;
+        }
+        n = ZSTD_compress(frame + STREAM_ZSTD_HEADER, cap, data, len, level ? level : ZSTD_CLEVEL_DEFAULT);
+        if (ZSTD_isError(n)) {
+            free(frame);
+            return NULL;
+        }
+        put_le32(frame, STREAM_ZSTD_SKIPPABLE);
+        put_le32(frame + 4, 4);
+        put_le32(frame + 8, (uint32_t)n);
+        *out_len = STREAM_ZSTD_HEADER + n;
+        return (char *)frame;
+    }
+#else
+    (void)method;
+#endif
+
+    {
+        z_stream zs;
+        uLong cap;
+        switch_size_t size;
+
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, level ? (level > 9 ? 9 : level) : Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return NULL;
+        }
+        cap = deflateBound(&zs, (uLong)len);
+        if (!(frame = (unsigned char *)malloc(STREAM_GZIP_HEADER + cap + STREAM_GZIP_TRAILER))) {
+            deflateEnd(&zs);
+            return NULL;
+        }
+        zs.next_in = (Bytef *)data;
+        zs.avail_in = (uInt)len;
+        zs.next_out = frame + STREAM_GZIP_HEADER;
+        zs.avail_out = (uInt)cap;
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+            deflateEnd(&zs);
+            free(frame);
+            return NULL;
+        }
+        size = STREAM_GZIP_HEADER + zs.total_out + STREAM_GZIP_TRAILER;
+        deflateEnd(&zs);
+
+        memset(frame, 0, STREAM_GZIP_HEADER);
+        frame[0] = 0x1f;
+        frame[1] = 0x8b;
+        frame[2] = 8;                /* deflate */
+        frame[3] = 4;                /* FEXTRA */
+        frame[9] = 255;              /* OS unknown */
+        frame[10] = 8;               /* XLEN */
+        frame[12] = 'L';
+        frame[13] = 'D';
+        frame[14] = 4;
+        put_le32(frame + 16, (uint32_t)size);
+        put_le32(frame + size - 8, (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef *)data, (uInt)len));
+        put_le32(frame + size - 4, (uint32_t)len);
+        *out_len = size;
+    }
+
+    return (char *)frame;
+}
+
+/* Size of the frame whose first n bytes are in h, 0 if it is not a frame of ours */
+static uint32_t stream_frame_size(compress_t method, const unsigned char *h, ssize_t n)
+{
+    if (method == COMPRESS_ZSTD) {
+        if (n >= STREAM_ZSTD_HEADER && get_le32(h) == STREAM_ZSTD_SKIPPABLE && get_le32(h + 4) == 4) {
+            return STREAM_ZSTD_HEADER + get_le32(h + 8);
+        }
+    } else if (n >= STREAM_GZIP_HEADER && h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && h[3] == 4 &&
+               h[10] == 8 && h[11] == 0 && h[12] == 'L' && h[13] == 'D' && h[14] == 4 && h[15] == 0 &&
+               get_le32(h + 16) >= STREAM_GZIP_HEADER + STREAM_GZIP_TRAILER) {
+        return get_le32(h + 16);
+    }
+
+    return 0;
+}
+
+/* A crash can leave a torn frame at the end of a compressed live file, and a decompressor
+   stops there, so cut the file back to its last whole frame before appending to it */
+static void stream_recover(const char *path, compress_t method)
+{
+    unsigned char h[STREAM_HEADER_MAX];
+    struct stat st;
+    off_t off = 0;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        return;
+    }
+
+    if (!fstat(fd, &st)) {
+        while (off < st.st_size) {
+            uint32_t size = stream_frame_size(method, h, pread(fd, h, sizeof(h), off));
+
+            if (!size || off + (off_t)size > st.st_size) {
+                break;
+            }
+            off += size;
+        }
+
+        if (off < st.st_size) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                            "mod_logfile_domain: Dropping %" PRId64 " bytes of an incomplete frame at the end of %s\n",
+                            (int64_t)(st.st_size - off), path);
+            if (ftruncate(fd, off)) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                                "mod_logfile_domain: Can't truncate %s: %s\n", path, strerror(errno));
+            }
+        }
+    }
+
+    close(fd);
+}
+
+static switch_bool_t evict_domain_handle(domain_cache_entry_t *self);
+
+/* Open/create log file for domain */
+switch_status_t open_domain_logfile(domain_cache_entry_t *entry)
+{
+    switch_status_t stat;
+
+    /* Stay within max-open-files by closing a handle nobody has used lately; if every
+       candidate is busy the budget is briefly exceeded rather than dropping the line */
+    while (__atomic_load_n(&globals.open_files, __ATOMIC_RELAXED) >= __atomic_load_n(&globals.max_open_files, __ATOMIC_RELAXED) && evict_domain_handle(entry));
+
+    /* once per path: later reopens follow a clean close */
+    if (entry->stream != COMPRESS_NONE && !entry->stream_checked) {
+        stream_recover(entry->path->str, entry->stream);
+        entry->stream_checked = 1;
+    }
+
+    stat = domain_sink_open(&entry->sink, entry->path->str);
+
+    if (stat != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, 
+                        "mod_logfile_domain: Failed to open %s (status=%d)\n", 
+                        entry->path->str, stat);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    __atomic_add_fetch(&entry->stats.opens, 1, __ATOMIC_RELAXED);
+
+    entry->log_size = entry->sink.size + entry->buf_len;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Build the file path from log-dir (globals.mutex held) */
+void build_domain_logfile_path(domain_cache_entry_t *entry)
+{
+    char path[DOMAIN_PATH_MAX];
+    switch_size_t len;
+
+    entry->stream = globals.compress_active;
+    entry->stream_checked = 0;
+    len = switch_snprintf(path, sizeof(path), "%s%sdomain_%s.log%s",
+                          globals.log_dir, SWITCH_PATH_SEPARATOR, entry->domain->str, compress_ext(entry->stream));
+    __atomic_store_n(&entry->path, domain_str_new(entry->pool, path, len), __ATOMIC_RELEASE);
+}
+
+/* Write a block to the domain file, reopening once on failure (file_lock held) */
+switch_status_t domain_file_write(domain_cache_entry_t *entry, const char *data, switch_size_t len)
+{
+    durability_t durability = __atomic_load_n(&globals.durability, __ATOMIC_RELAXED);
+    char *frame = NULL;
+    switch_size_t raw = len;
+    switch_time_t start;
+
+    if (entry->stream != COMPRESS_NONE) {
+        if (!(frame = stream_frame(entry->stream, __atomic_load_n(&globals.compress_level, __ATOMIC_RELAXED), data, raw, &len))) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                            "mod_logfile_domain: Can't compress %" SWITCH_SIZE_T_FMT " bytes for %s\n", raw, entry->path->str);
+            return SWITCH_STATUS_FALSE;
+        }
+        data = frame;
+        __atomic_add_fetch(&globals.stream_frames, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&globals.stream_bytes_in, raw, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&globals.stream_bytes_out, len, __ATOMIC_RELAXED);
+    }
+
+    start = switch_micro_time_now();
+    if (!entry->sink.ops || entry->sink.ops->write(&entry->sink, data, len) != SWITCH_STATUS_SUCCESS) {
+        domain_sink_close(&entry->sink);
+
+        /* Try to reopen and write */
+        if (open_domain_logfile(entry) != SWITCH_STATUS_SUCCESS ||
+            entry->sink.ops->write(&entry->sink, data, len) != SWITCH_STATUS_SUCCESS) {
+            __atomic_add_fetch(&entry->stats.write_errors, 1, __ATOMIC_RELAXED);
+            free(frame);
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+    __atomic_add_fetch(&entry->stats.write_hist[latency_bucket(switch_micro_time_now() - start, WRITE_HISTOGRAM_BUCKETS)], 1, __ATOMIC_RELAXED);
+
+    if (frame) {
+        /* rollover counts bytes on disk; the caller counted the uncompressed lines */
+        entry->log_size = entry->log_size + len - raw;
+        free(frame);
+    }
+
+    if (durability != DURABILITY_NONE) {
+        entry->unsynced += len;
+        if (durability == DURABILITY_BYTES && entry->unsynced >= __atomic_load_n(&globals.sync_bytes, __ATOMIC_RELAXED) && !entry->sync_pending) {
+            entry->sync_pending = 1;
+            log_sync_wake();
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Flush and close a domain's file and release its buffer; the next line reopens it (file_lock held) */
+void close_domain_handle(domain_cache_entry_t *entry)
+{
+    flush_domain_buffer(entry);
+    if (__atomic_load_n(&globals.durability, __ATOMIC_RELAXED) != DURABILITY_NONE && entry->unsynced && entry->sink.ops && entry->sink.fd >= 0) {
+        log_sync_closing(entry->sink.fd, __atomic_load_n(&entry->path, __ATOMIC_ACQUIRE)->str);
+        entry->unsynced = 0;
+    }
+    domain_sink_close(&entry->sink);
+    free(entry->buf);
+    entry->buf = NULL;
+    entry->buf_cap = 0;
+}
+
+/* CLOCK over the domain table: a domain written since the hand last passed gets a second
+   chance, the first open one that was not is closed. Other domains are only trylocked, so
+   this is safe with self's file_lock or globals.mutex held. Domains waiting for rotation
+   are skipped, the rotation is about to replace their handle. */
+static switch_bool_t evict_domain_handle(domain_cache_entry_t *self)
+{
+    domain_table_t *table;
+    switch_bool_t evicted = SWITCH_FALSE;
+    uint32_t scanned;
+
+    switch_mutex_lock(globals.clock_mutex);
+    table = __atomic_load_n(&globals.domain_table, __ATOMIC_ACQUIRE);
+
+    for (scanned = 0; scanned < table->size * 2 && !evicted; scanned++) {
+        domain_cache_entry_t *entry = __atomic_load_n(&table->slots[globals.clock_hand++ & (table->size - 1)], __ATOMIC_ACQUIRE);
+
+        if (!entry || entry == DOMAIN_TOMBSTONE || entry == self || !__atomic_load_n(&entry->sink.ops, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&entry->rotate_pending, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (__atomic_exchange_n(&entry->referenced, 0, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (switch_mutex_trylock(entry->file_lock) != SWITCH_STATUS_SUCCESS) {
+            continue;
+        }
+        if (entry->sink.ops && !entry->rotate_pending) {
+            close_domain_handle(entry);
+            evicted = SWITCH_TRUE;
+        }
+        switch_mutex_unlock(entry->file_lock);
+    }
+
+    switch_mutex_unlock(globals.clock_mutex);
+
+    if (evicted) {
+        __atomic_add_fetch(&globals.evictions, 1, __ATOMIC_RELAXED);
+    }
+
+    return evicted;
+}
+
+/* Close files that have not had a line for idle-timeout seconds */
+void close_idle_domain_handles(switch_time_t now)
+{
+    domain_cache_entry_t **entries;
+    switch_time_t idle = (switch_time_t)__atomic_load_n(&globals.idle_timeout, __ATOMIC_RELAXED) * 1000000;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+
+        if (!__atomic_load_n(&entry->sink.ops, __ATOMIC_RELAXED) ||
+            now - __atomic_load_n(&entry->last_used, __ATOMIC_RELAXED) < idle) {
+            continue;
+        }
+
+        switch_mutex_lock(entry->file_lock);
+        if (entry->sink.ops && now - entry->last_used >= idle) {
+            close_domain_handle(entry);
+            __atomic_add_fetch(&globals.idle_closes, 1, __ATOMIC_RELAXED);
+        }
+        switch_mutex_unlock(entry->file_lock);
+    }
+
+    release_domain_entries(entries);
+}
+
+/* Close all domain log files */
+void close_all_domain_logs(void)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    /* No globals.mutex here: reopen takes it under file_lock, so holding it would invert that order */
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+
+        if (entry->file_lock) {
+            switch_mutex_lock(entry->file_lock);
+            close_domain_handle(entry);
+            switch_mutex_unlock(entry->file_lock);
+        }
+    }
+
+    release_domain_entries(entries);
+}
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,646 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_table.c -- Domain table, entry slabs and the session UUID cache
+ *
+ */
+
+#include "logfile_domain.h"
+
+/* Cleanup domain cache entry; its pool takes file_lock with it */
+void cleanup_domain_entry(void *ptr)
+{
+    domain_cache_entry_t *entry = (domain_cache_entry_t *)ptr;
+    if (entry) {
+        domain_sink_close(&entry->sink);
+        free(entry->buf);
+        entry->buf = NULL;
+        entry->file_lock = NULL;
+        if (entry->pool) {
+            switch_core_destroy_memory_pool(&entry->pool);
+        }
+    }
+}
+
+/* Copy len bytes into a NUL-terminated, length-prefixed string in pool */
+domain_str_t *domain_str_new(switch_memory_pool_t *pool, const char *str, switch_size_t len)
+{
+    domain_str_t *s = (domain_str_t *)switch_core_alloc(pool, sizeof(*s) + len + 1);
+
+    memcpy(s->str, str, len);
+    s->str[len] = '\0';
+    s->len = len;
+
+    return s;
+}
+
+/* FNV-1a, cached in the entry so probes rarely need a strcmp */
+uint32_t domain_hash_func(const char *domain, switch_size_t len)
+{
+    uint32_t h = 2166136261U;
+    switch_size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)domain[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+domain_table_t *domain_table_create(uint32_t size)
+{
+    domain_table_t *table;
+
+    switch_zmalloc(table, sizeof(*table));
+    switch_zmalloc(table->slots, sizeof(domain_cache_entry_t *) * size);
+    table->size = size;
+
+    return table;
+}
+
+/* Lock-free probe, safe against concurrent inserts and resizes. The entry is held before
+   its name is read, since an old table can still point at one that has been reused; the
+   caller releases it with domain_entry_release(). */
+domain_cache_entry_t *domain_table_find(const domain_table_t *table, const char *domain, switch_size_t len, uint32_t hash)
+{
+    uint32_t mask = table->size - 1;
+    uint32_t i;
+
+    for (i = hash & mask;; i = (i + 1) & mask) {
+        domain_cache_entry_t *entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+
+        if (!entry) {
+            return NULL;
+        }
+        if (entry == DOMAIN_TOMBSTONE || __atomic_load_n(&entry->hash, __ATOMIC_RELAXED) != hash ||
+            !domain_entry_hold(entry)) {
+            continue;
+        }
+        if (entry->hash == hash && entry->domain->len == len && !memcmp(entry->domain->str, domain, len)) {
+            return entry;
+        }
+        domain_entry_release(entry);
+    }
+}
+
+/* First free slot on the entry's probe path; a tombstone may be reused, as the caller
+   has already checked that the domain is not further along */
+static void domain_table_place(domain_table_t *table, domain_cache_entry_t *entry)
+{
+    uint32_t mask = table->size - 1;
+    uint32_t i;
+
+    for (i = entry->hash & mask; table->slots[i] && table->slots[i] != DOMAIN_TOMBSTONE; i = (i + 1) & mask);
+
+    if (table->slots[i]) {
+        table->tombstones--;
+    } else {
+        table->count++;
+    }
+    __atomic_store_n(&table->slots[i], entry, __ATOMIC_RELEASE);
+}
+
+/* Insert a new entry (globals.mutex held). Once the table is half full it is rebuilt
+   without tombstones, at double the size only if the live entries need it. */
+static void domain_table_insert(domain_cache_entry_t *entry)
+{
+    domain_table_t *table = globals.domain_table;
+
+    if ((table->count + 1) * 2 > table->size) {
+        uint32_t live = table->count - table->tombstones;
+        domain_table_t *grown = domain_table_create((live + 1) * 4 > table->size ? table->size * 2 : table->size);
+        uint32_t i;
+
+        for (i = 0; i < table->size; i++) {
+            if (table->slots[i] && table->slots[i] != DOMAIN_TOMBSTONE) {
+                domain_table_place(grown, table->slots[i]);
+            }
+        }
+
+        table->retired_at = switch_micro_time_now();
+        grown->retired = table;
+        __atomic_store_n(&globals.domain_table, grown, __ATOMIC_RELEASE);
+        table = grown;
+    }
+
+    domain_table_place(table, entry);
+}
+
+/* Unlink an entry from the current table (globals.mutex held) */
+static void domain_table_remove(domain_cache_entry_t *entry)
+{
+    domain_table_t *table = globals.domain_table;
+    uint32_t mask = table->size - 1;
+    uint32_t i;
+
+    for (i = entry->hash & mask; table->slots[i]; i = (i + 1) & mask) {
+        if (table->slots[i] == entry) {
+            __atomic_store_n(&table->slots[i], DOMAIN_TOMBSTONE, __ATOMIC_RELEASE);
+            table->tombstones++;
+            return;
+        }
+    }
+}
+
+/* Free the current table and every retired one (module unload only) */
+void domain_table_destroy(void)
+{
+    domain_table_t *table = globals.domain_table;
+
+    globals.domain_table = NULL;
+
+    while (table) {
+        domain_table_t *next = table->retired;
+        free(table->slots);
+        free(table);
+        table = next;
+    }
+}
+
+/* Return retired entries and tables nobody can still see to the free list (globals.mutex
+   held). Entries go once refs drops to zero and ENTRY_DEAD can be set in its place, which
+   turns away any later domain_entry_hold(); the background threads' entry snapshots are
+   covered by globals.snapshots and the CLOCK hand by clock_mutex. Tables have no refs and
+   wait RECLAIM_GRACE for lock-free probes. */
+static void domain_entry_reclaim(switch_time_t now)
+{
+    domain_cache_entry_t **prev = &globals.entry_retired;
+    domain_table_t *table;
+
+    if (__atomic_load_n(&globals.snapshots, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    /* A CLOCK pass that read an entry from the table before it was unlinked is over once
+       clock_mutex has been free */
+    switch_mutex_lock(globals.clock_mutex);
+    switch_mutex_unlock(globals.clock_mutex);
+
+    while (*prev) {
+        domain_cache_entry_t *entry = *prev;
+        uint32_t unused = 0;
+
+        if (!__atomic_compare_exchange_n(&entry->refs, &unused, ENTRY_DEAD, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            prev = &entry->next;
+            continue;
+        }
+
+        *prev = entry->next;
+        globals.entries_retired--;
+
+        /* a line that raced the retirement may have reopened the file */
+        switch_mutex_lock(entry->file_lock);
+        close_domain_handle(entry);
+        switch_mutex_unlock(entry->file_lock);
+        cleanup_domain_entry(entry);
+
+        entry->next = globals.entry_free;
+        globals.entry_free = entry;
+        globals.entries_free++;
+        globals.entries_reclaimed++;
+    }
+
+    /* Retired tables are newest first, so everything past the first expired one has expired too */
+    switch_mutex_lock(globals.clock_mutex);
+    for (table = globals.domain_table; table->retired; table = table->retired) {
+        if (now - table->retired->retired_at >= RECLAIM_GRACE) {
+            domain_table_t *old = table->retired;
+
+            table->retired = NULL;
+            while (old) {
+                domain_table_t *next = old->retired;
+
+                free(old->slots);
+                free(old);
+                old = next;
+            }
+            break;
+        }
+    }
+    switch_mutex_unlock(globals.clock_mutex);
+}
+
+/* A zeroed, cache-line-aligned entry from the free list, carving a new slab when it is
+   empty (globals.mutex held) */
+domain_cache_entry_t *domain_entry_alloc(void)
+{
+    domain_cache_entry_t *entry;
+
+    if (!globals.entry_free) {
+        switch_size_t stride = (sizeof(domain_cache_entry_t) + ENTRY_ALIGN - 1) & ~(switch_size_t)(ENTRY_ALIGN - 1);
+        entry_slab_t *slab;
+        uintptr_t base;
+        int i;
+
+        if (!(slab = (entry_slab_t *)malloc(sizeof(*slab) + ENTRY_ALIGN + stride * ENTRY_SLAB_ENTRIES))) {
+            return NULL;
+        }
+        slab->next = globals.entry_slabs;
+        globals.entry_slabs = slab;
+        globals.entry_slab_count++;
+
+        base = ((uintptr_t)(slab + 1) + ENTRY_ALIGN - 1) & ~(uintptr_t)(ENTRY_ALIGN - 1);
+        for (i = ENTRY_SLAB_ENTRIES - 1; i >= 0; i--) {
+            entry = (domain_cache_entry_t *)(base + stride * i);
+            entry->hash = 0;
+            entry->refs = ENTRY_DEAD;
+            entry->next = globals.entry_free;
+            globals.entry_free = entry;
+        }
+        globals.entries_free += ENTRY_SLAB_ENTRIES;
+    }
+
+    entry = globals.entry_free;
+    globals.entry_free = entry->next;
+    globals.entries_free--;
+
+    /* A stale lock-free reader may still touch hash and refs, which stays ENTRY_DEAD until
+       get_domain_entry() publishes the entry */
+    memset((char *)entry + offsetof(domain_cache_entry_t, domain), 0,
+           sizeof(*entry) - offsetof(domain_cache_entry_t, domain));
+    __atomic_store_n(&entry->hash, 0, __ATOMIC_RELAXED);
+
+    return entry;
+}
+
+/* Put an entry that never made it into the table straight back (globals.mutex held) */
+void domain_entry_free(domain_cache_entry_t *entry)
+{
+    cleanup_domain_entry(entry);
+    entry->next = globals.entry_free;
+    globals.entry_free = entry;
+    globals.entries_free++;
+}
+
+static void uuid_cache_forget_entry(domain_cache_entry_t *entry);
+
+/* At max-domains: close and unlink a domain that the CLOCK hand finds unused since its last
+   pass and that has no lines queued (globals.mutex held). Its memory is reused once
+   domain_entry_reclaim() allows. */
+static switch_bool_t retire_domain_entry(void)
+{
+    domain_table_t *table = globals.domain_table;
+    uint32_t scanned;
+
+    for (scanned = 0; scanned < table->size * 2; scanned++) {
+        domain_cache_entry_t *entry = table->slots[globals.retire_hand++ & (table->size - 1)];
+        switch_bool_t idle;
+
+        if (!entry || entry == DOMAIN_TOMBSTONE || __atomic_load_n(&entry->refs, __ATOMIC_ACQUIRE) ||
+            __atomic_load_n(&entry->rotate_pending, __ATOMIC_ACQUIRE) ||
+            __atomic_load_n(&entry->migrating, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (__atomic_exchange_n(&entry->referenced, 0, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (switch_mutex_trylock(entry->file_lock) != SWITCH_STATUS_SUCCESS) {
+            continue;
+        }
+        if ((idle = !entry->rotate_pending)) {
+            if (entry->sink.ops || entry->buf_len) {
+                close_domain_handle(entry);
+            }
+            __atomic_store_n(&entry->retired, 1, __ATOMIC_RELEASE);
+        }
+        switch_mutex_unlock(entry->file_lock);
+
+        if (idle) {
+            domain_table_remove(entry);
+            uuid_cache_forget_entry(entry);
+            entry->next = globals.entry_retired;
+            globals.entry_retired = entry;
+            globals.entries_retired++;
+            globals.cache_entries--;
+            return SWITCH_TRUE;
+        }
+    }
+
+    return SWITCH_FALSE;
+}
+
+/* Get or create cache entry for a domain given as (pointer, length), which need not be
+   NUL-terminated; only creation takes globals.mutex. The entry comes held, the caller
+   passes the reference on with a line or drops it with domain_entry_release(). */
+domain_cache_entry_t *get_domain_entry(const char *domain, switch_size_t len)
+{
+    domain_cache_entry_t *entry = NULL;
+    switch_time_t now;
+    uint32_t hash;
+
+    if (!domain || !len || len >= DOMAIN_NAME_MAX) {
+        return NULL;
+    }
+
+    hash = domain_hash_func(domain, len);
+
+    /* Check if domain already in cache; a retired one is only still in an old table */
+    entry = domain_table_find(__atomic_load_n(&globals.domain_table, __ATOMIC_ACQUIRE), domain, len, hash);
+
+    if (entry) {
+        if (!__atomic_load_n(&entry->retired, __ATOMIC_ACQUIRE)) {
+            return entry;
+        }
+        domain_entry_release(entry);
+    }
+
+    switch_mutex_lock(globals.mutex);
+
+    /* Another thread may have created it while we waited for the lock */
+    entry = domain_table_find(globals.domain_table, domain, len, hash);
+
+    if (entry) {
+        switch_mutex_unlock(globals.mutex);
+        return entry;
+    }
+
+    now = switch_micro_time_now();
+    if (globals.entry_retired) {
+        domain_entry_reclaim(now);
+    }
+
+    /* At the limit, make room by retiring a domain nobody has used lately */
+    if (globals.cache_entries >= globals.max_domains && !retire_domain_entry()) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: Cache full (%d domains)\n", globals.max_domains);
+        switch_mutex_unlock(globals.mutex);
+        return NULL;
+    }
+
+    /* Create new cache entry */
+    if (!(entry = domain_entry_alloc())) {
+        switch_mutex_unlock(globals.mutex);
+        return NULL;
+    }
+
+    /* Per-entry pool for the file mutex and strings, released when the entry is reclaimed */
+    if (switch_core_new_memory_pool(&entry->pool) != SWITCH_STATUS_SUCCESS) {
+        domain_entry_free(entry);
+        switch_mutex_unlock(globals.mutex);
+        return NULL;
+    }
+    switch_mutex_init(&entry->file_lock, SWITCH_MUTEX_NESTED, entry->pool);
+
+    entry->domain = domain_str_new(entry->pool, domain, len);
+    __atomic_store_n(&entry->hash, hash, __ATOMIC_RELAXED);
+    entry->writer = hash % globals.writer_count;
+    entry->roll_size = globals.roll_size;
+    entry->suffix = -1;
+    entry->referenced = 1;
+    entry->last_used = now;
+    rate_limit_apply(entry, globals.rate_limits);
+
+    /* Build log file path */
+    build_domain_logfile_path(entry);
+
+    /* The append buffer is allocated by the first buffered line */
+    entry->buf_size = globals.buffer_size;
+
+    /* Open the log file */
+    if (open_domain_logfile(entry) != SWITCH_STATUS_SUCCESS) {
+        domain_entry_free(entry);
+        switch_mutex_unlock(globals.mutex);
+        return NULL;
+    }
+
+    /* Publish to lock-free readers, held for the caller */
+    __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+    __atomic_and_fetch(&entry->refs, ~ENTRY_DEAD, __ATOMIC_SEQ_CST);
+    domain_table_insert(entry);
+    globals.cache_entries++;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
+                    "mod_logfile_domain: Created cache entry for domain: %s\n", entry->domain->str);
+
+    switch_mutex_unlock(globals.mutex);
+    return entry;
+}
+
+/* Slot for a session UUID, or NULL when the cache is off or the UUID is too long to cache */
+static uuid_cache_slot_t *uuid_cache_slot(const char *uuid, switch_size_t len)
+{
+    if (!globals.uuid_cache || len > SWITCH_UUID_FORMATTED_LENGTH) {
+        return NULL;
+    }
+
+    return &globals.uuid_cache[domain_hash_func(uuid, len) & globals.uuid_cache_mask];
+}
+
+/* The UUID as the slot holds it, NUL-padded to whole words (len checked by uuid_cache_slot()) */
+static void uuid_cache_key(uint64_t *key, const char *uuid, switch_size_t len)
+{
+    memset(key, 0, UUID_CACHE_WORDS * sizeof(uint64_t));
+    memcpy(key, uuid, len);
+}
+
+/* Lock-free lookup. On a miss *seq is the slot version a later uuid_cache_store() must match,
+   so a store that raced with an invalidation is dropped instead of caching a stale domain. */
+static switch_bool_t uuid_cache_find(uuid_cache_slot_t *slot, const char *uuid, switch_size_t len, switch_time_t now,
+                                     domain_cache_entry_t **entry, uint32_t *seq)
+{
+    uint64_t key[UUID_CACHE_WORDS];
+    domain_cache_entry_t *found;
+    switch_time_t expires;
+    int i, match = 1;
+
+    uuid_cache_key(key, uuid, len);
+
+    *seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    if (*seq & 1) {
+        return SWITCH_FALSE;
+    }
+
+    for (i = 0; i < UUID_CACHE_WORDS; i++) {
+        match &= __atomic_load_n(&slot->uuid[i], __ATOMIC_RELAXED) == key[i];
+    }
+    found = __atomic_load_n(&slot->entry, __ATOMIC_RELAXED);
+    expires = __atomic_load_n(&slot->expires, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != *seq || !match || now >= expires) {
+        return SWITCH_FALSE;
+    }
+
+    *entry = found;
+
+    return SWITCH_TRUE;
+}
+
+/* Fill the slot if nobody touched it since uuid_cache_find() */
+static void uuid_cache_store(uuid_cache_slot_t *slot, const char *uuid, switch_size_t len, uint32_t seq,
+                             domain_cache_entry_t *entry, switch_time_t now)
+{
+    uint64_t key[UUID_CACHE_WORDS];
+    int i;
+
+    if ((seq & 1) || !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uuid_cache_key(key, uuid, len);
+    for (i = 0; i < UUID_CACHE_WORDS; i++) {
+        __atomic_store_n(&slot->uuid[i], key[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->entry, entry, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->expires, now + (switch_time_t)__atomic_load_n(&globals.uuid_cache_ttl, __ATOMIC_RELAXED) * 1000,
+                     __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Clear the slot if it maps to entry (any entry when NULL); always bumps the version so
+   racing stores fail */
+static void uuid_cache_clear_slot(uuid_cache_slot_t *slot, domain_cache_entry_t *entry)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) & ~1U;
+    } while (!__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (!entry || __atomic_load_n(&slot->entry, __ATOMIC_RELAXED) == entry) {
+        int i;
+
+        for (i = 0; i < UUID_CACHE_WORDS; i++) {
+            __atomic_store_n(&slot->uuid[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&slot->entry, NULL, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->expires, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Clear whatever occupies the UUID's slot */
+void uuid_cache_invalidate(const char *uuid)
+{
+    uuid_cache_slot_t *slot = uuid_cache_slot(uuid, strlen(uuid));
+
+    if (slot) {
+        uuid_cache_clear_slot(slot, NULL);
+    }
+}
+
+/* Drop every UUID mapped to a retired entry before its memory can be reused. Every slot's
+   version is bumped, so a lookup that resolved the entry before it was unlinked cannot
+   store it afterwards. */
+static void uuid_cache_forget_entry(domain_cache_entry_t *entry)
+{
+    uint32_t i;
+
+    for (i = 0; globals.uuid_cache && i <= globals.uuid_cache_mask; i++) {
+        uuid_cache_clear_slot(&globals.uuid_cache[i], entry);
+    }
+}
+
+/* Domain entry for a session UUID, from the cache or by asking the host for the session's
+   domain. Returns SWITCH_FALSE if the session is gone; *entry is NULL if it has no domain,
+   and held like get_domain_entry()'s otherwise. */
+switch_bool_t resolve_session_entry(const char *uuid, switch_time_t now, domain_cache_entry_t **entry)
+{
+    switch_size_t len = strlen(uuid);
+    uuid_cache_slot_t *slot = uuid_cache_slot(uuid, len);
+    char domain[DOMAIN_NAME_MAX];
+    uint32_t seq = 1;
+    int n;
+
+    *entry = NULL;
+
+    /* Retiring an entry clears it from every slot first, so a slot version still unchanged
+       once the entry is held means it was not retired, let alone reused */
+    if (slot && uuid_cache_find(slot, uuid, len, now, entry, &seq)) {
+        if (domain_entry_hold(*entry)) {
+            if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == seq) {
+                __atomic_add_fetch(&globals.uuid_cache_hits, 1, __ATOMIC_RELAXED);
+                return SWITCH_TRUE;
+            }
+            domain_entry_release(*entry);
+        }
+        *entry = NULL;
+    }
+
+    if (!globals.host || (n = globals.host->session_domain(uuid, domain, sizeof(domain))) < 0) {
+        return SWITCH_FALSE;
+    }
+
+    __atomic_add_fetch(&globals.uuid_cache_misses, 1, __ATOMIC_RELAXED);
+
+    if (n > 0) {
+        /* a failed open or a full cache is not remembered, the next line tries again;
+           a name too long for domain[] fails here like any other over-long name */
+        if (!(*entry = get_domain_entry(domain, (switch_size_t)n))) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                            "mod_logfile_domain: No cache entry for domain: %s\n", domain);
+        }
+    }
+
+    /* "No domain" is not remembered either: domain_name is usually set after the first
+       lines (sofia auth, the directory, originate variables), without an event to drop it */
+    if (slot && *entry) {
+        uuid_cache_store(slot, uuid, len, seq, *entry, now);
+    }
+
+    return SWITCH_TRUE;
+}
+
+/* Snapshot the cached entries so file I/O can run without holding globals.mutex. Entries in
+   a snapshot are not reclaimed until release_domain_entries(). */
+domain_cache_entry_t **collect_domain_entries(int *count)
+{
+    domain_table_t *table;
+    domain_cache_entry_t **entries;
+    uint32_t i;
+    int n = 0;
+
+    __atomic_add_fetch(&globals.snapshots, 1, __ATOMIC_SEQ_CST);
+    table = __atomic_load_n(&globals.domain_table, __ATOMIC_ACQUIRE);
+
+    switch_zmalloc(entries, sizeof(*entries) * (table ? table->size : 1));
+
+    for (i = 0; table && i < table->size; i++) {
+        domain_cache_entry_t *entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+
+        if (entry && entry != DOMAIN_TOMBSTONE) {
+            entries[n++] = entry;
+        }
+    }
+
+    *count = n;
+
+    return entries;
+}
+
+void release_domain_entries(domain_cache_entry_t **entries)
+{
+    free(entries);
+    __atomic_sub_fetch(&globals.snapshots, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,858 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * logfile_domain_writer.c -- Queues, writer threads, append buffers and the sync thread
+ *
+ */
+
+#include "logfile_domain.h"
+
+/* Allocate queue cells; size is rounded up to a power of two */
+void log_queue_init(log_queue_t *q, uint32_t size)
+{
+    uint32_t n = MIN_QUEUE_SIZE;
+    uint32_t i;
+
+    while (n < size && n < 0x80000000U) {
+        n <<= 1;
+    }
+
+    q->cells = (log_queue_cell_t *)switch_core_alloc(module_pool, sizeof(log_queue_cell_t) * n);
+    q->mask = n - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+
+    for (i = 0; i < n; i++) {
+        q->cells[i].seq = i;
+        q->cells[i].rec = NULL;
+    }
+}
+
+/* Lock-free enqueue, returns SWITCH_FALSE when the queue is full */
+static switch_bool_t log_queue_push(log_queue_t *q, log_record_t *rec)
+{
+    log_queue_cell_t *cell;
+    uint32_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        int32_t dif;
+
+        cell = &q->cells[pos & q->mask];
+        dif = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return SWITCH_FALSE;
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->rec = rec;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return SWITCH_TRUE;
+}
+
+/* Single-consumer dequeue, only called from the writer thread */
+static log_record_t *log_queue_pop(log_queue_t *q)
+{
+    uint32_t pos = q->dequeue_pos;
+    log_queue_cell_t *cell = &q->cells[pos & q->mask];
+    log_record_t *rec;
+
+    if ((int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1)) < 0) {
+        return NULL;
+    }
+
+    rec = cell->rec;
+    cell->rec = NULL;
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->dequeue_pos, pos + 1, __ATOMIC_RELEASE);
+
+    return rec;
+}
+
+uint32_t log_queue_depth(log_queue_t *q)
+{
+    uint32_t tail = __atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&q->enqueue_pos, __ATOMIC_ACQUIRE);
+
+    return head - tail;
+}
+
+/* Ask the sync thread for a pass; cheap enough to call with file_lock held */
+void log_sync_wake(void)
+{
+    if (!globals.sync_thread) {
+        return;
+    }
+
+    switch_mutex_lock(globals.sync_mutex);
+    globals.sync_requests++;
+    switch_thread_cond_signal(globals.sync_cond);
+    switch_mutex_unlock(globals.sync_mutex);
+}
+
+static void sync_histogram_add(switch_time_t usec)
+{
+    __atomic_add_fetch(&globals.sync_hist[latency_bucket(usec, SYNC_HISTOGRAM_BUCKETS)], 1, __ATOMIC_RELAXED);
+}
+
+/* One fdatasync, counted in the sync stats; SWITCH_FALSE (logged) if it failed */
+static switch_bool_t sync_fd(int fd, const char *path)
+{
+    switch_time_t start = switch_micro_time_now();
+
+    if (domain_fdatasync(fd)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Sync of %s failed: %s\n", path, strerror(errno));
+        __atomic_add_fetch(&globals.sync_errors, 1, __ATOMIC_RELAXED);
+        return SWITCH_FALSE;
+    }
+    sync_histogram_add(switch_micro_time_now() - start);
+    __atomic_add_fetch(&globals.syncs, 1, __ATOMIC_RELAXED);
+
+    return SWITCH_TRUE;
+}
+
+/* Sync a closing domain file's fd without making the closer wait: a dup goes to the sync
+   thread, the caller closes its own fd. Once the core is stopping it is synced in place. */
+void log_sync_closing(int fd, const char *path)
+{
+    switch_size_t len = strlen(path);
+    sync_closed_t *c;
+
+    if (!__atomic_load_n(&globals.running, __ATOMIC_ACQUIRE)) {
+        sync_fd(fd, path);
+        return;
+    }
+    if (!globals.sync_thread) {
+        return;
+    }
+
+    if ((fd = dup(fd)) < 0 || !(c = (sync_closed_t *)malloc(sizeof(*c) + len + 1))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                        "mod_logfile_domain: Can't hand %s to the sync thread: %s\n", path, strerror(errno));
+        __atomic_add_fetch(&globals.sync_errors, 1, __ATOMIC_RELAXED);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    c->fd = fd;
+    memcpy(c->path, path, len + 1);
+
+    switch_mutex_lock(globals.sync_mutex);
+    c->next = globals.sync_closed;
+    globals.sync_closed = c;
+    globals.sync_requests++;
+    switch_thread_cond_signal(globals.sync_cond);
+    switch_mutex_unlock(globals.sync_mutex);
+}
+
+/* Write out pending buffered lines (file_lock held) */
+switch_status_t flush_domain_buffer(domain_cache_entry_t *entry)
+{
+    switch_status_t status;
+
+    if (!entry->buf_len) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    status = domain_file_write(entry, entry->buf, entry->buf_len);
+    entry->buf_len = 0;
+
+    return status;
+}
+
+/* Ask the writer thread to rotate this domain once it crosses rollover (file_lock held) */
+void check_domain_rollover(domain_cache_entry_t *entry)
+{
+    if (entry->roll_size && entry->log_size >= entry->roll_size &&
+        !__atomic_load_n(&entry->rotate_pending, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&entry->rotate_pending, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&globals.rotate_requests, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Gather segments into dst */
+static void copy_segments(char *dst, const struct iovec *iov, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+}
+
+/* Write a line given as segments totalling len bytes. Buffered lines are copied once into the
+   append buffer; anything larger is written as is, whatever its size. */
+switch_status_t write_domain_log(domain_cache_entry_t *entry, const struct iovec *iov, int count, switch_size_t len)
+{
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    domain_cache_entry_t *redirected = NULL;
+    char stack_buf[4096];
+    char *gather = NULL;
+
+    switch_mutex_lock(entry->file_lock);
+
+    /* The domain was retired after the caller looked it up; follow it to its new entry,
+       held until the line is written there */
+    while (entry->retired) {
+        char domain[DOMAIN_NAME_MAX];
+        switch_size_t domain_len = entry->domain->len;
+
+        memcpy(domain, entry->domain->str, domain_len);
+        switch_mutex_unlock(entry->file_lock);
+
+        if (redirected) {
+            domain_entry_release(redirected);
+        }
+        if (!(entry = redirected = get_domain_entry(domain, domain_len))) {
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_mutex_lock(entry->file_lock);
+    }
+
+    __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->last_used, switch_micro_time_now(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&entry->stats.lines, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&entry->stats.bytes, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(entry->sink.ops ? &globals.handle_hits : &globals.handle_misses, 1, __ATOMIC_RELAXED);
+
+    /* Coalesce into the append buffer, making room first if the line does not fit */
+    if (entry->buf_size) {
+        if (entry->buf_len + len > entry->buf_size) {
+            flush_domain_buffer(entry);
+        }
+
+        if (entry->buf_cap < entry->buf_size && !entry->buf_len) {
+            free(entry->buf);
+            if ((entry->buf = (char *)malloc(entry->buf_size))) {
+                entry->buf_cap = entry->buf_size;
+            } else {
+                entry->buf_cap = 0;
+            }
+        }
+
+        if (len <= entry->buf_size && entry->buf) {
+            if (!entry->buf_len) {
+                entry->buf_since = entry->last_used;
+            }
+            copy_segments(entry->buf + entry->buf_len, iov, count);
+            entry->buf_len += len;
+            entry->log_size += len;
+            check_domain_rollover(entry);
+            goto done;
+        }
+    }
+
+    /* switch_file_t has no writev, so a multi-segment line is gathered once for a single write */
+    if (count == 1) {
+        status = domain_file_write(entry, iov[0].iov_base, len);
+    } else {
+        gather = len <= sizeof(stack_buf) ? stack_buf : malloc(len);
+        if (gather) {
+            copy_segments(gather, iov, count);
+            status = domain_file_write(entry, gather, len);
+        } else {
+            status = SWITCH_STATUS_MEMERR;
+        }
+    }
+
+    if (status == SWITCH_STATUS_SUCCESS) {
+        entry->log_size += len;
+        check_domain_rollover(entry);
+    }
+
+  done:
+    switch_mutex_unlock(entry->file_lock);
+
+    if (gather && gather != stack_buf) {
+        free(gather);
+    }
+    if (redirected) {
+        domain_entry_release(redirected);
+    }
+
+    return status;
+}
+
+/* Flush buffers whose oldest line is older than flush-interval, or all of them when forced */
+static void flush_domain_buffers(switch_bool_t force)
+{
+    domain_cache_entry_t **entries;
+    switch_time_t now = switch_micro_time_now();
+    switch_time_t interval = (switch_time_t)__atomic_load_n(&globals.flush_interval, __ATOMIC_RELAXED) * 1000;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+
+        switch_mutex_lock(entry->file_lock);
+        if (entry->buf_len && (force || now - entry->buf_since >= interval)) {
+            flush_domain_buffer(entry);
+        }
+        switch_mutex_unlock(entry->file_lock);
+    }
+
+    release_domain_entries(entries);
+}
+
+/* Writer 0, every STATS_SAMPLE_INTERVAL: per-domain line and byte rates over the last elapsed usec */
+static void sample_domain_rates(switch_time_t elapsed)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    if (elapsed <= 0) {
+        return;
+    }
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_stats_t *stats = &entries[i]->stats;
+        uint64_t lines = __atomic_load_n(&stats->lines, __ATOMIC_RELAXED);
+        uint64_t bytes = __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&stats->lines_rate, (lines - stats->sample_lines) * 1000000 / (uint64_t)elapsed, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->bytes_rate, (bytes - stats->sample_bytes) * 1000000 / (uint64_t)elapsed, __ATOMIC_RELAXED);
+        stats->sample_lines = lines;
+        stats->sample_bytes = bytes;
+    }
+
+    release_domain_entries(entries);
+}
+
+/* Wake a writer thread, only takes the mutex when the writer is actually asleep */
+void log_writer_wake(log_writer_t *writer)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&writer->sleeping, __ATOMIC_RELAXED)) {
+        switch_mutex_lock(writer->mutex);
+        switch_thread_cond_signal(writer->cond);
+        switch_mutex_unlock(writer->mutex);
+    }
+}
+
+/* Hand a formatted line to its domain's writer thread according to the overflow policy; the
+   record carries the caller's reference on the entry until it is written or dropped */
+switch_status_t enqueue_domain_log(domain_cache_entry_t *entry, const log_line_t *line)
+{
+    log_writer_t *writer;
+    log_record_t *rec;
+    uint32_t depth, hw;
+
+    switch_malloc(rec, sizeof(*rec) + line->len);
+    rec->entry = entry;
+    rec->data = (char *)(rec + 1);
+    rec->len = line->len;
+    rec->next = NULL;
+    copy_segments(rec->data, line->iov, line->count);
+
+    /* A rebalance only trusts the old writer's queue position once nobody is between
+       reading entry->writer and pushing */
+    __atomic_add_fetch(&entry->enqueuing, 1, __ATOMIC_SEQ_CST);
+    writer = &globals.writers[__atomic_load_n(&entry->writer, __ATOMIC_SEQ_CST)];
+
+    while (!log_queue_push(&writer->queue, rec)) {
+        if (__atomic_load_n(&globals.overflow_policy, __ATOMIC_RELAXED) == QUEUE_OVERFLOW_DROP || !__atomic_load_n(&globals.running, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&entry->enqueuing, 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&globals.queue_dropped, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&entry->stats.drops, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_RELEASE);
+            free(rec);
+            return SWITCH_STATUS_FALSE;
+        }
+        log_writer_wake(writer);
+        switch_cond_next();
+    }
+    __atomic_sub_fetch(&entry->enqueuing, 1, __ATOMIC_RELEASE);
+
+    depth = log_queue_depth(&writer->queue);
+    hw = __atomic_load_n(&writer->high_water, __ATOMIC_RELAXED);
+    while (depth > hw && !__atomic_compare_exchange_n(&writer->high_water, &hw, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    log_writer_wake(writer);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Whether every line queued on a migrating domain's old writer has been written */
+static switch_bool_t migration_ready(domain_cache_entry_t *entry)
+{
+    int state = __atomic_load_n(&entry->migrating, __ATOMIC_ACQUIRE);
+
+    if (state != MIGRATION_TICKETED) {
+        return state == MIGRATION_NONE;
+    }
+
+    return (int32_t)(__atomic_load_n(&globals.writers[entry->migrate_from].done, __ATOMIC_ACQUIRE) -
+                     entry->migrate_ticket) >= 0;
+}
+
+/* Write one queued line and drop the reference its producer took */
+static void log_writer_write(log_record_t *rec)
+{
+    domain_cache_entry_t *entry = rec->entry;
+    struct iovec iov;
+
+    iov.iov_base = rec->data;
+    iov.iov_len = rec->len;
+    write_domain_log(entry, &iov, 1, rec->len);
+    __atomic_add_fetch(&entry->lines, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_RELEASE);
+    free(rec);
+}
+
+/* Write a popped line, or hold it while its domain's old writer still has earlier ones. The
+   old writer itself only ever has earlier lines, so it writes them straight away. */
+static void log_writer_handle(log_writer_t *writer, log_record_t *rec)
+{
+    domain_cache_entry_t *entry = rec->entry;
+
+    if (__atomic_load_n(&entry->migrating, __ATOMIC_ACQUIRE) != MIGRATION_NONE &&
+        entry->migrate_from != (uint32_t)writer->id &&
+        (__atomic_load_n(&entry->deferred, __ATOMIC_RELAXED) || !migration_ready(entry))) {
+        if (writer->deferred_tail) {
+            writer->deferred_tail->next = rec;
+        } else {
+            writer->deferred = rec;
+        }
+        writer->deferred_tail = rec;
+        __atomic_add_fetch(&entry->deferred, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_writer_write(rec);
+}
+
+/* Write held lines once their old writer has caught up; the last one ends the migration.
+   Only one domain migrates at a time, so everything held belongs to it. */
+static void log_writer_release_deferred(log_writer_t *writer)
+{
+    log_record_t *rec;
+
+    while ((rec = writer->deferred) && migration_ready(rec->entry)) {
+        domain_cache_entry_t *entry = rec->entry;
+
+        if (!(writer->deferred = rec->next)) {
+            writer->deferred_tail = NULL;
+        }
+        if (!__atomic_sub_fetch(&entry->deferred, 1, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&entry->migrating, MIGRATION_NONE, __ATOMIC_RELEASE);
+        }
+        log_writer_write(rec);
+    }
+}
+
+/* Drive a migration into this writer: take the old queue's position once producers that
+   may still push there are gone, and finish once the old writer passed it with nothing held */
+static void log_writer_check_migration(log_writer_t *writer)
+{
+    domain_cache_entry_t *entry = __atomic_load_n(&globals.migration, __ATOMIC_ACQUIRE);
+    int state;
+
+    if (!entry || __atomic_load_n(&entry->writer, __ATOMIC_ACQUIRE) != (uint32_t)writer->id) {
+        return;
+    }
+
+    state = __atomic_load_n(&entry->migrating, __ATOMIC_ACQUIRE);
+
+    if (state == MIGRATION_SWITCHED && !__atomic_load_n(&entry->enqueuing, __ATOMIC_SEQ_CST)) {
+        entry->migrate_ticket = __atomic_load_n(&globals.writers[entry->migrate_from].queue.enqueue_pos, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&entry->migrating, MIGRATION_TICKETED, __ATOMIC_RELEASE);
+    } else if (state == MIGRATION_TICKETED && !__atomic_load_n(&entry->deferred, __ATOMIC_RELAXED) && migration_ready(entry)) {
+        __atomic_store_n(&entry->migrating, MIGRATION_NONE, __ATOMIC_RELEASE);
+    }
+}
+
+/* Writer 0, every REBALANCE_INTERVAL: a writer whose queue stayed over rebalance-depth for
+   REBALANCE_SAMPLES samples hands its busiest domain to the least loaded writer. Moving a
+   domain that has the writer to itself would not help, so at least two must be active. */
+static void rebalance_writers(void)
+{
+    domain_cache_entry_t **entries, *busiest = NULL;
+    log_writer_t *hot = NULL, *cold = NULL;
+    uint32_t i, hot_depth = 0, cold_depth = UINT32_MAX, active = 0, most = 0;
+    uint32_t rebalance_depth = __atomic_load_n(&globals.rebalance_depth, __ATOMIC_RELAXED);
+    int n, j;
+
+    if (globals.migration) {
+        if (__atomic_load_n(&globals.migration->migrating, __ATOMIC_ACQUIRE) != MIGRATION_NONE) {
+            return;
+        }
+        __atomic_store_n(&globals.migration, NULL, __ATOMIC_RELEASE);
+    }
+
+    for (i = 0; i < globals.writer_count; i++) {
+        log_writer_t *writer = &globals.writers[i];
+        uint32_t depth = log_queue_depth(&writer->queue);
+
+        writer->hot_samples = depth > rebalance_depth ? writer->hot_samples + 1 : 0;
+        if (writer->hot_samples >= REBALANCE_SAMPLES && depth > hot_depth) {
+            hot = writer;
+            hot_depth = depth;
+        }
+        if (depth < cold_depth) {
+            cold = writer;
+            cold_depth = depth;
+        }
+    }
+
+    entries = collect_domain_entries(&n);
+
+    for (j = 0; j < n; j++) {
+        domain_cache_entry_t *entry = entries[j];
+        uint32_t lines = __atomic_exchange_n(&entry->lines, 0, __ATOMIC_RELAXED);
+
+        if (hot && lines && entry->writer == (uint32_t)hot->id) {
+            active++;
+            if (lines > most && !entry->retired) {
+                most = lines;
+                busiest = entry;
+            }
+        }
+    }
+
+    if (busiest && active > 1 && cold != hot && cold_depth < rebalance_depth / 2) {
+        /* migrating is visible before any line can reach the new writer */
+        busiest->migrate_from = hot->id;
+        __atomic_store_n(&busiest->migrating, MIGRATION_SWITCHED, __ATOMIC_RELEASE);
+        __atomic_store_n(&busiest->writer, (uint32_t)cold->id, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&globals.migration, busiest, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&globals.migrations, 1, __ATOMIC_RELAXED);
+        hot->hot_samples = 0;
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                        "mod_logfile_domain: Moving %s from writer %d (depth %u) to writer %d (depth %u)\n",
+                        busiest->domain->str, hot->id, hot_depth, cold->id, cold_depth);
+        log_writer_wake(cold);
+    }
+
+    release_domain_entries(entries);
+}
+
+#ifdef LOGFILE_DOMAIN_AFFINITY
+/* Pin the calling writer thread to writer->cpu */
+static void pin_writer_thread(log_writer_t *writer)
+{
+    unsigned long mask[MAX_WRITER_CPUS / (8 * sizeof(unsigned long))];
+    const int bits = 8 * sizeof(unsigned long);
+
+    memset(mask, 0, sizeof(mask));
+    mask[writer->cpu / bits] |= 1UL << (writer->cpu % bits);
+
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: Can't pin writer %d to CPU %d: %s\n", writer->id, writer->cpu, strerror(errno));
+        writer->cpu = -1;
+    }
+}
+#endif
+
+/* Writer thread: drains its queue to the per-domain files. Writer 0 also flushes idle
+   buffers, rotates, relocates after a log-dir change, rebalances and reports drops. */
+void *SWITCH_THREAD_FUNC log_writer_thread(switch_thread_t *thread, void *obj)
+{
+    log_writer_t *writer = (log_writer_t *)obj;
+    log_record_t *rec = NULL;
+    uint64_t reported = 0;
+    uint32_t batch = 0;
+    switch_time_t now = switch_micro_time_now();
+    switch_time_t last_report = now;
+    switch_time_t last_flush = now;
+    switch_time_t last_idle_check = now;
+    switch_time_t last_rebalance = now;
+    switch_time_t last_sample = now;
+    switch_time_t flush_interval;
+    switch_bool_t buffered;
+    uint32_t rotations_seen = 0, relocations_seen = 0;
+
+    (void)thread;
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+    uring_batching = writer->id == 0;
+#endif
+#ifdef LOGFILE_DOMAIN_AFFINITY
+    if (writer->cpu >= 0) {
+        pin_writer_thread(writer);
+    }
+#endif
+
+    while (__atomic_load_n(&globals.running, __ATOMIC_ACQUIRE) ||
+           (globals.async_write && (log_queue_depth(&writer->queue) || writer->deferred))) {
+        switch_interval_time_t idle_wait = WRITER_IDLE_WAIT;
+        switch_bool_t maint_pending = SWITCH_FALSE;
+
+        if (__atomic_load_n(&globals.migration, __ATOMIC_RELAXED)) {
+            log_writer_check_migration(writer);
+        }
+        if (writer->deferred) {
+            log_writer_release_deferred(writer);
+        }
+
+        if (globals.async_write && (rec = log_queue_pop(&writer->queue))) {
+            log_writer_handle(writer, rec);
+            __atomic_store_n(&writer->done, writer->done + 1, __ATOMIC_RELEASE);
+            if (++batch < WRITER_BATCH) {
+                continue;
+            }
+        }
+        batch = 0;
+
+        if (writer->id == 0) {
+            if (__atomic_load_n(&globals.relocate_requests, __ATOMIC_ACQUIRE) != relocations_seen) {
+                relocations_seen = __atomic_load_n(&globals.relocate_requests, __ATOMIC_ACQUIRE);
+                reopen_all_domain_logs(SWITCH_TRUE);
+            }
+
+            if (__atomic_load_n(&globals.rotate_requests, __ATOMIC_ACQUIRE) != rotations_seen) {
+                rotations_seen = __atomic_load_n(&globals.rotate_requests, __ATOMIC_ACQUIRE);
+                rotate_pending_domain_logs();
+            }
+
+            now = switch_micro_time_now();
+            flush_interval = (switch_time_t)__atomic_load_n(&globals.flush_interval, __ATOMIC_RELAXED) * 1000;
+            buffered = __atomic_load_n(&globals.buffer_size, __ATOMIC_RELAXED) != 0;
+
+            if (buffered && now - last_flush >= flush_interval) {
+                flush_domain_buffers(SWITCH_FALSE);
+                last_flush = now;
+            }
+
+            if (__atomic_load_n(&globals.idle_timeout, __ATOMIC_RELAXED) && now - last_idle_check >= IDLE_CHECK_INTERVAL) {
+                close_idle_domain_handles(now);
+                last_idle_check = now;
+            }
+
+            if (globals.async_write && globals.writer_count > 1 && __atomic_load_n(&globals.rebalance_depth, __ATOMIC_RELAXED) &&
+                now - last_rebalance >= REBALANCE_INTERVAL) {
+                rebalance_writers();
+                last_rebalance = now;
+            }
+
+            if (now - last_sample >= STATS_SAMPLE_INTERVAL) {
+                sample_domain_rates(now - last_sample);
+                log_pending_summaries(now);
+                last_sample = now;
+            }
+
+            if (now - last_report >= QUEUE_REPORT_INTERVAL * 1000000) {
+                uint64_t dropped = __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED);
+
+                if (dropped != reported) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Queue full, dropped %" PRIu64 " lines (%u writers, size %u each)\n",
+                                    dropped - reported, globals.writer_count, writer->queue.mask + 1);
+                    reported = dropped;
+                }
+                last_report = now;
+            }
+
+            if (buffered && flush_interval < idle_wait) {
+                idle_wait = flush_interval;
+            }
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+            /* Everything flushed since the last pass goes out in one submission */
+            log_uring_flush();
+#endif
+        }
+
+        if (rec || !__atomic_load_n(&globals.running, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        /* Held lines wait on another writer, check back soon */
+        if (writer->deferred && idle_wait > 1000) {
+            idle_wait = 1000;
+        }
+
+        switch_mutex_lock(writer->mutex);
+        __atomic_store_n(&writer->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (writer->id == 0) {
+            maint_pending = __atomic_load_n(&globals.rotate_requests, __ATOMIC_ACQUIRE) != rotations_seen ||
+                __atomic_load_n(&globals.relocate_requests, __ATOMIC_ACQUIRE) != relocations_seen;
+        }
+        if ((!globals.async_write || !log_queue_depth(&writer->queue)) && !maint_pending &&
+            __atomic_load_n(&globals.running, __ATOMIC_ACQUIRE)) {
+            switch_thread_cond_timedwait(writer->cond, writer->mutex, idle_wait);
+        }
+        __atomic_store_n(&writer->sleeping, 0, __ATOMIC_RELAXED);
+        switch_mutex_unlock(writer->mutex);
+    }
+
+#ifdef LOGFILE_DOMAIN_IO_URING
+    if (writer->id == 0) {
+        log_uring_flush();
+        uring_batching = 0;
+    }
+#endif
+
+    return NULL;
+}
+
+
+/* Group commit: one pass syncs every domain holding at least threshold unsynced bytes.
+   The fd is dup'ed under file_lock so a rotation or close cannot pull it away, and the
+   lock is not held while the disk works, so logging never waits for a sync. */
+static void sync_domain_logs(switch_size_t threshold)
+{
+    domain_cache_entry_t **entries;
+    int n, i;
+
+    entries = collect_domain_entries(&n);
+
+    for (i = 0; i < n; i++) {
+        domain_cache_entry_t *entry = entries[i];
+        switch_size_t pending = 0;
+        int fd = -1;
+
+        switch_mutex_lock(entry->file_lock);
+        if (entry->unsynced && entry->unsynced >= threshold && entry->sink.ops && entry->sink.fd >= 0 &&
+            (fd = dup(entry->sink.fd)) >= 0) {
+            pending = entry->unsynced;
+            entry->unsynced = 0;
+            entry->sync_pending = 0;
+        }
+        switch_mutex_unlock(entry->file_lock);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        if (!sync_fd(fd, __atomic_load_n(&entry->path, __ATOMIC_ACQUIRE)->str)) {
+            switch_mutex_lock(entry->file_lock);
+            entry->unsynced += pending;
+            switch_mutex_unlock(entry->file_lock);
+        }
+        close(fd);
+    }
+
+    release_domain_entries(entries);
+}
+
+/* Sync the files handed over by log_sync_closing() since the last pass */
+static void sync_closed_logs(void)
+{
+    sync_closed_t *c;
+
+    switch_mutex_lock(globals.sync_mutex);
+    c = globals.sync_closed;
+    globals.sync_closed = NULL;
+    switch_mutex_unlock(globals.sync_mutex);
+
+    while (c) {
+        sync_closed_t *next = c->next;
+
+        sync_fd(c->fd, c->path);
+        close(c->fd);
+        free(c);
+        c = next;
+    }
+}
+
+/* Sync thread: runs the group commits for durability=interval and durability=bytes */
+void *SWITCH_THREAD_FUNC log_sync_thread(switch_thread_t *thread, void *obj)
+{
+    (void)thread;
+    (void)obj;
+
+    while (__atomic_load_n(&globals.running, __ATOMIC_ACQUIRE)) {
+        durability_t durability = __atomic_load_n(&globals.durability, __ATOMIC_RELAXED);
+        switch_interval_time_t wait = SYNC_IDLE_WAIT;
+
+        if (durability == DURABILITY_INTERVAL) {
+            wait = (switch_interval_time_t)__atomic_load_n(&globals.sync_interval, __ATOMIC_RELAXED) * 1000;
+        }
+
+        switch_mutex_lock(globals.sync_mutex);
+        if (__atomic_load_n(&globals.running, __ATOMIC_ACQUIRE) && !globals.sync_requests) {
+            switch_thread_cond_timedwait(globals.sync_cond, globals.sync_mutex, wait);
+        }
+        globals.sync_requests = 0;
+        switch_mutex_unlock(globals.sync_mutex);
+
+        sync_closed_logs();
+        if (durability == DURABILITY_INTERVAL) {
+            sync_domain_logs(1);
+        } else if (durability == DURABILITY_BYTES) {
+            sync_domain_logs(__atomic_load_n(&globals.sync_bytes, __ATOMIC_RELAXED));
+        }
+    }
+
+    return NULL;
+}
+
+/* Signal and join every started writer thread (globals.running already cleared) */
+void stop_log_writers(void)
+{
+    uint32_t i;
+
+    for (i = 0; globals.writers && i < globals.writer_count; i++) {
+        log_writer_t *writer = &globals.writers[i];
+        switch_status_t st;
+
+        if (!writer->thread) {
+            continue;
+        }
+
+        switch_mutex_lock(writer->mutex);
+        switch_thread_cond_signal(writer->cond);
+        switch_mutex_unlock(writer->mutex);
+        switch_thread_join(&st, writer->thread);
+        writer->thread = NULL;
+    }
+}
+
+void stop_sync_thread(void)
+{
+    switch_status_t st;
+
+    if (!globals.sync_thread) {
+        return;
+    }
+
+    switch_mutex_lock(globals.sync_mutex);
+    switch_thread_cond_signal(globals.sync_cond);
+    switch_mutex_unlock(globals.sync_mutex);
+    switch_thread_join(&st, globals.sync_thread);
+    globals.sync_thread = NULL;
+
+    /* Files closed after its last pass */
+    sync_closed_logs();
+}
+
+/*
+ * For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -17,144 +17,380 @@
  *
  * Purpose: Capture and route channel-specific log messages to domain-based log files
  *
+ * This file adapts the logging core (logfile_domain.h) to FreeSWITCH: it reads the
+ * config XML, answers the API command, follows HUP, reloadxml and channel events, and
+ * looks up a session's domain for the core.
+ *
  */
 
-#include <switch.h>
-#include <dlfcn.h>
-#include <ctype.h>
+#include "logfile_domain.h"
 
 SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_logfile_domain_shutdown);
 SWITCH_MODULE_DEFINITION(mod_logfile_domain, mod_logfile_domain_load, mod_logfile_domain_shutdown, NULL);
 
-#define DEFAULT_LIMIT 0xA00000  /* About 10 MB */
-#define WARM_FUZZY_OFFSET 256
-#define MAX_ROT 4096
-#define MAX_DOMAIN_CACHE_SIZE 256
-
-static switch_memory_pool_t *module_pool = NULL;
-static switch_hash_t *domain_hash = NULL;
+#define LOGFILE_DOMAIN_SYNTAX "queue|stats|status [json]|sync|latency [on|off|reset]|reload"
 
-/* function pointer for optional API (may not exist in older FreeSWITCH builds) */
-typedef switch_status_t (*switch_log_node_render_fn)(const switch_log_node_t *node, char *buf, size_t len);
-static switch_log_node_render_fn switch_log_node_render_ptr = NULL;
+static struct {
+    switch_event_node_t *trap_node;
+    switch_event_node_t *reload_node;
+    switch_event_node_t *destroy_node;
+    switch_event_node_t *execute_node;
+} module;
+
+/* "0,2,4-7" into CPU numbers in order; writer i is pinned to cpus[i % count] */
+static switch_status_t parse_cpu_list(const char *val, int *cpus, uint32_t *count)
+{
+    const char *p = val;
 
-/* Domain file cache entry */
-typedef struct {
-    char domain[128];
-    switch_file_t *log_file;
-    switch_size_t log_size;
-    switch_size_t roll_size;
-    char logfile_path[512];
-    switch_mutex_t *file_lock;
-} domain_cache_entry_t;
+    *count = 0;
 
-static struct {
-    switch_mutex_t *mutex;
-    int cache_entries;
-} globals;
+    while (*p) {
+        char *end;
+        long lo, hi;
 
-/* Cleanup domain cache entry */
-static void cleanup_domain_entry(void *ptr)
-{
-    domain_cache_entry_t *entry = (domain_cache_entry_t *)ptr;
-    if (entry) {
-        if (entry->file_lock) {
-            switch_mutex_destroy(entry->file_lock);
+        lo = hi = strtol(p, &end, 10);
+        if (end == p || lo < 0) {
+            return SWITCH_STATUS_FALSE;
         }
-        if (entry->log_file) {
-            switch_file_close(entry->log_file);
+        p = end;
+        if (*p == '-') {
+            hi = strtol(++p, &end, 10);
+            if (end == p || hi < lo) {
+                return SWITCH_STATUS_FALSE;
+            }
+            p = end;
+        }
+        if (hi >= MAX_WRITER_CPUS) {
+            return SWITCH_STATUS_FALSE;
+        }
+        for (; lo <= hi && *count < MAX_WRITER_THREADS; lo++) {
+            cpus[(*count)++] = (int)lo;
+        }
+        while (*p == ',' || *p == ' ') {
+            p++;
         }
     }
-}
 
+    return *count ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE;
+}
 
-/* Open/create log file for domain */
-static switch_status_t open_domain_logfile(domain_cache_entry_t *entry)
+/* Parse logfile_domain.conf into s, starting from the defaults; invalid values keep the default.
+   s->level_map and s->rate_limits are always allocated and owned by the caller. */
+static switch_status_t parse_config(logfile_domain_settings_t *s)
 {
-    unsigned int flags = 0;
-    switch_file_t *afd;
-    switch_status_t stat;
+    const char *cf = "logfile_domain.conf";
+    switch_xml_t cfg, xml, settings, param, profiles, profile, mappings, domains;
+    switch_bool_t mapped = SWITCH_FALSE;
 
-    flags |= SWITCH_FOPEN_CREATE;
-    flags |= SWITCH_FOPEN_READ;
-    flags |= SWITCH_FOPEN_WRITE;
-    flags |= SWITCH_FOPEN_APPEND;
+    logfile_domain_settings_init(s);
 
-    stat = switch_file_open(&afd, entry->logfile_path, flags, SWITCH_FPROT_OS_DEFAULT, module_pool);
-    
-    if (stat != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, 
-                        "mod_logfile_domain: Failed to open %s (status=%d)\n", 
-                        entry->logfile_path, stat);
+    if (!(xml = switch_xml_open_cfg(cf, &cfg, NULL))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: Open of %s failed, using defaults\n", cf);
+        s->level_map->all.mask = level_floor_mask(s->log_level);
+        s->level_map->all.fallback = s->message_fallback;
         return SWITCH_STATUS_FALSE;
     }
 
-    entry->log_file = afd;
-    entry->log_size = switch_file_get_size(entry->log_file);
-
-    return SWITCH_STATUS_SUCCESS;
-}
+    if ((settings = switch_xml_child(cfg, "settings"))) {
+        for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+            const char *var = switch_xml_attr_soft(param, "name");
+            const char *val = switch_xml_attr_soft(param, "value");
+
+            if (!strcasecmp(var, "rotate-on-hup")) {
+                s->rotate_on_hup = switch_true(val) ? SWITCH_TRUE : SWITCH_FALSE;
+            } else if (!strcasecmp(var, "async-write")) {
+                s->async_write = switch_true(val) ? SWITCH_TRUE : SWITCH_FALSE;
+            } else if (!strcasecmp(var, "queue-size")) {
+                int tmp = atoi(val);
+                if (tmp >= MIN_QUEUE_SIZE) {
+                    s->queue_size = (uint32_t)tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid queue-size %s, using %u\n", val, s->queue_size);
+                }
+            } else if (!strcasecmp(var, "queue-overflow")) {
+                if (!strcasecmp(val, "block")) {
+                    s->overflow_policy = QUEUE_OVERFLOW_BLOCK;
+                } else if (!strcasecmp(val, "drop")) {
+                    s->overflow_policy = QUEUE_OVERFLOW_DROP;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid queue-overflow %s, using drop\n", val);
+                }
+            } else if (!strcasecmp(var, "writer-threads")) {
+                int tmp = atoi(val);
+                if (tmp > 0 && tmp <= MAX_WRITER_THREADS) {
+                    s->writer_threads = (uint32_t)tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: writer-threads must be 1..%d, using %u\n", MAX_WRITER_THREADS, s->writer_threads);
+                }
+            } else if (!strcasecmp(var, "writer-cpus")) {
+                if (parse_cpu_list(val, s->writer_cpus, &s->writer_cpu_count) != SWITCH_STATUS_SUCCESS) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid writer-cpus %s, writers not pinned\n", val);
+                    s->writer_cpu_count = 0;
+                }
+            } else if (!strcasecmp(var, "rebalance-depth")) {
+                int tmp = atoi(val);
+                if (tmp >= 0) {
+                    s->rebalance_depth = (uint32_t)tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: rebalance-depth must be >= 0, using %u\n", s->rebalance_depth);
+                }
+            } else if (!strcasecmp(var, "buffer-size")) {
+                int tmp = atoi(val);
+                if (tmp >= 0) {
+                    s->buffer_size = (switch_size_t)tmp;
+                }
+            } else if (!strcasecmp(var, "flush-interval")) {
+                int tmp = atoi(val);
+                if (tmp > 0) {
+                    s->flush_interval = (uint32_t)tmp;
+                }
+            } else if (!strcasecmp(var, "max-domains")) {
+                int tmp = atoi(val);
+                if (tmp > 0) {
+                    s->max_domains = tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid max-domains %s, using %d\n", val, s->max_domains);
+                }
+            } else if (!strcasecmp(var, "max-open-files")) {
+                int tmp = atoi(val);
+                if (tmp > 0) {
+                    s->max_open_files = tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid max-open-files %s, using %d\n", val, s->max_open_files);
+                }
+            } else if (!strcasecmp(var, "idle-timeout")) {
+                int tmp = atoi(val);
+                if (tmp >= 0) {
+                    s->idle_timeout = (uint32_t)tmp;
+                }
+            } else if (!strcasecmp(var, "log-level")) {
+                switch_log_level_t tmp = switch_log_str2level(val);
+                if (tmp != SWITCH_LOG_INVALID) {
+                    s->log_level = tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid log-level %s, using %s\n", val, switch_log_level2str(s->log_level));
+                }
+            } else if (!strcasecmp(var, "output")) {
+                const domain_sink_ops_t *ops = domain_sink_ops_find(val);
+                if (ops) {
+                    s->sink_ops = ops;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Unsupported output %s, using %s\n", val, s->sink_ops->name);
+                }
+            } else if (!strcasecmp(var, "mmap-chunk")) {
+                int64_t tmp = atoll(val);
+                int64_t page = (int64_t)sysconf(_SC_PAGESIZE);
+                if (tmp >= page) {
+                    s->mmap_chunk = (switch_size_t)((tmp + page - 1) / page * page);
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: mmap-chunk must be at least %" PRId64 ", using %" SWITCH_SIZE_T_FMT "\n",
+                                    page, s->mmap_chunk);
+                }
+            } else if (!strcasecmp(var, "log-microseconds")) {
+                s->log_usec = switch_true(val) ? SWITCH_TRUE : SWITCH_FALSE;
+            } else if (!strcasecmp(var, "message-fallback")) {
+                s->message_fallback = switch_true(val) ? SWITCH_TRUE : SWITCH_FALSE;
+            } else if (!strcasecmp(var, "uuid-cache-size")) {
+                int tmp = atoi(val);
+                if (tmp >= 0 && tmp <= 1048576) {
+                    s->uuid_cache_size = (uint32_t)tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: uuid-cache-size must be 0..1048576, using %u\n", s->uuid_cache_size);
+                }
+            } else if (!strcasecmp(var, "uuid-cache-ttl")) {
+                int tmp = atoi(val);
+                if (tmp > 0) {
+                    s->uuid_cache_ttl = (uint32_t)tmp;
+                }
+            } else if (!strcasecmp(var, "durability")) {
+                if (!strcasecmp(val, "none")) {
+                    s->durability = DURABILITY_NONE;
+                } else if (!strcasecmp(val, "interval")) {
+                    s->durability = DURABILITY_INTERVAL;
+                } else if (!strcasecmp(val, "bytes")) {
+                    s->durability = DURABILITY_BYTES;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid durability %s, using none\n", val);
+                }
+            } else if (!strcasecmp(var, "sync-interval")) {
+                int tmp = atoi(val);
+                if (tmp > 0) {
+                    s->sync_interval = (uint32_t)tmp;
+                }
+            } else if (!strcasecmp(var, "sync-bytes")) {
+                int64_t tmp = atoll(val);
+                if (tmp > 0) {
+                    s->sync_bytes = (switch_size_t)tmp;
+                }
+            } else if (!strcasecmp(var, "compress") || !strcasecmp(var, "compress-active")) {
+                compress_t *method = !strcasecmp(var, "compress") ? &s->compress : &s->compress_active;
+
+                if (!strcasecmp(val, "none")) {
+                    *method = COMPRESS_NONE;
+                } else if (!strcasecmp(val, "gzip")) {
+                    *method = COMPRESS_GZIP;
+                } else if (!strcasecmp(val, "zstd")) {
+#ifdef LOGFILE_DOMAIN_ZSTD
+                    *method = COMPRESS_ZSTD;
+#else
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Built without zstd, %s uses gzip\n", var);
+                    *method = COMPRESS_GZIP;
+#endif
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Invalid %s %s, using none\n", var, val);
+                }
+            } else if (!strcasecmp(var, "rate-limit") || !strcasecmp(var, "rate-limit-burst")) {
+                int *limit = !strcasecmp(var, "rate-limit") ? &s->rate_limits->all.rate : &s->rate_limits->all.burst;
+                int tmp = atoi(val);
+
+                if (tmp >= 0) {
+                    *limit = tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: %s must be >= 0, using %d\n", var, *limit);
+                }
+            } else if (!strcasecmp(var, "latency-histograms")) {
+                s->latency_histograms = switch_true(val) ? SWITCH_TRUE : SWITCH_FALSE;
+            } else if (!strcasecmp(var, "compress-level")) {
+                s->compress_level = atoi(val);
+            } else if (!strcasecmp(var, "compress-threads")) {
+                int tmp = atoi(val);
+                if (tmp > 0 && tmp <= MAX_COMPRESS_THREADS) {
+                    s->compress_threads = (uint32_t)tmp;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: compress-threads must be 1..%d, using %u\n", MAX_COMPRESS_THREADS, s->compress_threads);
+                }
+            }
+        }
+    }
 
-/* Get or create cache entry for a domain */
-static domain_cache_entry_t *get_domain_entry(const char *domain)
-{
-    domain_cache_entry_t *entry = NULL;
-    
-    if (!domain || zstr(domain)) {
-        return NULL;
+#ifndef WIN32
+    /* mmap trims trailing NULs after a crash, which can be part of a compressed frame */
+    if (s->compress_active != COMPRESS_NONE && s->sink_ops == domain_sink_ops_find("mmap")) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: compress-active does not work with output=mmap, disabled\n");
+        s->compress_active = COMPRESS_NONE;
     }
+#endif
 
-    switch_mutex_lock(globals.mutex);
+    /* 0 picks the method's default; gzip caps higher zstd levels at 9 */
+    if (s->compress_level) {
+        int max = 9;
 
-    /* Check if domain already in cache */
-    entry = (domain_cache_entry_t *)switch_core_hash_find(domain_hash, domain);
-    
-    if (entry) {
-        switch_mutex_unlock(globals.mutex);
-        return entry;
+#ifdef LOGFILE_DOMAIN_ZSTD
+        if (s->compress == COMPRESS_ZSTD || s->compress_active == COMPRESS_ZSTD) {
+            max = ZSTD_maxCLevel();
+        }
+#endif
+        if (s->compress_level < 1 || s->compress_level > max) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                            "mod_logfile_domain: compress-level must be 1..%d, using the default\n", max);
+            s->compress_level = 0;
+        }
     }
 
-    /* Check cache size limit */
-    if (globals.cache_entries >= MAX_DOMAIN_CACHE_SIZE) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
-                        "mod_logfile_domain: Cache full (%d domains)\n", MAX_DOMAIN_CACHE_SIZE);
-        switch_mutex_unlock(globals.mutex);
-        return NULL;
-    }
+    s->level_map->all.fallback = s->message_fallback;
 
-    /* Create new cache entry */
-    entry = (domain_cache_entry_t *)switch_core_alloc(module_pool, sizeof(*entry));
-    memset(entry, 0, sizeof(*entry));
+    /* Per-file settings come from the "default" profile, or the first one if none is named so */
+    if ((profiles = switch_xml_child(cfg, "profiles"))) {
+        switch_xml_t chosen = NULL;
 
-    switch_copy_string(entry->domain, domain, sizeof(entry->domain));
-    entry->roll_size = DEFAULT_LIMIT;
+        for (profile = switch_xml_child(profiles, "profile"); profile; profile = profile->next) {
+            if (!chosen || !strcasecmp(switch_xml_attr_soft(profile, "name"), "default")) {
+                chosen = profile;
+            }
+        }
 
-    /* Build log file path */
-    switch_snprintf(entry->logfile_path, sizeof(entry->logfile_path), 
-                   "%s%sdomain_%s.log", 
-                   SWITCH_GLOBAL_dirs.log_dir, 
-                   SWITCH_PATH_SEPARATOR, 
-                   domain);
+        if (chosen && (settings = switch_xml_child(chosen, "settings"))) {
+            for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+                const char *var = switch_xml_attr_soft(param, "name");
+                const char *val = switch_xml_attr_soft(param, "value");
+
+                if (!strcasecmp(var, "rollover")) {
+                    int64_t tmp = atoll(val);
+                    if (tmp >= 0) {
+                        s->roll_size = (switch_size_t)tmp;
+                    }
+                } else if (!strcasecmp(var, "maximum-rotate")) {
+                    int tmp = atoi(val);
+                    if (tmp > 0 && tmp <= MAX_ROT) {
+                        s->max_rot = tmp;
+                    } else {
+                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                        "mod_logfile_domain: maximum-rotate must be 1..%d, using %d\n", MAX_ROT, s->max_rot);
+                    }
+                } else if (!strcasecmp(var, "log-dir")) {
+                    if (zstr(val) || strlen(val) >= sizeof(s->log_dir)) {
+                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                        "mod_logfile_domain: Invalid log-dir, using %s\n", s->log_dir);
+                    } else {
+                        switch_copy_string(s->log_dir, val, sizeof(s->log_dir));
+                    }
+                }
+            }
+        }
 
-    /* Create per-file mutex */
-    switch_mutex_init(&entry->file_lock, SWITCH_MUTEX_NESTED, module_pool);
+        if (chosen && (mappings = switch_xml_child(chosen, "mappings"))) {
+            for (param = switch_xml_child(mappings, "map"); param; param = param->next) {
+                const char *var = switch_xml_attr_soft(param, "name");
+                const char *val = switch_xml_attr_soft(param, "value");
 
-    /* Open the log file */
-    if (open_domain_logfile(entry) != SWITCH_STATUS_SUCCESS) {
-        switch_mutex_unlock(globals.mutex);
-        return NULL;
+                if (zstr(var)) {
+                    continue;
+                }
+                level_map_add(s->level_map, var, switch_log_str2mask(val), switch_xml_attr(param, "fallback"));
+                mapped = SWITCH_TRUE;
+            }
+        }
+
+        /* <domain name="..." rate-limit="N" rate-limit-burst="N"/>, either attribute may be left to the global one */
+        if (chosen && (domains = switch_xml_child(chosen, "domains"))) {
+            for (param = switch_xml_child(domains, "domain"); param; param = param->next) {
+                const char *name = switch_xml_attr_soft(param, "name");
+                const char *rate = switch_xml_attr(param, "rate-limit");
+                const char *burst = switch_xml_attr(param, "rate-limit-burst");
+
+                if (zstr(name) || strlen(name) >= DOMAIN_NAME_MAX) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Ignoring <domain> without a valid name\n");
+                    continue;
+                }
+                if ((rate && atoi(rate) < 0) || (burst && atoi(burst) < 0)) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                    "mod_logfile_domain: Negative rate-limit for %s, using the global one\n", name);
+                }
+                rate_limit_map_add(s->rate_limits, name, rate ? atoi(rate) : -1, burst ? atoi(burst) : -1);
+            }
+        }
     }
 
-    /* Add to cache hash */
-    switch_core_hash_insert_destructor(domain_hash, domain, (void *)entry, cleanup_domain_entry);
-    globals.cache_entries++;
+    /* Without any <map> every level is written */
+    if (!mapped) {
+        s->level_map->all.mask = 0xFFFFFFFFU;
+    }
+    level_map_finish(s->level_map, s->log_level);
+    rate_limit_map_finish(s->rate_limits);
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
-                    "mod_logfile_domain: Created cache entry for domain: %s\n", domain);
+    switch_xml_free(xml);
 
-    switch_mutex_unlock(globals.mutex);
-    return entry;
+    return SWITCH_STATUS_SUCCESS;
 }
 
 /* Extract domain from channel */
@@ -183,217 +419,176 @@ static const char *extract_domain(switch_channel_t *channel)
     return NULL;
 }
 
-/* Try to extract domain from a rendered log message (fallback) */
-static const char *extract_domain_from_msg(const char *msg)
+/* The session's domain_name, or else domain, channel variable for the core; the session's
+   read lock keeps the value alive while it is copied */
+static int session_domain(const char *uuid, char *buf, switch_size_t len)
 {
-    static char domainbuf[128];
-    const char *p;
-    size_t i = 0;
-
-    if (!msg) return NULL;
-
-    /* look for domain_name=VALUE */
-    p = strstr(msg, "domain_name=");
-    if (!p) {
-        p = strstr(msg, "domain=");
-        if (!p) return NULL;
-        p += strlen("domain=");
-    } else {
-        p += strlen("domain_name=");
+    switch_core_session_t *session;
+    const char *domain;
+    int n = 0;
+
+    if (!(session = switch_core_session_locate(uuid))) {
+        return -1;
     }
 
-    /* copy until whitespace or non-printable or end */
-    while (*p && !isspace((unsigned char)*p) && i + 1 < sizeof(domainbuf)) {
-        domainbuf[i++] = *p++;
+    *buf = '\0';
+    if ((domain = extract_domain(switch_core_session_get_channel(session)))) {
+        n = (int)strlen(domain);
+        switch_copy_string(buf, domain, len);
     }
-    domainbuf[i] = '\0';
 
-    if (i == 0) return NULL;
-    return domainbuf;
+    switch_core_session_rwunlock(session);
+
+    return n;
 }
 
-/* Write log data to domain file */
-static switch_status_t write_domain_log(const char *domain, const char *log_data)
+static const logfile_domain_host_t freeswitch_host = { session_domain };
+
+/* Applications that can change domain_name/domain on a channel */
+static switch_bool_t sets_channel_variables(const char *app)
 {
-    domain_cache_entry_t *entry = NULL;
-    switch_size_t len;
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    static const char *apps[] = { "set", "export", "multiset", "unset", "set_user", "push", "unshift", NULL };
+    int i;
 
-    if (!domain || !log_data) {
-        return SWITCH_STATUS_FALSE;
+    for (i = 0; apps[i]; i++) {
+        if (!strcasecmp(app, apps[i])) {
+            return SWITCH_TRUE;
+        }
     }
 
-    entry = get_domain_entry(domain);
-    if (!entry) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
-                        "mod_logfile_domain: No cache entry for domain: %s\n", domain);
-        return SWITCH_STATUS_FALSE;
-    }
+    return SWITCH_FALSE;
+}
 
-    len = strlen(log_data);
+/* Drop a session's cached domain when it hangs up or may have changed its variables;
+   changes made any other way (e.g. uuid_setvar) are picked up when uuid-cache-ttl expires */
+static void session_event_handler(switch_event_t *event)
+{
+    const char *uuid = switch_event_get_header(event, "Unique-ID");
 
-    switch_mutex_lock(entry->file_lock);
+    if (zstr(uuid)) {
+        return;
+    }
 
-    if (!entry->log_file || 
-        switch_file_write(entry->log_file, log_data, &len) != SWITCH_STATUS_SUCCESS) {
-        
-        if (entry->log_file) {
-            switch_file_close(entry->log_file);
-            entry->log_file = NULL;
-        }
+    if (event->event_id == SWITCH_EVENT_CHANNEL_EXECUTE_COMPLETE) {
+        const char *app = switch_event_get_header(event, "Application");
 
-        /* Try to reopen and write */
-        if (open_domain_logfile(entry) == SWITCH_STATUS_SUCCESS) {
-            len = strlen(log_data);
-            switch_file_write(entry->log_file, log_data, &len);
-        } else {
-            status = SWITCH_STATUS_FALSE;
+        if (zstr(app) || !sets_channel_variables(app)) {
+            return;
         }
     }
 
-    if (status == SWITCH_STATUS_SUCCESS) {
-        entry->log_size += len;
-    }
+    uuid_cache_invalidate(uuid);
+}
 
-    switch_mutex_unlock(entry->file_lock);
+/* Parse the config again and apply it; unchanged defaults are reapplied too */
+static void reload_config(void)
+{
+    logfile_domain_settings_t settings;
 
-    return status;
-}
+    if (parse_config(&settings) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "mod_logfile_domain: Keeping current settings\n");
+        level_map_destroy(settings.level_map);
+        rate_limit_map_destroy(settings.rate_limits);
+        return;
+    }
 
-/* Main logging callback */
+    logfile_domain_reload(&settings);
+}
 
-static switch_status_t mod_logfile_domain_logger(const switch_log_node_t *node, switch_log_level_t level)
+/* HUP rotates or reopens every domain file, see logfile_domain_hup() */
+static void event_handler(switch_event_t *event)
 {
-    switch_core_session_t *session = NULL;
-    switch_channel_t *channel = NULL;
-    const char *domain = NULL;
-    char log_line[2048];
-    switch_time_t now = switch_time_now();
-    switch_time_exp_t tm;
-    char date[80] = "";
-    size_t retsize;
+    const char *sig = switch_event_get_header(event, "Trapped-Signal");
 
-    if (!node) {
-        return SWITCH_STATUS_SUCCESS;
+    if (sig && !strcmp(sig, "HUP")) {
+        logfile_domain_hup();
     }
+}
 
-    /* Render message into buffer instead of accessing struct fields that may change */
-    char rendered_msg[1024] = "";
-    if (switch_log_node_render_ptr) {
-        if (switch_log_node_render_ptr(node, rendered_msg, sizeof(rendered_msg)) != SWITCH_STATUS_SUCCESS) {
-            rendered_msg[0] = '\0';
-        }
-    }
+/* reloadxml: re-read logfile_domain.conf without dropping any lines */
+static void reload_event_handler(switch_event_t *event)
+{
+    reload_config();
+}
 
-    /* Skip internal module logs to prevent recursion */
-    if (node->file && strstr(node->file, "mod_logfile_domain")) {
+/* API: logfile_domain <command> */
+SWITCH_STANDARD_API(logfile_domain_api_function)
+{
+    if (zstr(cmd)) {
+        stream->write_function(stream, "-USAGE: %s\n", LOGFILE_DOMAIN_SYNTAX);
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Try to get session and extract domain */
-    if (node->userdata) {
-        session = (switch_core_session_t *)node->userdata;
-        channel = switch_core_session_get_channel(session);
-        
-        if (channel) {
-            domain = extract_domain(channel);
-        }
-    }
-
-    /* Fallback: if no session/domain, try to parse rendered message for domain_name= or domain= */
-    if (zstr(domain) && rendered_msg[0]) {
-        const char *f = extract_domain_from_msg(rendered_msg);
-        if (f) {
-            domain = f;
+    if (!strcasecmp(cmd, "queue")) {
+        logfile_domain_queue_report(stream);
+    } else if (!strcasecmp(cmd, "stats")) {
+        logfile_domain_stats_report(stream);
+    } else if (!strcasecmp(cmd, "status") || !strcasecmp(cmd, "status json")) {
+        logfile_domain_status(stream, !strcasecmp(cmd, "status json") ? SWITCH_TRUE : SWITCH_FALSE);
+    } else if (!strncasecmp(cmd, "latency", 7) && (!cmd[7] || cmd[7] == ' ')) {
+        const char *arg = cmd + 7;
+
+        while (*arg == ' ') {
+            arg++;
         }
-    }
-
-    /* If we have a domain, write to domain-specific log */
-    if (!zstr(domain)) {
-        switch_time_exp_lt(&tm, now);
-        switch_strftime_nocheck(date, &retsize, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
-
-        if (channel) {
-            const char *uuid = switch_channel_get_uuid(channel);
-            switch_snprintf(log_line, sizeof(log_line), 
-                           "%s [%s] [%s:%s:%d] %s [%s]\n",
-                           date, 
-                           switch_log_level2str(level), 
-                           node->file ? node->file : "unknown",
-                           node->func ? node->func : "unknown",
-                           node->line, 
-                           rendered_msg[0] ? rendered_msg : "(message)", 
-                           uuid ? uuid : "unknown");
+        if (!*arg) {
+            latency_dump(stream);
+        } else if (!strcasecmp(arg, "on") || !strcasecmp(arg, "off")) {
+            latency_enable(!strcasecmp(arg, "on") ? SWITCH_TRUE : SWITCH_FALSE);
+            stream->write_function(stream, "+OK\n");
+        } else if (!strcasecmp(arg, "reset")) {
+            latency_reset();
+            stream->write_function(stream, "+OK\n");
         } else {
-            switch_snprintf(log_line, sizeof(log_line),
-                           "%s [%s] [%s:%s:%d] %s\n",
-                           date,
-                           switch_log_level2str(level),
-                           node->file ? node->file : "unknown",
-                           node->func ? node->func : "unknown",
-                           node->line,
-                           rendered_msg[0] ? rendered_msg : "(message)");
+            stream->write_function(stream, "-USAGE: %s\n", LOGFILE_DOMAIN_SYNTAX);
         }
-
-        write_domain_log(domain, log_line);
+    } else if (!strcasecmp(cmd, "sync")) {
+        logfile_domain_sync_report(stream);
+    } else if (!strcasecmp(cmd, "reload")) {
+        reload_config();
+        stream->write_function(stream, "+OK\n");
+    } else {
+        stream->write_function(stream, "-USAGE: %s\n", LOGFILE_DOMAIN_SYNTAX);
     }
 
     return SWITCH_STATUS_SUCCESS;
 }
 
-/* Close all domain log files */
-static void close_all_domain_logs(void)
-{
-    switch_hash_index_t *hi;
-    void *val;
-    const void *var;
-    domain_cache_entry_t *entry;
-
-    switch_mutex_lock(globals.mutex);
-
-    for (hi = switch_core_hash_first(domain_hash); hi; hi = switch_core_hash_next(&hi)) {
-        switch_core_hash_this(hi, &var, NULL, &val);
-        entry = (domain_cache_entry_t *)val;
-        
-        if (entry && entry->file_lock) {
-            switch_mutex_lock(entry->file_lock);
-            if (entry->log_file) {
-                switch_file_close(entry->log_file);
-                entry->log_file = NULL;
-            }
-            switch_mutex_unlock(entry->file_lock);
-        }
-    }
-
-    switch_mutex_unlock(globals.mutex);
-}
-
 /* Module load function */
 SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load)
 {
-    module_pool = pool;
+    switch_api_interface_t *api_interface;
+    logfile_domain_settings_t settings;
 
-    memset(&globals, 0, sizeof(globals));
-    switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, module_pool);
+    memset(&module, 0, sizeof(module));
 
-    if (domain_hash) {
-        switch_core_hash_destroy(&domain_hash);
-    }
-    switch_core_hash_init(&domain_hash);
+    /* Without a readable config the defaults are used */
+    parse_config(&settings);
+    logfile_domain_start(pool, &freeswitch_host, &settings);
 
     /* Create module interface */
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
+    SWITCH_ADD_API(api_interface, "logfile_domain", "Domain logger control", logfile_domain_api_function, LOGFILE_DOMAIN_SYNTAX);
 
-    /* Try to resolve optional render API at runtime to remain compatible with older FS builds */
-    switch_log_node_render_ptr = (switch_log_node_render_fn)dlsym(RTLD_DEFAULT, "switch_log_node_render");
-    if (switch_log_node_render_ptr) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "mod_logfile_domain: runtime resolved switch_log_node_render\n");
-    } else {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "mod_logfile_domain: switch_log_node_render not available; using fallback\n");
+    if (switch_event_bind_removable(modname, SWITCH_EVENT_TRAP, SWITCH_EVENT_SUBCLASS_ANY, event_handler, NULL, &module.trap_node) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mod_logfile_domain: Couldn't bind HUP handler\n");
+    }
+
+    if (globals.uuid_cache &&
+        (switch_event_bind_removable(modname, SWITCH_EVENT_CHANNEL_DESTROY, NULL, session_event_handler, NULL, &module.destroy_node) != SWITCH_STATUS_SUCCESS ||
+         switch_event_bind_removable(modname, SWITCH_EVENT_CHANNEL_EXECUTE_COMPLETE, NULL, session_event_handler, NULL, &module.execute_node) != SWITCH_STATUS_SUCCESS)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mod_logfile_domain: Couldn't bind channel events, disabling the uuid cache\n");
+        switch_event_unbind(&module.destroy_node);
+        globals.uuid_cache = NULL;
+    }
+
+    if (switch_event_bind_removable(modname, SWITCH_EVENT_RELOADXML, NULL, reload_event_handler, NULL, &module.reload_node) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mod_logfile_domain: Couldn't bind reloadxml handler\n");
     }
 
     /* Register logging hook */
-    switch_log_bind_logger(mod_logfile_domain_logger, SWITCH_LOG_DEBUG, SWITCH_TRUE);
+    switch_log_bind_logger(logfile_domain_log, SWITCH_LOG_DEBUG, SWITCH_TRUE);
 
     /* One-time diagnostic: write a small verification file to the freeswitch log directory
        to make it easy to confirm the module has write permission and can create files. */
@@ -402,7 +597,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load)
         switch_file_t *diag = NULL;
         unsigned int flags = SWITCH_FOPEN_CREATE | SWITCH_FOPEN_WRITE | SWITCH_FOPEN_TRUNCATE;
         switch_snprintf(diag_path, sizeof(diag_path), "%s%sswitch_mod_logfile_domain_loaded", SWITCH_GLOBAL_dirs.log_dir, SWITCH_PATH_SEPARATOR);
-        if (switch_file_open(&diag, diag_path, flags, SWITCH_FPROT_OS_DEFAULT, module_pool) == SWITCH_STATUS_SUCCESS) {
+        if (switch_file_open(&diag, diag_path, flags, SWITCH_FPROT_OS_DEFAULT, pool) == SWITCH_STATUS_SUCCESS) {
             const char *msg = "mod_logfile_domain loaded\n";
             switch_size_t wrote = (switch_size_t)strlen(msg);
             switch_file_write(diag, msg, &wrote);
@@ -422,17 +617,17 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_logfile_domain_load)
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_logfile_domain_shutdown)
 {
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
-                    "mod_logfile_domain: Shutting down - %d domains cached\n", 
-                    globals.cache_entries);
+                    "mod_logfile_domain: Shutting down - %d domains cached, %" PRIu64 " lines dropped\n", 
+                    globals.cache_entries, __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED));
 
     /* Unbind logging */
-    switch_log_unbind_logger(mod_logfile_domain_logger);
-
-    /* Close all open files */
-    close_all_domain_logs();
+    switch_log_unbind_logger(logfile_domain_log);
+    switch_event_unbind(&module.trap_node);
+    switch_event_unbind(&module.reload_node);
+    switch_event_unbind(&module.destroy_node);
+    switch_event_unbind(&module.execute_node);
 
-    /* Destroy hash */
-    switch_core_hash_destroy(&domain_hash);
+    logfile_domain_stop();
 
     return SWITCH_STATUS_SUCCESS;
 }
@@ -0,0 +1,775 @@
+/*
+ * test_core.c -- Unit tests for the logging core
+ *
+ * Covers the pieces behind logfile_domain.h one at a time: level map, domain
+ * extraction (including keys that straddle the SIMD scan width), date prefix,
+ * the lock-free domain table, session lookup through the host and its uuid
+ * cache, retirement at max-domains, synchronous and queued writes, size and HUP rotation, reopen after an
+ * external rename, per-domain rate limits, and the report commands.
+ *
+ * Usage: test_core
+ *
+ */
+
+#include "test_util.h"
+
+#include <time.h>
+
+/* Lines of one domain's files, oldest first */
+typedef struct {
+    const char *domain;
+    char lines[64][512];
+    int count;
+} collect_t;
+
+static void collect_line(const char *domain, const char *line, void *arg)
+{
+    collect_t *c = (collect_t *)arg;
+
+    if (!strcmp(domain, c->domain) && c->count < 64) {
+        switch_copy_string(c->lines[c->count++], line, sizeof(c->lines[0]));
+    }
+}
+
+static int collect(const char *dir, const char *domain, collect_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->domain = domain;
+    test_read_lines(dir, collect_line, c);
+
+    return c->count;
+}
+
+static int file_exists(const char *dir, const char *name)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    return access(path, F_OK) == 0;
+}
+
+static void test_level_map(void)
+{
+    level_map_t *map = level_map_create();
+    const level_map_source_t *src;
+
+    CHECK_EQ(level_floor_mask(SWITCH_LOG_CONSOLE), 1);
+    CHECK_EQ(level_floor_mask(SWITCH_LOG_ERROR), (1U << (SWITCH_LOG_ERROR + 1)) - 1);
+    CHECK_EQ(level_floor_mask((switch_log_level_t)31), 0xFFFFFFFFU);
+
+    level_map_add(map, "all", 1U << SWITCH_LOG_ERROR, NULL);
+    level_map_add(map, "all", 1U << SWITCH_LOG_DEBUG, "false");
+    level_map_add(map, "sofia.c", (1U << SWITCH_LOG_INFO) | (1U << SWITCH_LOG_DEBUG), NULL);
+    level_map_add(map, "mod_dptools.c", 1U << SWITCH_LOG_NOTICE, "true");
+    level_map_finish(map, SWITCH_LOG_INFO);
+
+    src = level_map_lookup(map, "switch_core.c");
+    CHECK(src == &map->all);
+    CHECK_EQ(src->mask, 1U << SWITCH_LOG_ERROR);
+    CHECK_EQ(src->fallback, SWITCH_FALSE);
+
+    /* log-level cuts debug from the file map, which inherits the fallback from "all" */
+    src = level_map_lookup(map, "sofia.c");
+    CHECK(src != &map->all);
+    CHECK_EQ(src->mask, 1U << SWITCH_LOG_INFO);
+    CHECK_EQ(src->fallback, SWITCH_FALSE);
+
+    src = level_map_lookup(map, "mod_dptools.c");
+    CHECK_EQ(src->mask, 1U << SWITCH_LOG_NOTICE);
+    CHECK_EQ(src->fallback, SWITCH_TRUE);
+
+    CHECK(level_map_lookup(map, NULL) == &map->all);
+
+    level_map_destroy(map);
+}
+
+static void check_extract(const char *msg, const char *expect)
+{
+    switch_size_t len = 0;
+    const char *d = extract_domain_from_msg(msg, strlen(msg), &len);
+
+    if (!expect) {
+        CHECK(d == NULL);
+    } else if (!d) {
+        fprintf(stderr, "no domain in \"%s\", expected %s\n", msg, expect);
+        test_failures++;
+    } else if (len != strlen(expect) || memcmp(d, expect, len)) {
+        fprintf(stderr, "domain \"%.*s\" in \"%s\", expected %s\n", (int)len, d, msg, expect);
+        test_failures++;
+    }
+}
+
+static void test_extract(void)
+{
+    char msg[256];
+    int pad;
+
+    check_extract("", NULL);
+    check_extract("no key here", NULL);
+    check_extract("domain=a.example.com", "a.example.com");
+    check_extract("x domain=a.example.com rest", "a.example.com");
+    check_extract("domain=a.example.com domain_name=b.example.com", "b.example.com");
+    check_extract("domain_name=b.example.com domain=a.example.com", "b.example.com");
+    check_extract("domain=", NULL);
+    check_extract("domain= x", NULL);
+    check_extract("domainx=a.example.com", NULL);
+    check_extract("domain_nam=a.example.com", NULL);
+    check_extract("ddddomain=a.example.com", "a.example.com");
+    check_extract("domain=a.example.com\tafter", "a.example.com");
+
+    /* Keys at every offset across two SIMD blocks, and cut off at the end of the buffer */
+    for (pad = 0; pad < 80; pad++) {
+        snprintf(msg, sizeof(msg), "%*sdomain_name=p%d.example.com", pad, "", pad);
+        {
+            char expect[32];
+
+            snprintf(expect, sizeof(expect), "p%d.example.com", pad);
+            check_extract(msg, expect);
+        }
+        snprintf(msg, sizeof(msg), "%*sdomain", pad, "");
+        check_extract(msg, NULL);
+        snprintf(msg, sizeof(msg), "%*sdomain_name", pad, "");
+        check_extract(msg, NULL);
+    }
+
+    /* Only len bytes are looked at */
+    {
+        switch_size_t len = 0;
+        const char *m = "domain=a.example.com domain_name=b.example.com";
+
+        CHECK(extract_domain_from_msg(m, 20, &len) == m + 7);
+        CHECK_EQ(len, 13);
+        CHECK(extract_domain_from_msg(m, 6, &len) == NULL);
+    }
+}
+
+static void test_format_date(void)
+{
+    char buf[40], expect[32];
+    switch_time_t now = switch_micro_time_now();
+    time_t sec = (time_t)(now / 1000000);
+    struct tm tm;
+
+    localtime_r(&sec, &tm);
+    strftime(expect, sizeof(expect), "%Y-%m-%d %H:%M:%S", &tm);
+
+    globals.log_usec = SWITCH_FALSE;
+    CHECK_EQ(format_log_date(now, buf), 19);
+    CHECK(!strcmp(buf, expect));
+
+    /* Cached for the second, microseconds appended */
+    globals.log_usec = SWITCH_TRUE;
+    CHECK_EQ(format_log_date(sec * 1000000 + 42, buf), 26);
+    CHECK(!strncmp(buf, expect, 19));
+    CHECK(!strcmp(buf + 19, ".000042"));
+    globals.log_usec = SWITCH_FALSE;
+}
+
+static void test_domain_table(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64], name[64];
+    domain_cache_entry_t *a, *b, *e;
+    int i, missing = 0;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    test_start(&s);
+
+    /* The name need not be NUL-terminated */
+    a = get_domain_entry("a.example.com;junk", 13);
+    b = get_domain_entry("a.example.com", 13);
+    CHECK(a != NULL);
+    CHECK(a == b);
+    CHECK(!strcmp(a->domain->str, "a.example.com"));
+    /* Lookups come back held */
+    CHECK_EQ(a->refs, 2);
+    e = get_domain_entry("b.example.com", 13);
+    CHECK(e != NULL && e != a);
+    domain_entry_release(e);
+    domain_entry_release(b);
+    domain_entry_release(a);
+    CHECK_EQ(a->refs, 0);
+    CHECK(get_domain_entry("", 0) == NULL);
+    CHECK_EQ(globals.cache_entries, 2);
+
+    /* Past several table resizes everything is still found, lock-free and by name */
+    for (i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "t%d.example.com", i);
+        e = get_domain_entry(name, strlen(name));
+        CHECK(e != NULL);
+        if (e) {
+            domain_entry_release(e);
+        }
+    }
+    for (i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "t%d.example.com", i);
+        e = domain_table_find(globals.domain_table, name, strlen(name), domain_hash_func(name, strlen(name)));
+        if (!e || strcmp(e->domain->str, name)) {
+            missing++;
+        }
+        if (e) {
+            domain_entry_release(e);
+        }
+    }
+    CHECK_EQ(missing, 0);
+    CHECK_EQ(globals.cache_entries, 5002);
+    CHECK(domain_table_find(globals.domain_table, "nope", 4, domain_hash_func("nope", 4)) == NULL);
+
+    test_stop();
+    test_rmdir(dir);
+}
+
+static void test_sync_write(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64];
+    collect_t c;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.buffer_size = 0;
+    level_map_add(s.level_map, "quiet.c", 1U << SWITCH_LOG_ERROR, "false");
+    test_start(&s);
+
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "first domain=s.example.com\n");
+    test_log("switch_core.c", SWITCH_LOG_ERROR, NULL, "second domain_name=s.example.com");
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "no domain at all");
+    test_log("quiet.c", SWITCH_LOG_INFO, NULL, "unmapped level domain=s.example.com");
+    test_log("quiet.c", SWITCH_LOG_ERROR, NULL, "no fallback for quiet.c domain=s.example.com");
+    test_log("logfile_domain_sink.c", SWITCH_LOG_ERROR, NULL, "own line domain=s.example.com");
+
+    /* Unbuffered synchronous writes are on disk right away */
+    CHECK_EQ(collect(dir, "s.example.com", &c), 2);
+    CHECK(strstr(c.lines[0], " [INFO] [switch_core.c:test_fn:42] first domain=s.example.com\n") != NULL);
+    CHECK(strstr(c.lines[1], " [ERR] [switch_core.c:test_fn:42] second domain_name=s.example.com\n") != NULL);
+    CHECK(c.lines[0][4] == '-' && c.lines[0][19] == ' ');
+    CHECK_EQ(globals.renders_avoided, 1);
+
+    test_stop();
+    test_rmdir(dir);
+}
+
+static void test_evict_sync(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64];
+    collect_t c;
+    int i;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.buffer_size = 0;
+    s.max_open_files = 1;
+    s.durability = DURABILITY_BYTES;
+    s.sync_bytes = 1 << 30;
+    test_start(&s);
+
+    /* Opening y evicts x on this thread; its sync is left to the sync thread */
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "one domain=x.example.com");
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "two domain=y.example.com");
+    CHECK_EQ(globals.evictions, 1);
+    for (i = 0; i < 100 && !__atomic_load_n(&globals.syncs, __ATOMIC_RELAXED); i++) {
+        switch_yield(10000);
+    }
+    CHECK_EQ(__atomic_load_n(&globals.syncs, __ATOMIC_RELAXED), 1);
+
+    test_stop();
+
+    CHECK_EQ(globals.syncs, 2);
+    CHECK_EQ(collect(dir, "x.example.com", &c), 1);
+    test_rmdir(dir);
+}
+
+static void test_session_lookup(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64];
+    collect_t c;
+    int calls;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_session_count = 0;
+    test_session_add("uuid-1", "one.example.com");
+    test_session_add("uuid-2", "");
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    s.writer_threads = 2;
+    test_start(&s);
+
+    calls = test_host_calls;
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-1", "hello");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-1", "again domain=other.example.com");
+    CHECK_EQ(test_host_calls - calls, 1);
+    CHECK_EQ(globals.uuid_cache_hits, 1);
+
+    /* A session without a domain and an unknown one both fall back to the message */
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-2", "from two domain=other.example.com");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-gone", "gone domain=other.example.com");
+
+    /* After the adapter invalidates the uuid the host is asked again */
+    switch_copy_string(test_sessions[0].domain, "moved.example.com", sizeof(test_sessions[0].domain));
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-1", "still cached");
+    uuid_cache_invalidate("uuid-1");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-1", "moved");
+
+    test_stop();
+
+    CHECK_EQ(collect(dir, "one.example.com", &c), 3);
+    CHECK(strstr(c.lines[0], "] hello [uuid-1]\n") != NULL);
+    CHECK(strstr(c.lines[1], "] again domain=other.example.com [uuid-1]\n") != NULL);
+    CHECK(strstr(c.lines[2], "] still cached [uuid-1]\n") != NULL);
+    CHECK_EQ(collect(dir, "other.example.com", &c), 2);
+    CHECK(strstr(c.lines[0], "] from two domain=other.example.com [uuid-2]\n") != NULL);
+    CHECK(strstr(c.lines[1], "] gone domain=other.example.com\n") != NULL);
+    CHECK_EQ(collect(dir, "moved.example.com", &c), 1);
+
+    test_rmdir(dir);
+}
+
+static void test_session_domain_late(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64];
+    collect_t c;
+    int calls;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_session_count = 0;
+    test_session_add("uuid-late", "");
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    test_start(&s);
+
+    /* A session without a domain yet is asked again on every line, not cached as such */
+    calls = test_host_calls;
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-late", "before auth");
+    switch_copy_string(test_sessions[0].domain, "late.example.com", sizeof(test_sessions[0].domain));
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-late", "after auth");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-late", "cached now");
+    CHECK_EQ(test_host_calls - calls, 2);
+
+    test_stop();
+
+    CHECK_EQ(collect(dir, "late.example.com", &c), 2);
+    CHECK(strstr(c.lines[0], "] after auth [uuid-late]\n") != NULL);
+    CHECK(strstr(c.lines[1], "] cached now [uuid-late]\n") != NULL);
+
+    test_rmdir(dir);
+}
+
+static void test_max_domains(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64], msg[64];
+    collect_t c;
+    uint64_t hits;
+    int calls, i;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_session_count = 0;
+    test_session_add("uuid-a", "a.example.com");
+    test_session_add("uuid-b", "b.example.com");
+    test_settings(&s, dir);
+    s.buffer_size = 0;
+    s.max_domains = 2;
+    test_start(&s);
+
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-a", "first a");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-b", "first b");
+
+    /* New domains push a and b out; their memory goes to later domains once reclaimed */
+    for (i = 0; i < 50 && globals.entries_reclaimed < 2; i++) {
+        snprintf(msg, sizeof(msg), "filler domain=n%d.example.com", i);
+        test_log("switch_core.c", SWITCH_LOG_INFO, NULL, msg);
+    }
+    CHECK(globals.entries_reclaimed >= 2);
+    CHECK_EQ(globals.cache_entries, 2);
+
+    /* The sessions' cached entries went with the retirement; the host is asked again */
+    calls = test_host_calls;
+    hits = globals.uuid_cache_hits;
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-a", "again a");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, "uuid-b", "again b");
+    CHECK_EQ(test_host_calls - calls, 2);
+    CHECK_EQ(globals.uuid_cache_hits, hits);
+
+    test_stop();
+
+    CHECK_EQ(collect(dir, "a.example.com", &c), 2);
+    CHECK(strstr(c.lines[1], "] again a [uuid-a]\n") != NULL);
+    CHECK_EQ(collect(dir, "b.example.com", &c), 2);
+    CHECK(strstr(c.lines[1], "] again b [uuid-b]\n") != NULL);
+    CHECK_EQ(collect(dir, "n0.example.com", &c), 1);
+
+    test_rmdir(dir);
+}
+
+static void test_size_rotation(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64], msg[128];
+    collect_t c;
+    int i, order = 1;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    s.buffer_size = 0;
+    s.roll_size = 256;
+    s.max_rot = 3;
+    test_start(&s);
+
+    /* Lines of about 100 bytes, so every third one or so rolls the file */
+    for (i = 0; i < 40; i++) {
+        snprintf(msg, sizeof(msg), "line %02d domain=r.example.com", i);
+        test_log("switch_core.c", SWITCH_LOG_INFO, NULL, msg);
+        /* Let writer 0 rotate before the next line */
+        switch_yield(2000);
+    }
+
+    test_stop();
+
+    /* Only max-rot generations are kept: the newest lines survive, in order */
+    CHECK(file_exists(dir, "domain_r.example.com.log.1"));
+    CHECK(file_exists(dir, "domain_r.example.com.log.3"));
+    CHECK(!file_exists(dir, "domain_r.example.com.log.4"));
+    CHECK(collect(dir, "r.example.com", &c) > 3);
+    CHECK(strstr(c.lines[c.count - 1], "line 39 ") != NULL);
+    for (i = 1; i < c.count; i++) {
+        order &= atoi(strstr(c.lines[i], "line ") + 5) == atoi(strstr(c.lines[i - 1], "line ") + 5) + 1;
+    }
+    CHECK(order);
+
+    test_rmdir(dir);
+}
+
+static void test_hup(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64], from[512], to[512];
+    collect_t c;
+
+    /* rotate-on-hup: every domain file moves to .1 */
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    test_start(&s);
+
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "before domain=h.example.com");
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "before domain=i.example.com");
+    switch_yield(20000);
+    logfile_domain_hup();
+    switch_yield(20000);
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "after domain=h.example.com");
+
+    test_stop();
+
+    CHECK(file_exists(dir, "domain_h.example.com.log.1"));
+    CHECK(file_exists(dir, "domain_i.example.com.log.1"));
+    CHECK_EQ(collect(dir, "h.example.com", &c), 2);
+    CHECK(strstr(c.lines[0], "] before ") != NULL);
+    CHECK(strstr(c.lines[1], "] after ") != NULL);
+    test_rmdir(dir);
+
+    /* rotate-on-hup off: an external rename is followed by a fresh file */
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.rotate_on_hup = SWITCH_FALSE;
+    s.buffer_size = 0;
+    test_start(&s);
+
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "before domain=h.example.com");
+    snprintf(from, sizeof(from), "%s/domain_h.example.com.log", dir);
+    snprintf(to, sizeof(to), "%s/domain_h.example.com.log.old", dir);
+    CHECK(rename(from, to) == 0);
+    logfile_domain_hup();
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "after domain=h.example.com");
+
+    test_stop();
+
+    CHECK(file_exists(dir, "domain_h.example.com.log"));
+    CHECK(!file_exists(dir, "domain_h.example.com.log.1"));
+    CHECK_EQ(collect(dir, "h.example.com", &c), 2);
+    test_rmdir(dir);
+}
+
+static void test_reload(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64], dir2[64];
+    collect_t c;
+    int n;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_mkdtemp(dir2, sizeof(dir2));
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    test_start(&s);
+
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "old dir domain=m.example.com");
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, NULL, "debug before domain=m.example.com");
+
+    /* New log-dir and log-level apply without losing queued lines */
+    test_settings(&s, dir2);
+    s.async_write = SWITCH_TRUE;
+    s.log_level = SWITCH_LOG_INFO;
+    test_settings_finish(&s);
+    logfile_domain_reload(&s);
+    /* The writer relocates between batches; give it the chance before the next line */
+    switch_yield(20000);
+
+    test_log("switch_core.c", SWITCH_LOG_DEBUG, NULL, "debug after domain=m.example.com");
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "new dir domain=m.example.com");
+
+    test_stop();
+
+    n = collect(dir, "m.example.com", &c);
+    n += collect(dir2, "m.example.com", &c);
+    CHECK_EQ(n, 3);
+    CHECK(c.count > 0 && strstr(c.lines[c.count - 1], "] new dir ") != NULL);
+    test_rmdir(dir);
+    test_rmdir(dir2);
+}
+
+static pthread_barrier_t reload_barrier;
+
+static void *reload_thread(void *obj)
+{
+    const char *dir = (const char *)obj;
+    logfile_domain_settings_t s;
+    int i;
+
+    pthread_barrier_wait(&reload_barrier);
+    for (i = 0; i < 20; i++) {
+        test_settings(&s, dir);
+        s.compress = COMPRESS_GZIP;
+        s.compress_threads = 2;
+        s.sink_ops = domain_sink_ops_find("io_uring");
+        if (!s.sink_ops) {
+            s.sink_ops = domain_sink_ops_find("file");
+        }
+        test_settings_finish(&s);
+        logfile_domain_reload(&s);
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_reload(void)
+{
+    logfile_domain_settings_t s;
+    pthread_t tids[4];
+    char dir[64];
+    int i;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    test_start(&s);
+
+    /* reloadxml and the API command racing: one ring and one set of compress threads */
+    pthread_barrier_init(&reload_barrier, NULL, 4);
+    for (i = 0; i < 4; i++) {
+        pthread_create(&tids[i], NULL, reload_thread, dir);
+    }
+    for (i = 0; i < 4; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&reload_barrier);
+    CHECK_EQ(globals.compress_thread_count, 2);
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "after domain=c.example.com");
+
+    test_stop();
+
+    CHECK(file_exists(dir, "domain_c.example.com.log"));
+    test_rmdir(dir);
+}
+
+/* n lines naming domain, all logged at t */
+static void log_burst(const char *domain, int n, switch_time_t t)
+{
+    char msg[128];
+    int i;
+
+    for (i = 0; i < n; i++) {
+        snprintf(msg, sizeof(msg), "burst %d domain=%s", i, domain);
+        test_log_at("switch_core.c", SWITCH_LOG_INFO, NULL, msg, t);
+    }
+}
+
+static int count_matching(const collect_t *c, const char *needle)
+{
+    int i, n = 0;
+
+    for (i = 0; i < c->count; i++) {
+        n += strstr(c->lines[i], needle) != NULL;
+    }
+
+    return n;
+}
+
+static void test_rate_limit(void)
+{
+    logfile_domain_settings_t s;
+    rate_limit_map_t *map = rate_limit_map_create();
+    const rate_limit_t *limit;
+    test_stream_t ts;
+    char dir[64];
+    collect_t c;
+    switch_time_t t0 = switch_micro_time_now();
+
+    /* Overrides take what they leave out from the global setting, a burst of 0 is one second */
+    map->all.rate = 10;
+    rate_limit_map_add(map, "o.example.com", 0, -1);
+    rate_limit_map_add(map, "b.example.com", -1, 3);
+    rate_limit_map_finish(map);
+    CHECK_EQ(map->all.burst, 10);
+    limit = rate_limit_lookup(map, "o.example.com");
+    CHECK_EQ(limit->rate, 0);
+    limit = rate_limit_lookup(map, "b.example.com");
+    CHECK_EQ(limit->rate, 10);
+    CHECK_EQ(limit->burst, 3);
+    CHECK(rate_limit_lookup(map, "x.example.com") == &map->all);
+    rate_limit_map_destroy(map);
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.rate_limits->all.rate = 10;
+    rate_limit_map_add(s.rate_limits, "o.example.com", 0, -1);
+    rate_limit_map_add(s.rate_limits, "b.example.com", -1, 3);
+    test_start(&s);
+
+    /* A burst at one instant gets the bucket's worth through, the next line a second later
+       is preceded by the count of the rest */
+    log_burst("r.example.com", 25, t0);
+    log_burst("o.example.com", 25, t0);
+    log_burst("b.example.com", 25, t0);
+    test_log_at("switch_core.c", SWITCH_LOG_INFO, NULL, "later domain=r.example.com", t0 + 1000000);
+
+    test_stream_init(&ts);
+    logfile_domain_status(&ts.stream, SWITCH_TRUE);
+    CHECK(strstr(ts.data, "\"suppressed\":15,") != NULL);
+    CHECK(strstr(ts.data, "\"suppressed\":22,") != NULL);
+    test_stream_init(&ts);
+    logfile_domain_stats_report(&ts.stream);
+    CHECK(strstr(ts.data, "rate-limited: 37\n") != NULL);
+
+    /* A reload lifting the global limit applies to existing domains */
+    test_settings(&s, dir);
+    test_settings_finish(&s);
+    logfile_domain_reload(&s);
+    log_burst("r.example.com", 20, t0 + 2000000);
+
+    test_stop();
+
+    CHECK_EQ(collect(dir, "r.example.com", &c), 10 + 2 + 20);
+    CHECK_EQ(count_matching(&c, "] 15 lines suppressed by rate-limit"), 1);
+    CHECK(strstr(c.lines[10], "lines suppressed") != NULL);
+    CHECK(strstr(c.lines[11], "] later ") != NULL);
+    CHECK_EQ(collect(dir, "o.example.com", &c), 25);
+    CHECK_EQ(collect(dir, "b.example.com", &c), 3);
+    test_rmdir(dir);
+}
+
+static void test_rate_limit_quiet(void)
+{
+    logfile_domain_settings_t s;
+    char dir[64];
+    collect_t c;
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    s.writer_threads = 2;
+    s.rate_limits->all.rate = 10;
+    test_start(&s);
+
+    /* The storm stops and no line follows to carry the summary; writer 0 writes it */
+    log_burst("q.example.com", 25, switch_micro_time_now());
+    switch_yield(STATS_SAMPLE_INTERVAL + 500000);
+
+    test_stop();
+
+    CHECK_EQ(collect(dir, "q.example.com", &c), 10 + 1);
+    CHECK(strstr(c.lines[10], "] 15 lines suppressed by rate-limit") != NULL);
+    test_rmdir(dir);
+}
+
+static void test_reports(void)
+{
+    logfile_domain_settings_t s;
+    test_stream_t ts;
+    char dir[64];
+
+    test_mkdtemp(dir, sizeof(dir));
+    test_settings(&s, dir);
+    s.async_write = SWITCH_TRUE;
+    s.writer_threads = 2;
+    test_start(&s);
+
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "x domain=q.example.com");
+
+    test_stream_init(&ts);
+    logfile_domain_queue_report(&ts.stream);
+    CHECK(strstr(ts.data, "writers: 2\n") != NULL);
+    CHECK(strstr(ts.data, "policy: drop\n") != NULL);
+
+    test_stream_init(&ts);
+    logfile_domain_stats_report(&ts.stream);
+    CHECK(strstr(ts.data, "domains: 1\n") != NULL);
+
+    test_stream_init(&ts);
+    logfile_domain_status(&ts.stream, SWITCH_TRUE);
+    CHECK(ts.data[0] == '{');
+    CHECK(strstr(ts.data, "\"q.example.com\"") != NULL);
+
+    test_stream_init(&ts);
+    logfile_domain_sync_report(&ts.stream);
+    CHECK(strstr(ts.data, "durability: none\n") != NULL);
+
+    latency_enable(SWITCH_TRUE);
+    test_log("switch_core.c", SWITCH_LOG_INFO, NULL, "y domain=q.example.com");
+    test_stream_init(&ts);
+    latency_dump(&ts.stream);
+    CHECK(strstr(ts.data, "resolve") != NULL);
+
+    test_stop();
+    test_rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[64];
+
+    /* The stub logs warnings somewhere; keep it out of the log-dir under test */
+    test_mkdtemp(dir, sizeof(dir));
+    SWITCH_GLOBAL_dirs.log_dir = dir;
+
+    RUN_TEST(test_level_map);
+    RUN_TEST(test_extract);
+    RUN_TEST(test_format_date);
+    RUN_TEST(test_domain_table);
+    RUN_TEST(test_sync_write);
+    RUN_TEST(test_evict_sync);
+    RUN_TEST(test_session_lookup);
+    RUN_TEST(test_session_domain_late);
+    RUN_TEST(test_max_domains);
+    RUN_TEST(test_size_rotation);
+    RUN_TEST(test_hup);
+    RUN_TEST(test_reload);
+    RUN_TEST(test_concurrent_reload);
+    RUN_TEST(test_rate_limit);
+    RUN_TEST(test_rate_limit_quiet);
+    RUN_TEST(test_reports);
+
+    test_rmdir(dir);
+
+    if (test_failures) {
+        printf("%d check(s) failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
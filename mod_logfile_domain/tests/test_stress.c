@@ -0,0 +1,300 @@
+/*
+ * test_stress.c -- Concurrent logging, domain creation, rotation, HUP and reload
+ *
+ * Several threads log numbered lines to a set of domains, some through sessions
+ * the host resolves and some named only in the message, while a control thread
+ * sends HUPs and reloads and small roll sizes keep rotating the files. Before
+ * logging, all threads race to create the same domains. Afterwards every file
+ * generation is read back and each line must be there exactly once, in its own
+ * domain's file, and in order per thread within that domain.
+ *
+ * Meant to run under -fsanitize=thread as well as address; see tests/Makefile.
+ *
+ * Usage: test_stress [-t threads] [-n lines_per_thread] [-d domains] [-c config]
+ *        config is one of sync, async, multi, evict, gzip, mmap, uring (default: all)
+ *
+ */
+
+#include "test_util.h"
+
+#define RACE_DOMAINS 64
+#define MAX_THREADS 64
+#define MAX_HUPS 16
+
+typedef struct {
+    const char *name;
+    switch_bool_t async_write;
+    uint32_t writer_threads;
+    uint32_t rebalance_depth;
+    switch_size_t buffer_size;
+    switch_bool_t rotate_on_hup;
+    int max_open_files;
+    compress_t compress;
+    compress_t compress_active;
+    const char *sink;
+} stress_config_t;
+
+static const stress_config_t configs[] = {
+    /* name    async         writers rebalance buffer rotate-on-hup  files compress       compress-active sink */
+    { "sync",  SWITCH_FALSE, 1,      0,        4096,  SWITCH_TRUE,   256,  COMPRESS_NONE, COMPRESS_NONE,  "file" },
+    { "async", SWITCH_TRUE,  1,      0,        65536, SWITCH_TRUE,   256,  COMPRESS_NONE, COMPRESS_NONE,  "file" },
+    { "multi", SWITCH_TRUE,  4,      64,       8192,  SWITCH_TRUE,   256,  COMPRESS_NONE, COMPRESS_NONE,  "file" },
+    { "evict", SWITCH_TRUE,  4,      0,        0,     SWITCH_FALSE,  4,    COMPRESS_NONE, COMPRESS_NONE,  "file" },
+    { "gzip",  SWITCH_TRUE,  2,      0,        65536, SWITCH_TRUE,   256,  COMPRESS_GZIP, COMPRESS_GZIP,  "file" },
+    { "mmap",  SWITCH_TRUE,  2,      0,        65536, SWITCH_TRUE,   256,  COMPRESS_NONE, COMPRESS_NONE,  "mmap" },
+#ifdef LOGFILE_DOMAIN_IO_URING
+    { "uring", SWITCH_TRUE,  2,      0,        65536, SWITCH_TRUE,   256,  COMPRESS_NONE, COMPRESS_NONE,  "io_uring" },
+#endif
+};
+
+static int threads = 8;
+static int lines = 4000;
+static int domains = 24;
+static char dir[64];
+
+static pthread_barrier_t barrier;
+static domain_cache_entry_t *race[MAX_THREADS][RACE_DOMAINS];
+static int done = 0;
+
+/* Thread t's line s goes to this domain; even lines through a session */
+static int line_domain(int t, int s)
+{
+    return (t * 7 + s * 13) % domains;
+}
+
+static void make_settings(logfile_domain_settings_t *s, const stress_config_t *c)
+{
+    test_settings(s, dir);
+    s->async_write = c->async_write;
+    s->writer_threads = c->writer_threads;
+    s->rebalance_depth = c->rebalance_depth;
+    s->overflow_policy = QUEUE_OVERFLOW_BLOCK;
+    s->queue_size = 1024;
+    s->buffer_size = c->buffer_size;
+    s->flush_interval = 5;
+    s->rotate_on_hup = c->rotate_on_hup;
+    s->roll_size = 32768;
+    s->max_rot = MAX_ROT;
+    s->max_open_files = c->max_open_files;
+    s->compress = c->compress;
+    s->compress_active = c->compress_active;
+    s->compress_threads = 2;
+    s->sink_ops = domain_sink_ops_find(c->sink);
+    test_settings_finish(s);
+}
+
+static void *stress_thread(void *arg)
+{
+    int t = (int)(intptr_t)arg, s, k;
+    char msg[256], uuid[64];
+
+    /* Everyone creates the same domains at once, each starting somewhere else */
+    pthread_barrier_wait(&barrier);
+    for (k = 0; k < RACE_DOMAINS; k++) {
+        int d = (k + t * 5) % RACE_DOMAINS;
+        char name[64];
+
+        snprintf(name, sizeof(name), "race-%d.example.com", d);
+        race[t][d] = get_domain_entry(name, strlen(name));
+        if (race[t][d]) {
+            domain_entry_release(race[t][d]);
+        }
+    }
+
+    for (s = 0; s < lines; s++) {
+        int d = line_domain(t, s);
+
+        if (s % 2) {
+            snprintf(msg, sizeof(msg), "stress t=%d s=%d domain=d%d.example.com", t, s, d);
+            test_log("switch_core.c", SWITCH_LOG_INFO, NULL, msg);
+        } else {
+            snprintf(uuid, sizeof(uuid), "uuid-%d-%d", d, (s / 2) % 2);
+            snprintf(msg, sizeof(msg), "stress t=%d s=%d", t, s);
+            test_log("switch_core.c", SWITCH_LOG_DEBUG, uuid, msg);
+        }
+    }
+
+    return NULL;
+}
+
+/* HUPs and reloads with unchanged settings while the threads log */
+static void *control_thread(void *arg)
+{
+    const stress_config_t *c = (const stress_config_t *)arg;
+    int hups = 0;
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        logfile_domain_settings_t s;
+
+        switch_yield(10000);
+        if (hups < MAX_HUPS) {
+            logfile_domain_hup();
+            hups++;
+        }
+        make_settings(&s, c);
+        logfile_domain_reload(&s);
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    unsigned char *seen;
+    int *last;          /* last seq per thread and domain, -1 before the first */
+    int misplaced;
+    int unordered;
+    int duplicated;
+    int foreign;
+} verify_t;
+
+static void verify_line(const char *domain, const char *line, void *arg)
+{
+    verify_t *v = (verify_t *)arg;
+    const char *p = strstr(line, "] stress t=");
+    char expect[64];
+    int t, s, d;
+
+    if (!p || sscanf(p, "] stress t=%d s=%d", &t, &s) != 2 || t < 0 || t >= threads || s < 0 || s >= lines) {
+        v->foreign++;
+        return;
+    }
+
+    d = line_domain(t, s);
+    snprintf(expect, sizeof(expect), "d%d.example.com", d);
+    if (strcmp(domain, expect)) {
+        v->misplaced++;
+    }
+    if (v->seen[t * lines + s]++) {
+        v->duplicated++;
+    }
+    if (v->last[t * domains + d] >= s) {
+        v->unordered++;
+    }
+    v->last[t * domains + d] = s;
+}
+
+static void run_config(const stress_config_t *c)
+{
+    logfile_domain_settings_t s;
+    pthread_t tids[MAX_THREADS], control;
+    verify_t v;
+    switch_time_t start;
+    uint64_t dropped;
+    int i, k, missing = 0, race_ok = 1, total;
+
+    test_mkdtemp(dir, sizeof(dir));
+    make_settings(&s, c);
+    switch_core_new_memory_pool(&test_pool);
+    logfile_domain_start(test_pool, &test_host, &s);
+
+    start = switch_micro_time_now();
+    __atomic_store_n(&done, 0, __ATOMIC_RELEASE);
+    pthread_barrier_init(&barrier, NULL, threads);
+    pthread_create(&control, NULL, control_thread, (void *)c);
+    for (i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, stress_thread, (void *)(intptr_t)i);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    pthread_join(control, NULL);
+    pthread_barrier_destroy(&barrier);
+
+    dropped = __atomic_load_n(&globals.queue_dropped, __ATOMIC_RELAXED);
+    for (k = 0; k < RACE_DOMAINS; k++) {
+        for (i = 0; i < threads; i++) {
+            race_ok &= race[i][k] && race[i][k] == race[0][k];
+        }
+    }
+
+    test_stop();
+
+    memset(&v, 0, sizeof(v));
+    v.seen = (unsigned char *)calloc((size_t)threads * lines, 1);
+    v.last = (int *)malloc(sizeof(int) * threads * domains);
+    memset(v.last, 0xff, sizeof(int) * threads * domains);
+    total = test_read_lines(dir, verify_line, &v);
+    for (i = 0; i < threads * lines; i++) {
+        missing += !v.seen[i];
+    }
+
+    printf("%-6s %d lines in %.2f s, %d file lines, %d missing, %d duplicated, %d misplaced, %d out of order\n",
+           c->name, threads * lines, (double)(switch_micro_time_now() - start) / 1000000, total,
+           missing, v.duplicated, v.misplaced, v.unordered);
+
+    CHECK(race_ok);
+    CHECK_EQ(dropped, 0);
+    CHECK_EQ(missing, 0);
+    CHECK_EQ(v.duplicated, 0);
+    CHECK_EQ(v.misplaced, 0);
+    CHECK_EQ(v.unordered, 0);
+    CHECK_EQ(v.foreign, 0);
+
+    free(v.seen);
+    free(v.last);
+    test_rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = NULL;
+    char logdir[64];
+    int i, opt;
+
+    while ((opt = getopt(argc, argv, "t:n:d:c:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            lines = atoi(optarg);
+            break;
+        case 'd':
+            domains = atoi(optarg);
+            break;
+        case 'c':
+            only = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-n lines_per_thread] [-d domains] [-c config]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || lines < 1 || domains < 1) {
+        fprintf(stderr, "threads must be 1..%d, lines and domains at least 1\n", MAX_THREADS);
+        return 2;
+    }
+
+    if (domains * 2 > TEST_MAX_SESSIONS) {
+        fprintf(stderr, "at most %d domains\n", TEST_MAX_SESSIONS / 2);
+        return 2;
+    }
+
+    test_mkdtemp(logdir, sizeof(logdir));
+    SWITCH_GLOBAL_dirs.log_dir = logdir;
+
+    /* Two sessions per domain */
+    for (i = 0; i < domains * 2; i++) {
+        char uuid[64], domain[64];
+
+        snprintf(uuid, sizeof(uuid), "uuid-%d-%d", i / 2, i % 2);
+        snprintf(domain, sizeof(domain), "d%d.example.com", i / 2);
+        test_session_add(uuid, domain);
+    }
+
+    for (i = 0; i < (int)(sizeof(configs) / sizeof(configs[0])); i++) {
+        if (!only || !strcmp(only, configs[i].name)) {
+            run_config(&configs[i]);
+        }
+    }
+
+    test_rmdir(logdir);
+
+    if (test_failures) {
+        printf("%d check(s) failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * test_util.h -- Helpers shared by the logging core's tests
+ *
+ * The core is started directly with logfile_domain_start() against the FreeSWITCH
+ * stub in bench/stub, with a host whose sessions are a fixed uuid -> domain table.
+ * Log files are read back through zlib so plain, rotated and compressed generations
+ * are all counted the same way.
+ *
+ */
+
+#ifndef LOGFILE_DOMAIN_TEST_UTIL_H
+#define LOGFILE_DOMAIN_TEST_UTIL_H
+
+#include "../logfile_domain.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdarg.h>
+
+static int test_failures = 0;
+
+#define CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #_cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(_a, _b) \
+    do { \
+        long long _va = (long long)(_a), _vb = (long long)(_b); \
+        if (_va != _vb) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #_a, #_b, _va, _vb); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(_fn) \
+    do { \
+        int _before = test_failures; \
+        _fn(); \
+        printf("%-40s %s\n", #_fn, test_failures == _before ? "ok" : "FAILED"); \
+    } while (0)
+
+/* Sessions the test host knows; domain may be changed between lines, the cache is told */
+#define TEST_MAX_SESSIONS 256
+
+typedef struct {
+    char uuid[64];
+    char domain[DOMAIN_NAME_MAX];
+} test_session_t;
+
+static test_session_t test_sessions[TEST_MAX_SESSIONS];
+static int test_session_count = 0;
+static int test_host_calls = 0;
+
+static int test_session_domain(const char *uuid, char *buf, switch_size_t len)
+{
+    int i;
+
+    __atomic_add_fetch(&test_host_calls, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < test_session_count; i++) {
+        if (!strcmp(test_sessions[i].uuid, uuid)) {
+            switch_copy_string(buf, test_sessions[i].domain, len);
+            return (int)strlen(test_sessions[i].domain);
+        }
+    }
+
+    return -1;
+}
+
+static const logfile_domain_host_t test_host = { test_session_domain };
+
+static void test_session_add(const char *uuid, const char *domain)
+{
+    test_session_t *s = &test_sessions[test_session_count++];
+
+    switch_copy_string(s->uuid, uuid, sizeof(s->uuid));
+    switch_copy_string(s->domain, domain, sizeof(s->domain));
+}
+
+/* Default settings writing to dir, every level mapped and the message fallback on */
+static void test_settings(logfile_domain_settings_t *s, const char *dir)
+{
+    logfile_domain_settings_init(s);
+    switch_copy_string(s->log_dir, dir, sizeof(s->log_dir));
+    s->level_map->all.mask = 0xFFFFFFFFU;
+    s->level_map->all.fallback = SWITCH_TRUE;
+}
+
+static void test_settings_finish(logfile_domain_settings_t *s)
+{
+    level_map_finish(s->level_map, s->log_level);
+    rate_limit_map_finish(s->rate_limits);
+}
+
+static switch_memory_pool_t *test_pool = NULL;
+
+static void test_start(logfile_domain_settings_t *s)
+{
+    test_settings_finish(s);
+    switch_core_new_memory_pool(&test_pool);
+    logfile_domain_start(test_pool, &test_host, s);
+}
+
+static void test_stop(void)
+{
+    logfile_domain_stop();
+    switch_core_destroy_memory_pool(&test_pool);
+}
+
+/* A line logged at timestamp (usec), for tests that need the clock to stand still */
+static void test_log_at(const char *file, switch_log_level_t level, const char *uuid, const char *msg,
+                        switch_time_t timestamp)
+{
+    switch_log_node_t node;
+
+    memset(&node, 0, sizeof(node));
+    node.data = (char *)msg;
+    node.content = (char *)msg;
+    switch_copy_string(node.file, file, sizeof(node.file));
+    switch_copy_string(node.func, "test_fn", sizeof(node.func));
+    node.line = 42;
+    node.level = level;
+    node.timestamp = timestamp;
+    node.userdata = (char *)uuid;
+    node.channel = uuid ? SWITCH_CHANNEL_ID_SESSION : SWITCH_CHANNEL_ID_LOG;
+
+    logfile_domain_log(&node, level);
+}
+
+static void test_log(const char *file, switch_log_level_t level, const char *uuid, const char *msg)
+{
+    test_log_at(file, level, uuid, msg, switch_micro_time_now());
+}
+
+static void test_mkdtemp(char *dir, switch_size_t len)
+{
+    switch_snprintf(dir, len, "/tmp/logfile_domain_test.XXXXXX");
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+}
+
+static void test_rmdir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    char path[512];
+
+    if (!d) {
+        return;
+    }
+    while ((de = readdir(d))) {
+        if (de->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+/* Calls fn for every line of dir's domain_*.log* files, oldest generation first within a
+   domain; gzread() reads plain files as they are */
+typedef void (*test_line_fn)(const char *domain, const char *line, void *arg);
+
+static int test_generation(const char *name)
+{
+    const char *p = strstr(name, ".log");
+
+    return p && p[4] == '.' && p[5] >= '0' && p[5] <= '9' ? atoi(p + 5) : 0;
+}
+
+static int test_file_cmp(const void *a, const void *b)
+{
+    const char *x = *(const char *const *)a, *y = *(const char *const *)b;
+    const char *xe = strstr(x, ".log"), *ye = strstr(y, ".log");
+
+    /* Same domain: higher generation is older, the live file (0) comes last */
+    if ((xe - x) == (ye - y) && !memcmp(x, y, xe - x)) {
+        return test_generation(y) - test_generation(x);
+    }
+
+    return strcmp(x, y);
+}
+
+static int test_read_lines(const char *dir, test_line_fn fn, void *arg)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    char **names = NULL;
+    int n = 0, cap = 0, i, lines = 0;
+
+    if (!d) {
+        return -1;
+    }
+    while ((de = readdir(d))) {
+        if (strncmp(de->d_name, "domain_", 7) || !strstr(de->d_name, ".log")) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            names = (char **)realloc(names, sizeof(char *) * cap);
+        }
+        names[n++] = strdup(de->d_name);
+    }
+    closedir(d);
+
+    qsort(names, n, sizeof(char *), test_file_cmp);
+
+    for (i = 0; i < n; i++) {
+        char path[512], domain[DOMAIN_NAME_MAX], *buf;
+        switch_size_t dlen = strstr(names[i], ".log") - names[i] - 7;
+        gzFile gz;
+
+        snprintf(domain, sizeof(domain), "%.*s", (int)dlen, names[i] + 7);
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        buf = (char *)malloc(65536);
+        if ((gz = gzopen(path, "rb"))) {
+            while (gzgets(gz, buf, 65536)) {
+                fn(domain, buf, arg);
+                lines++;
+            }
+            gzclose(gz);
+        }
+        free(buf);
+        free(names[i]);
+    }
+    free(names);
+
+    return lines;
+}
+
+/* A stream that collects what is written to it */
+typedef struct {
+    switch_stream_handle_t stream;
+    char data[65536];
+    switch_size_t len;
+} test_stream_t;
+
+static switch_status_t test_stream_write(switch_stream_handle_t *handle, const char *fmt, ...)
+{
+    test_stream_t *ts = (test_stream_t *)handle;
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(ts->data + ts->len, sizeof(ts->data) - ts->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        ts->len += (switch_size_t)n < sizeof(ts->data) - ts->len ? (switch_size_t)n : sizeof(ts->data) - ts->len - 1;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void test_stream_init(test_stream_t *ts)
+{
+    memset(ts, 0, sizeof(*ts));
+    ts->stream.write_function = test_stream_write;
+}
+
+#endif